@@ -0,0 +1,311 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "at_exit.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "atomicops.h"
+
+namespace base {
+
+// Keep a stack of registered AtExitManagers. We always operate on the most
+// recent, and we should never have more than one outside of testing (for a
+// statically linked version of this library). Testing may use the shadow
+// version of the constructor, and if we are building a dynamic library we may
+// end up with multiple AtExitManagers on the same process. We don't protect
+// this for thread-safe access, since it will only be modified in testing.
+static AtExitManager* g_top_manager = NULL;
+
+static subtle::Atomic32 g_fast_shutdown = 0;
+
+static subtle::Atomic32 g_teardown_thread_count = 1;
+
+// Results of the last ProcessCallbacksNow().
+static pthread_mutex_t g_timings_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t g_last_teardown_ns = 0;
+static std::vector<AtExitManager::CallbackTiming>* g_last_timings = NULL;
+
+namespace {
+
+struct UnmanagedCallback {
+  AtExitManager::AtExitCallbackType func;
+  void* param;
+};
+
+}  // namespace
+
+// Singleton callbacks registered while no AtExitManager existed. Nothing
+// destroys those singletons, but FastShutdownAndExit() still runs them so that
+// their Flush() hooks are called.
+static pthread_mutex_t g_unmanaged_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<UnmanagedCallback>* g_unmanaged_callbacks = NULL;
+
+namespace {
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// State shared by the threads of AtExitManager::RunInParallel(). Task i may
+// run once |blockers[i]| tasks have completed; then it unblocks the tasks in
+// |unblocks[i]|.
+struct TeardownGraph {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  std::vector<int> blockers;
+  std::vector<std::vector<int> > unblocks;
+  // Runnable tasks. The most recently registered one is picked first, which
+  // keeps the order close to LIFO.
+  std::vector<int> ready;
+  size_t remaining;
+};
+
+}  // namespace
+
+AtExitManager::AtExitManager()
+    : next_manager_(g_top_manager) {
+  pthread_mutex_init(&lock_, NULL);
+  g_top_manager = this;
+}
+
+AtExitManager::~AtExitManager() {
+  if (!g_top_manager) {
+    fprintf(stderr, "Tried to ~AtExitManager without an AtExitManager\n");
+    return;
+  }
+
+  ProcessCallbacksNow();
+  g_top_manager = next_manager_;
+  pthread_mutex_destroy(&lock_);
+}
+
+// static
+void AtExitManager::RegisterCallback(AtExitCallbackType func, void* param) {
+  Callback callback = {func, param, NULL, NULL, NULL, false};
+  Register(callback);
+}
+
+// static
+void AtExitManager::RegisterSingletonCallback(AtExitCallbackType func,
+                                              void* param,
+                                              const void* key,
+                                              const void* parent_key,
+                                              const char* pretty_name,
+                                              bool independent) {
+  Callback callback = {func, param, key, parent_key, pretty_name, independent};
+  Register(callback);
+}
+
+// static
+void AtExitManager::Register(const Callback& callback) {
+  if (!g_top_manager) {
+    // The object simply lives until the process exits, unless it's a
+    // singleton that FastShutdownAndExit() must flush.
+    if (callback.key) {
+      UnmanagedCallback unmanaged = {callback.func, callback.param};
+      pthread_mutex_lock(&g_unmanaged_lock);
+      if (!g_unmanaged_callbacks)
+        g_unmanaged_callbacks = new std::vector<UnmanagedCallback>;
+      g_unmanaged_callbacks->push_back(unmanaged);
+      pthread_mutex_unlock(&g_unmanaged_lock);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&g_top_manager->lock_);
+  g_top_manager->stack_.push_back(callback);
+  pthread_mutex_unlock(&g_top_manager->lock_);
+}
+
+// static
+void AtExitManager::ProcessCallbacksNow() {
+  if (!g_top_manager) {
+    fprintf(stderr,
+            "Tried to ProcessCallbacksNow without an AtExitManager\n");
+    return;
+  }
+
+  // Callbacks may try to add new callbacks, so run them without holding
+  // |lock_|. A singleton created by another singleton's destructor registers
+  // here; it is destroyed by the next call.
+  std::vector<Callback> tasks;
+  pthread_mutex_lock(&g_top_manager->lock_);
+  tasks.swap(g_top_manager->stack_);
+  pthread_mutex_unlock(&g_top_manager->lock_);
+
+  std::vector<CallbackTiming>* timings = new std::vector<CallbackTiming>;
+  timings->reserve(tasks.size());
+  int64_t start = NowNs();
+  int thread_count = subtle::NoBarrier_Load(&g_teardown_thread_count);
+  if (thread_count > 1 && tasks.size() > 1) {
+    RunInParallel(tasks, thread_count, timings);
+  } else {
+    while (!tasks.empty()) {
+      Callback callback = tasks.back();
+      tasks.pop_back();
+      int64_t callback_start = NowNs();
+      callback.func(callback.param);
+      CallbackTiming timing = {callback.pretty_name,
+                               NowNs() - callback_start};
+      timings->push_back(timing);
+    }
+  }
+  int64_t duration = NowNs() - start;
+
+  pthread_mutex_lock(&g_timings_lock);
+  std::swap(g_last_timings, timings);
+  g_last_teardown_ns = duration;
+  pthread_mutex_unlock(&g_timings_lock);
+  delete timings;
+}
+
+// static
+void AtExitManager::RunInParallel(const std::vector<Callback>& tasks,
+                                  int thread_count,
+                                  std::vector<CallbackTiming>* timings) {
+  TeardownGraph graph;
+  pthread_mutex_init(&graph.lock, NULL);
+  pthread_cond_init(&graph.changed, NULL);
+  graph.blockers.assign(tasks.size(), 0);
+  graph.unblocks.resize(tasks.size());
+  graph.remaining = tasks.size();
+
+  // Task j, registered after task i, runs first if either of them must keep
+  // LIFO order, or if i was created by j's creation.
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    for (size_t j = i + 1; j < tasks.size(); ++j) {
+      bool nested = tasks[i].parent_key && tasks[i].parent_key == tasks[j].key;
+      if (!tasks[i].independent || !tasks[j].independent || nested) {
+        graph.unblocks[j].push_back(static_cast<int>(i));
+        ++graph.blockers[i];
+      }
+    }
+  }
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (graph.blockers[i] == 0)
+      graph.ready.push_back(static_cast<int>(i));
+  }
+
+  struct Worker {
+    const std::vector<Callback>* tasks;
+    TeardownGraph* graph;
+    std::vector<CallbackTiming>* timings;
+
+    static void* Run(void* arg) {
+      Worker* worker = static_cast<Worker*>(arg);
+      TeardownGraph* graph = worker->graph;
+      pthread_mutex_lock(&graph->lock);
+      while (graph->remaining > 0) {
+        if (graph->ready.empty()) {
+          pthread_cond_wait(&graph->changed, &graph->lock);
+          continue;
+        }
+        std::vector<int>::iterator latest = graph->ready.begin();
+        for (std::vector<int>::iterator it = graph->ready.begin();
+             it != graph->ready.end(); ++it) {
+          if (*it > *latest)
+            latest = it;
+        }
+        int index = *latest;
+        graph->ready.erase(latest);
+        pthread_mutex_unlock(&graph->lock);
+
+        const Callback& callback = (*worker->tasks)[index];
+        int64_t start = NowNs();
+        callback.func(callback.param);
+        CallbackTiming timing = {callback.pretty_name, NowNs() - start};
+
+        pthread_mutex_lock(&graph->lock);
+        worker->timings->push_back(timing);
+        for (size_t i = 0; i < graph->unblocks[index].size(); ++i) {
+          int next = graph->unblocks[index][i];
+          if (--graph->blockers[next] == 0)
+            graph->ready.push_back(next);
+        }
+        --graph->remaining;
+        pthread_cond_broadcast(&graph->changed);
+      }
+      pthread_mutex_unlock(&graph->lock);
+      return NULL;
+    }
+  };
+
+  Worker worker = {&tasks, &graph, timings};
+  std::vector<pthread_t> threads;
+  for (int i = 1; i < thread_count; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &Worker::Run, &worker) == 0)
+      threads.push_back(thread);
+  }
+  Worker::Run(&worker);
+  for (size_t i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&graph.changed);
+  pthread_mutex_destroy(&graph.lock);
+}
+
+// static
+void AtExitManager::SetTeardownThreadCount(int count) {
+  subtle::NoBarrier_Store(&g_teardown_thread_count, count > 1 ? count : 1);
+}
+
+// static
+int64_t AtExitManager::GetLastTeardownDurationNs() {
+  pthread_mutex_lock(&g_timings_lock);
+  int64_t duration = g_last_teardown_ns;
+  pthread_mutex_unlock(&g_timings_lock);
+  return duration;
+}
+
+// static
+std::vector<AtExitManager::CallbackTiming>
+AtExitManager::GetLastTeardownTimings() {
+  std::vector<CallbackTiming> timings;
+  pthread_mutex_lock(&g_timings_lock);
+  if (g_last_timings)
+    timings = *g_last_timings;
+  pthread_mutex_unlock(&g_timings_lock);
+  return timings;
+}
+
+// static
+void AtExitManager::FastShutdownAndExit(int exit_code) {
+  subtle::Release_Store(&g_fast_shutdown, 1);
+  if (g_top_manager)
+    ProcessCallbacksNow();
+
+  std::vector<UnmanagedCallback> unmanaged;
+  pthread_mutex_lock(&g_unmanaged_lock);
+  if (g_unmanaged_callbacks)
+    unmanaged.swap(*g_unmanaged_callbacks);
+  pthread_mutex_unlock(&g_unmanaged_lock);
+  while (!unmanaged.empty()) {
+    unmanaged.back().func(unmanaged.back().param);
+    unmanaged.pop_back();
+  }
+  fflush(NULL);
+  _exit(exit_code);
+}
+
+// static
+bool AtExitManager::IsFastShutdown() {
+  return subtle::Acquire_Load(&g_fast_shutdown) != 0;
+}
+
+AtExitManager::AtExitManager(bool /*shadow*/)
+    : next_manager_(g_top_manager) {
+  pthread_mutex_init(&lock_, NULL);
+  g_top_manager = this;
+}
+
+}  // namespace base
@@ -0,0 +1,128 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_AT_EXIT_H_
+#define BASE_AT_EXIT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base_export.h"
+
+namespace base {
+
+// This class provides a facility similar to the CRT atexit(), except that
+// we control when the callbacks are executed. Under Windows for a DLL they
+// happen at a really bad time and under the loader lock. This facility is
+// mostly used by base::Singleton.
+//
+// The usage is simple. Early in the main() or WinMain() scope create an
+// AtExitManager object on the stack:
+// int main(...) {
+//    base::AtExitManager exit_manager;
+//
+// }
+// When the exit_manager object goes out of scope, all the registered
+// callbacks and singleton destructors will be called.
+//
+// Servers that restart often can skip the destructors instead: see
+// FastShutdownAndExit(). Slow destructors of independent singletons can also
+// run concurrently: see SetTeardownThreadCount().
+class BASE_EXPORT AtExitManager {
+ public:
+  typedef void (*AtExitCallbackType)(void*);
+
+  // How long one callback took during the last ProcessCallbacksNow().
+  struct CallbackTiming {
+    // __PRETTY_FUNCTION__ of the singleton's creation, see
+    // internal::GetSingletonTypeName(). NULL for plain callbacks.
+    const char* pretty_name;
+    int64_t duration_ns;
+  };
+
+  AtExitManager();
+
+  // The dtor calls all the registered callbacks. Do not try to register more
+  // callbacks after this point.
+  ~AtExitManager();
+
+  // Registers the specified function to be called at exit. The prototype of
+  // the callback function is void func(void*).
+  static void RegisterCallback(AtExitCallbackType func, void* param);
+
+  // Registers the at exit callback of a singleton. |key| identifies the
+  // singleton and |parent_key| the singleton whose creation created it, if
+  // any: the parent is destroyed first, as its destructor may still use it.
+  // If |independent|, the callback may run concurrently with, or out of LIFO
+  // order with respect to, other independent callbacks it has no such
+  // relation with; other callbacks keep strict LIFO order with respect to
+  // everything.
+  static void RegisterSingletonCallback(AtExitCallbackType func,
+                                        void* param,
+                                        const void* key,
+                                        const void* parent_key,
+                                        const char* pretty_name,
+                                        bool independent);
+
+  // Calls the functions registered with RegisterCallback in LIFO order. It
+  // is possible to register new callbacks after calling this function.
+  static void ProcessCallbacksNow();
+
+  // Sets how many threads ProcessCallbacksNow() uses, the calling thread
+  // included. Defaults to 1, which runs everything in LIFO order.
+  static void SetTeardownThreadCount(int count);
+
+  // Wall time spent in the last ProcessCallbacksNow(), and the time taken by
+  // each callback it ran, in the order they completed.
+  static int64_t GetLastTeardownDurationNs();
+  static std::vector<CallbackTiming> GetLastTeardownTimings();
+
+  // Runs the callbacks in fast shutdown mode, then terminates the process
+  // with _exit(|exit_code|), skipping static destructors and atexit()
+  // handlers. In that mode singletons are not deleted, as the kernel
+  // reclaims their memory anyway; only those whose traits have a Flush()
+  // hook get it called, so that buffered output isn't lost. That includes
+  // singletons created while no AtExitManager existed.
+  static void FastShutdownAndExit(int exit_code) __attribute__((noreturn));
+
+  // Whether callbacks are being run by FastShutdownAndExit().
+  static bool IsFastShutdown();
+
+ protected:
+  // This constructor will allow this instance of AtExitManager to be created
+  // even if one already exists. This should only be used for testing!
+  // AtExitManagers are kept on a global stack, and it will be removed during
+  // destruction. This allows you to shadow another AtExitManager.
+  explicit AtExitManager(bool shadow);
+
+ private:
+  struct Callback {
+    AtExitCallbackType func;
+    void* param;
+    const void* key;
+    const void* parent_key;
+    const char* pretty_name;
+    bool independent;
+  };
+
+  static void Register(const Callback& callback);
+  static void RunInParallel(const std::vector<Callback>& tasks,
+                            int thread_count,
+                            std::vector<CallbackTiming>* timings);
+
+  pthread_mutex_t lock_;
+  std::vector<Callback> stack_;
+
+  // Stack of managers to allow shadowing.
+  AtExitManager* next_manager_;
+
+  AtExitManager(const AtExitManager&) = delete;
+  AtExitManager& operator=(const AtExitManager&) = delete;
+};
+
+}  // namespace base
+
+#endif  // BASE_AT_EXIT_H_
@@ -0,0 +1,101 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares base::CallOnce() with std::call_once() and pthread_once(): the
+// cost of a call once the function has run, from one and several threads,
+// and the cost of a round in which several threads race on a fresh flag.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "call_once.h"
+
+namespace {
+
+const int kFastPathCalls = 20000000;
+const int kRaceRounds = 2000;
+const int kThreads = 4;
+
+int g_sink = 0;
+
+void Work() {
+  ++g_sink;
+}
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Runs |call| kFastPathCalls times on each of |threads| threads, returns the
+// average time of a call in nanoseconds.
+template <typename Call>
+double TimeFastPath(int threads, Call call) {
+  int64_t start = NowNs();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([call] {
+      for (int j = 0; j < kFastPathCalls; ++j)
+        call();
+    });
+  }
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  return static_cast<double>(NowNs() - start) / kFastPathCalls;
+}
+
+// Runs kRaceRounds rounds of kThreads threads calling |call|(round) at once;
+// returns the average time of a round in microseconds.
+template <typename Call>
+double TimeRaces(Call call) {
+  int64_t start = NowNs();
+  for (int round = 0; round < kRaceRounds; ++round) {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < kThreads; ++i)
+      workers.emplace_back([call, round] { call(round); });
+    for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
+  }
+  return static_cast<double>(NowNs() - start) / kRaceRounds / 1000;
+}
+
+base::OnceFlag g_base_flag;
+std::once_flag g_std_flag;
+pthread_once_t g_pthread_flag = PTHREAD_ONCE_INIT;
+
+base::OnceFlag g_base_flags[kRaceRounds];
+std::once_flag g_std_flags[kRaceRounds];
+pthread_once_t g_pthread_flags[kRaceRounds];
+
+}  // namespace
+
+int main() {
+  base::CallOnce(g_base_flag, &Work);
+  std::call_once(g_std_flag, &Work);
+  pthread_once(&g_pthread_flag, &Work);
+  for (int i = 0; i < kRaceRounds; ++i)
+    g_pthread_flags[i] = PTHREAD_ONCE_INIT;
+
+  printf("%-20s %16s %16s %16s\n", "", "done, 1 thread", "done, 4 threads",
+         "4-thread race");
+  printf("%-20s %13.2f ns %13.2f ns %13.1f us\n", "base::CallOnce",
+         TimeFastPath(1, [] { base::CallOnce(g_base_flag, &Work); }),
+         TimeFastPath(kThreads, [] { base::CallOnce(g_base_flag, &Work); }),
+         TimeRaces([](int i) { base::CallOnce(g_base_flags[i], &Work); }));
+  printf("%-20s %13.2f ns %13.2f ns %13.1f us\n", "std::call_once",
+         TimeFastPath(1, [] { std::call_once(g_std_flag, &Work); }),
+         TimeFastPath(kThreads, [] { std::call_once(g_std_flag, &Work); }),
+         TimeRaces([](int i) { std::call_once(g_std_flags[i], &Work); }));
+  printf("%-20s %13.2f ns %13.2f ns %13.1f us\n", "pthread_once",
+         TimeFastPath(1, [] { pthread_once(&g_pthread_flag, &Work); }),
+         TimeFastPath(kThreads, [] { pthread_once(&g_pthread_flag, &Work); }),
+         TimeRaces([](int i) { pthread_once(&g_pthread_flags[i], &Work); }));
+  return g_sink == 3 + 3 * kRaceRounds ? 0 : 1;
+}
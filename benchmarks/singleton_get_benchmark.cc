@@ -0,0 +1,82 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures Singleton::get() once the instance exists, from one and several
+// threads, against a function-local static. Run it from "make bench" and
+// "make bench-static-keys" to compare the Acquire_Load check with the
+// patched path of ENABLE_SINGLETON_STATIC_KEYS.
+
+#include <stdio.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
+#include "singleton.h"
+
+namespace {
+
+const int kCalls = 50000000;
+const int kThreads = 4;
+
+// Not constexpr constructible, so that Singleton doesn't use constant
+// storage.
+struct Widget {
+  Widget() : value(1) {}
+  static Widget* GetInstance() { return base::Singleton<Widget>::get(); }
+  int value;
+};
+
+Widget* GetFunctionLocalStatic() {
+  static Widget widget;
+  return &widget;
+}
+
+Widget* volatile g_sink = NULL;
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Runs |get| kCalls times on each of |threads| threads, returns the average
+// time of a call in nanoseconds.
+template <typename Get>
+double TimeGet(int threads, Get get) {
+  int64_t start = NowNs();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([get] {
+      for (int j = 0; j < kCalls; ++j)
+        g_sink = get();
+    });
+  }
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  return static_cast<double>(NowNs() - start) / kCalls;
+}
+
+}  // namespace
+
+int main() {
+  // The second call patches get() when static keys are enabled.
+  Widget::GetInstance();
+  Widget::GetInstance();
+  GetFunctionLocalStatic();
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+  const char* singleton_name = "Singleton (patched)";
+#else
+  const char* singleton_name = "Singleton";
+#endif
+  printf("%-24s %16s %16s\n", "", "1 thread", "4 threads");
+  printf("%-24s %13.2f ns %13.2f ns\n", singleton_name,
+         TimeGet(1, [] { return Widget::GetInstance(); }),
+         TimeGet(kThreads, [] { return Widget::GetInstance(); }));
+  printf("%-24s %13.2f ns %13.2f ns\n", "function-local static",
+         TimeGet(1, [] { return GetFunctionLocalStatic(); }),
+         TimeGet(kThreads, [] { return GetFunctionLocalStatic(); }));
+  return 0;
+}
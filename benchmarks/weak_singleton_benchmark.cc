@@ -0,0 +1,75 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures taking and dropping a WeakSingleton<>::Ref once the instance
+// exists, from one and several threads, against Singleton::get(). Every Ref
+// is a full barrier increment and decrement of one shared reference count,
+// so the cost grows with the number of threads bouncing its cache line.
+
+#include <stdio.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
+#include "singleton.h"
+#include "weak_singleton.h"
+
+namespace {
+
+const int kCalls = 10000000;
+const int kThreads = 4;
+
+struct Widget {
+  Widget() : value(1) {}
+  static Widget* GetInstance() { return base::Singleton<Widget>::get(); }
+  int value;
+};
+
+typedef base::WeakSingleton<Widget> WeakWidget;
+
+int g_sink = 0;
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Runs |use| kCalls times on each of |threads| threads, returns the average
+// time of a call in nanoseconds.
+template <typename Use>
+double TimeUse(int threads, Use use) {
+  int64_t start = NowNs();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([use] {
+      int sum = 0;
+      for (int j = 0; j < kCalls; ++j)
+        sum += use();
+      __atomic_fetch_add(&g_sink, sum, __ATOMIC_RELAXED);
+    });
+  }
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  return static_cast<double>(NowNs() - start) / kCalls;
+}
+
+}  // namespace
+
+int main() {
+  Widget::GetInstance();
+  // Held for the whole run, so that the instance is never reaped and every
+  // Ref below only measures the reference counting.
+  WeakWidget::Ref keep_alive = WeakWidget::get();
+
+  printf("%-24s %16s %16s\n", "", "1 thread", "4 threads");
+  printf("%-24s %13.2f ns %13.2f ns\n", "Singleton::get()",
+         TimeUse(1, [] { return Widget::GetInstance()->value; }),
+         TimeUse(kThreads, [] { return Widget::GetInstance()->value; }));
+  printf("%-24s %13.2f ns %13.2f ns\n", "WeakSingleton Ref",
+         TimeUse(1, [] { return WeakWidget::get()->value; }),
+         TimeUse(kThreads, [] { return WeakWidget::get()->value; }));
+  return g_sink == 2 * (1 + kThreads) * kCalls ? 0 : 1;
+}
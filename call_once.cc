@@ -0,0 +1,72 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "call_once.h"
+
+#include <limits.h>
+#include <sched.h>
+
+#if defined(OS_LINUX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace base {
+namespace internal {
+
+namespace {
+
+// Blocks while |*state| == |value|. May return spuriously.
+void WaitWhileEqual(volatile subtle::Atomic32* state, subtle::Atomic32 value) {
+#if defined(OS_LINUX)
+  syscall(SYS_futex, state, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+  sched_yield();
+#endif
+}
+
+void WakeAll(volatile subtle::Atomic32* state) {
+#if defined(OS_LINUX)
+  syscall(SYS_futex, state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+}  // namespace
+
+bool BeginCallOnce(volatile subtle::Atomic32* state) {
+  while (true) {
+    // Only a successful claim returns true: the flag may also be back to
+    // kOnceIdle because the previous runner threw.
+    subtle::Atomic32 value =
+        subtle::Acquire_CompareAndSwap(state, kOnceIdle, kOnceRunning);
+    if (value == kOnceIdle)
+      return true;
+    if (value == kOnceDone)
+      return false;
+
+    // Somebody else is running the function. Tell them there is a waiter, so
+    // that they issue a wake up when they are done.
+    if (value == kOnceRunning) {
+      value = subtle::Acquire_CompareAndSwap(state, kOnceRunning,
+                                             kOnceRunningWithWaiters);
+      // The runner completed or threw in the meantime; look again.
+      if (value != kOnceRunning && value != kOnceRunningWithWaiters)
+        continue;
+    }
+    WaitWhileEqual(state, kOnceRunningWithWaiters);
+  }
+}
+
+void EndCallOnce(volatile subtle::Atomic32* state, bool completed) {
+  // Releases the visibility over the function's side effects to the readers.
+  subtle::MemoryBarrier();
+  subtle::Atomic32 previous = subtle::NoBarrier_AtomicExchange(
+      state, completed ? kOnceDone : kOnceIdle);
+  if (previous == kOnceRunningWithWaiters)
+    WakeAll(state);
+}
+
+}  // namespace internal
+}  // namespace base
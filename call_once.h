@@ -0,0 +1,103 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// OnceFlag and CallOnce() run a function exactly once, like std::call_once()
+// and pthread_once(), using the same claim-and-publish protocol as
+// Singleton::get():
+//
+//   base::OnceFlag g_init_flag;
+//
+//   void EnsureInitialized() {
+//     base::CallOnce(g_init_flag, &InitializeTables, table_size);
+//   }
+//
+// Once the function has completed, CallOnce() is a single acquire load and a
+// compare. Threads that arrive while the function is running sleep (on a
+// futex on Linux) until it finishes. If the function throws, the flag is reset
+// so that the next caller retries, and the exception propagates.
+
+#ifndef BASE_CALL_ONCE_H_
+#define BASE_CALL_ONCE_H_
+
+#include <utility>
+
+#include "atomicops.h"
+#include "base_export.h"
+
+namespace base {
+namespace internal {
+
+// States of OnceFlag::state_.
+static const subtle::Atomic32 kOnceIdle = 0;
+static const subtle::Atomic32 kOnceRunning = 1;
+static const subtle::Atomic32 kOnceRunningWithWaiters = 2;
+static const subtle::Atomic32 kOnceDone = 3;
+
+// Out of line slow path of CallOnce(). Returns true if the caller won the race
+// and must run the function, false once another caller has completed it.
+BASE_EXPORT bool BeginCallOnce(volatile subtle::Atomic32* state);
+
+// Publishes the outcome of the function run after BeginCallOnce() returned
+// true, and wakes up the waiters.
+BASE_EXPORT void EndCallOnce(volatile subtle::Atomic32* state, bool completed);
+
+// Resets the flag if the function exits by an exception.
+class CallOnceScope {
+ public:
+  explicit CallOnceScope(volatile subtle::Atomic32* state)
+      : state_(state), completed_(false) {}
+  ~CallOnceScope() { EndCallOnce(state_, completed_); }
+
+  void set_completed() { completed_ = true; }
+
+ private:
+  volatile subtle::Atomic32* state_;
+  bool completed_;
+
+  CallOnceScope(const CallOnceScope&) = delete;
+  CallOnceScope& operator=(const CallOnceScope&) = delete;
+};
+
+}  // namespace internal
+
+// A OnceFlag is constant initialized, so it can be a global without a static
+// initializer.
+class OnceFlag {
+ public:
+  constexpr OnceFlag() : state_(internal::kOnceIdle) {}
+
+  // Returns true once a CallOnce() with this flag has completed.
+  bool is_done() const {
+    return subtle::Acquire_Load(&state_) == internal::kOnceDone;
+  }
+
+ private:
+  template <typename Function, typename... Args>
+  friend void CallOnce(OnceFlag& flag, Function&& function, Args&&... args);
+
+  volatile subtle::Atomic32 state_;
+
+  OnceFlag(const OnceFlag&) = delete;
+  OnceFlag& operator=(const OnceFlag&) = delete;
+};
+
+// Calls function(args...) unless a call with |flag| already completed. All
+// callers return after the function has completed, and see its side effects.
+template <typename Function, typename... Args>
+inline void CallOnce(OnceFlag& flag, Function&& function, Args&&... args) {
+  // The load has acquire memory ordering as the thread which sees kOnceDone
+  // must acquire visibility over what the function did.
+  if (subtle::Acquire_Load(&flag.state_) == internal::kOnceDone)
+    return;
+  if (!internal::BeginCallOnce(&flag.state_))
+    return;
+
+  internal::CallOnceScope scope(&flag.state_);
+  std::forward<Function>(function)(std::forward<Args>(args)...);
+  scope.set_completed();
+}
+
+}  // namespace base
+
+#endif  // BASE_CALL_ONCE_H_
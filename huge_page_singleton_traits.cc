@@ -0,0 +1,210 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "huge_page_singleton_traits.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "atomicops.h"
+#include "singleton_memory.h"
+
+namespace base {
+
+namespace {
+
+// Used when the kernel doesn't report a size; the usual one on x86-64 and
+// on arm64 with 4K pages.
+const size_t kDefaultHugePageSize = 2 * 1024 * 1024;
+
+// Returns the default hugetlbfs page size, which is what MAP_HUGETLB without
+// a size flag uses. It is 1GB with default_hugepagesz=1G, 512MB on arm64
+// with 64K pages.
+size_t ReadHugeTlbPageSize() {
+  FILE* meminfo = fopen("/proc/meminfo", "r");
+  if (!meminfo)
+    return 0;
+  char line[128];
+  unsigned long kilobytes = 0;
+  while (fgets(line, sizeof(line), meminfo)) {
+    if (sscanf(line, "Hugepagesize: %lu kB", &kilobytes) == 1)
+      break;
+  }
+  fclose(meminfo);
+  return static_cast<size_t>(kilobytes) * 1024;
+}
+
+// Returns the size of a transparent huge page, which is the size a PMD maps.
+size_t ReadTransparentHugePageSize() {
+  FILE* file =
+      fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+  if (!file)
+    return 0;
+  unsigned long bytes = 0;
+  if (fscanf(file, "%lu", &bytes) != 1)
+    bytes = 0;
+  fclose(file);
+  return static_cast<size_t>(bytes);
+}
+
+bool IsPowerOfTwo(size_t value) {
+  return value && !(value & (value - 1));
+}
+
+size_t RoundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// MAP_HUGETLB mappings, which are rounded to GetHugePageSize() rather than
+// to GetTransparentHugePageSize(). munmap() of a hugetlb mapping must cover
+// whole huge pages, so FreeHugePageMemory() needs to tell them apart.
+struct HugeTlbMapping {
+  void* address;
+  HugeTlbMapping* next;
+};
+
+pthread_mutex_t g_huge_tlb_lock = PTHREAD_MUTEX_INITIALIZER;
+HugeTlbMapping* g_huge_tlb_mappings = NULL;
+
+void AddHugeTlbMapping(void* address) {
+  HugeTlbMapping* mapping = new HugeTlbMapping;
+  mapping->address = address;
+  pthread_mutex_lock(&g_huge_tlb_lock);
+  mapping->next = g_huge_tlb_mappings;
+  g_huge_tlb_mappings = mapping;
+  pthread_mutex_unlock(&g_huge_tlb_lock);
+}
+
+// Returns true if |address| was a MAP_HUGETLB mapping, and forgets it.
+bool RemoveHugeTlbMapping(void* address) {
+  HugeTlbMapping* found = NULL;
+  pthread_mutex_lock(&g_huge_tlb_lock);
+  for (HugeTlbMapping** link = &g_huge_tlb_mappings; *link;
+       link = &(*link)->next) {
+    if ((*link)->address == address) {
+      found = *link;
+      *link = found->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_huge_tlb_lock);
+  delete found;
+  return found != NULL;
+}
+
+
+void FaultIn(void* address, size_t size) {
+#if defined(MADV_POPULATE_WRITE)
+  if (madvise(address, size, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  // Older kernels: touch every page. Writing is what allocates the page; a
+  // read would map the shared zero page.
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  volatile char* bytes = static_cast<volatile char*>(address);
+  for (size_t offset = 0; offset < size; offset += page_size)
+    bytes[offset] = 0;
+}
+
+}  // namespace
+
+size_t GetHugePageSize() {
+  static subtle::AtomicWord huge_page_size = 0;
+  subtle::AtomicWord size = subtle::Acquire_Load(&huge_page_size);
+  if (size == 0) {
+    size_t huge_tlb = ReadHugeTlbPageSize();
+    if (!IsPowerOfTwo(huge_tlb))
+      huge_tlb = kDefaultHugePageSize;
+    size = static_cast<subtle::AtomicWord>(huge_tlb);
+    subtle::Release_Store(&huge_page_size, size);
+  }
+  return static_cast<size_t>(size);
+}
+
+size_t GetTransparentHugePageSize() {
+  static subtle::AtomicWord huge_page_size = 0;
+  subtle::AtomicWord size = subtle::Acquire_Load(&huge_page_size);
+  if (size == 0) {
+    // Without transparent huge pages, the fallback is regular pages and
+    // there is nothing to align to.
+    size_t transparent = ReadTransparentHugePageSize();
+    if (!IsPowerOfTwo(transparent))
+      transparent = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size = static_cast<subtle::AtomicWord>(transparent);
+    subtle::Release_Store(&huge_page_size, size);
+  }
+  return static_cast<size_t>(size);
+}
+
+void* AllocateHugePageMemory(size_t size,
+                             HugePagePrefault prefault,
+                             HugePageBacking* backing) {
+  if (!size)
+    size = 1;
+#if defined(MAP_HUGETLB)
+  int populate = prefault == kPrefaultHugePages ? MAP_POPULATE : 0;
+  size_t huge_tlb_size = RoundUp(size, GetHugePageSize());
+  void* huge_tlb = mmap(NULL, huge_tlb_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate,
+                        -1, 0);
+  if (huge_tlb != MAP_FAILED) {
+    AddHugeTlbMapping(huge_tlb);
+    if (backing)
+      *backing = kHugeTlbPages;
+    internal::ChargeSingletonMemoryBlock(huge_tlb, huge_tlb_size);
+    return huge_tlb;
+  }
+#endif
+
+  // Over-reserve so that the mapping can be trimmed to a huge page boundary;
+  // transparent huge pages are only used for aligned ranges.
+  size_t huge_page_size = GetTransparentHugePageSize();
+  size_t mapped = RoundUp(size, huge_page_size);
+  size_t reserved = mapped + huge_page_size;
+  void* reservation = mmap(NULL, reserved, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reservation == MAP_FAILED)
+    abort();
+
+  uintptr_t begin = reinterpret_cast<uintptr_t>(reservation);
+  uintptr_t aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+  uintptr_t end = begin + reserved;
+  if (aligned != begin)
+    munmap(reservation, aligned - begin);
+  if (aligned + mapped != end)
+    munmap(reinterpret_cast<void*>(aligned + mapped), end - (aligned + mapped));
+  void* memory = reinterpret_cast<void*>(aligned);
+
+  HugePageBacking got = kRegularPages;
+#if defined(MADV_HUGEPAGE)
+  if (madvise(memory, mapped, MADV_HUGEPAGE) == 0)
+    got = kTransparentHugePages;
+#endif
+  // Prefault only after madvise(), or the range would be filled with regular
+  // pages before the kernel knows it should use huge ones. Only the bytes
+  // asked for: the rest of the last huge page may never be used.
+  if (prefault == kPrefaultHugePages)
+    FaultIn(memory, size);
+
+  if (backing)
+    *backing = got;
+  internal::ChargeSingletonMemoryBlock(memory, mapped);
+  return memory;
+}
+
+void FreeHugePageMemory(void* address, size_t size) {
+  internal::CreditSingletonMemoryBlock(address);
+  if (!size)
+    size = 1;
+  size_t huge_page_size = RemoveHugeTlbMapping(address)
+                              ? GetHugePageSize()
+                              : GetTransparentHugePageSize();
+  munmap(address, RoundUp(size, huge_page_size));
+}
+
+}  // namespace base
@@ -0,0 +1,107 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// HugePageSingletonTraits<Type> backs a large singleton (lookup tables of
+// hundreds of MB and more) with huge pages, to cut TLB misses, and can fault
+// all of its memory in up front, so that first-touch page faults happen while
+// the singleton is constructed rather than on the first requests served.
+//
+// Example usage:
+//   struct RoutingTable {
+//     Entry entries[1 << 26];
+//   };
+//
+//   RoutingTable* RoutingTable::GetInstance() {
+//     return Singleton<RoutingTable,
+//         HugePageSingletonTraits<RoutingTable, kPrefaultHugePages> >::get();
+//   }
+//
+// Objects that keep their bulk in containers can allocate it with
+// AllocateHugePageMemory() from their constructor instead.
+
+#ifndef BASE_MEMORY_HUGE_PAGE_SINGLETON_TRAITS_H_
+#define BASE_MEMORY_HUGE_PAGE_SINGLETON_TRAITS_H_
+
+#include <stddef.h>
+
+#include <new>
+#include <type_traits>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+enum HugePagePrefault {
+  // Pages are faulted in on first touch.
+  kLazyHugePages,
+  // All pages are faulted in by the allocation.
+  kPrefaultHugePages,
+};
+
+// What an allocation ended up being backed by, from best to worst.
+enum HugePageBacking {
+  // Explicit huge pages from the hugetlbfs pool (MAP_HUGETLB).
+  kHugeTlbPages,
+  // Transparent huge pages requested with madvise(MADV_HUGEPAGE).
+  kTransparentHugePages,
+  // Regular pages.
+  kRegularPages,
+};
+
+// Returns the default hugetlbfs page size, which MAP_HUGETLB allocations are
+// aligned and rounded to, 2MB if the kernel doesn't report it.
+BASE_EXPORT size_t GetHugePageSize();
+
+// Returns the transparent huge page size, which the other allocations are
+// aligned and rounded to, or the regular page size if the kernel has no
+// transparent huge pages. It may be smaller than GetHugePageSize(), e.g. with
+// default_hugepagesz=1G.
+BASE_EXPORT size_t GetTransparentHugePageSize();
+
+// Maps at least |size| bytes of zeroed, read-write memory aligned to a huge
+// page. Tries MAP_HUGETLB first, then transparent huge pages, then regular
+// pages. Stores what it got in |backing| if not NULL. Aborts if the memory
+// can't be mapped at all. kPrefaultHugePages faults in the |size| bytes asked
+// for, or the whole mapping for MAP_HUGETLB, which reserves it anyway.
+BASE_EXPORT void* AllocateHugePageMemory(size_t size,
+                                         HugePagePrefault prefault,
+                                         HugePageBacking* backing);
+
+// Unmaps memory returned by AllocateHugePageMemory() for the same |size|.
+BASE_EXPORT void FreeHugePageMemory(void* address, size_t size);
+
+// Traits for Singleton<Type> that place the instance in memory returned by
+// AllocateHugePageMemory().
+template <typename Type, HugePagePrefault kPrefault = kLazyHugePages>
+struct SINGLETON_EXPORT HugePageSingletonTraits {
+  static Type* New() {
+    void* memory = AllocateHugePageMemory(sizeof(Type), kPrefault, NULL);
+    return New(memory, std::is_trivially_default_constructible<Type>());
+  }
+
+  static void Delete(Type* x) {
+    x->~Type();
+    FreeHugePageMemory(x, sizeof(Type));
+  }
+
+  static const bool kRegisterAtExit = false;
+
+ private:
+  static Type* New(void* memory, std::false_type) {
+    // The parenthesis is very important here; it forces POD type
+    // initialization.
+    return new (memory) Type();
+  }
+
+  // The memory is already zeroed; value-initializing would only write the
+  // zeroes again and fault in every page of a lazily backed table.
+  static Type* New(void* memory, std::true_type) {
+    return new (memory) Type;
+  }
+};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_HUGE_PAGE_SINGLETON_TRAITS_H_
@@ -0,0 +1,251 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// KeyedSingleton<Type, Key> manages one lazily created instance of Type per
+// runtime key (tenant, shard, model id, ...), with the same thread-safety
+// guarantees as Singleton<Type>. Use DifferentiatingType on Singleton<> when
+// the keys are known at compile time; it is cheaper.
+
+#ifndef BASE_MEMORY_KEYED_SINGLETON_H_
+#define BASE_MEMORY_KEYED_SINGLETON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+#include "atomicops.h"
+#include "singleton.h"
+
+namespace base {
+
+// Default traits for KeyedSingleton<Type, Key>. Constructs the instance from
+// its key with operator new and destroys it with operator delete.
+template <typename Type, typename Key>
+struct SINGLETON_EXPORT DefaultKeyedSingletonTraits {
+  // Allocates the instance for |key|.
+  static Type* New(const Key& key) { return new Type(key); }
+
+  // Destroys the object.
+  static void Delete(Type* x) { delete x; }
+
+  static size_t Hash(const Key& key) { return std::hash<Key>()(key); }
+
+  // Number of slots in the first hash table. Must be a power of two. Further
+  // tables, each twice as large as the previous one, are chained as needed.
+  static const size_t kInitialCapacity = 64;
+
+  // Set to true to allow KeyedSingleton<>::Evict().
+  static const bool kAllowEviction = false;
+};
+
+// The table is a chain of open addressed hash tables that only ever grow.
+// Every slot goes through the same states as Singleton<>::instance_:
+//   0                    -> empty
+//   kBeingCreatedMarker  -> claimed by a thread that is publishing a key
+//   Entry*               -> key published
+// and every Entry's instance word goes through them once more to construct the
+// Type for that key. Lookups of existing keys are a handful of acquire loads
+// and never block; only the thread that claims a slot or an entry constructs.
+//
+// Slots are never emptied, so a key always stays on the probe path where it
+// was first inserted. Evict() only destroys the Type; the key's entry stays
+// and the next get() of that key recreates the instance in place.
+//
+// Nothing is destroyed at exit: unlike Singleton<>, instances aren't
+// registered with the AtExitManager, whatever the traits, and entries and
+// tables are leaked like those of LeakySingletonTraits. Types that must run
+// their destructor should be Evict()ed explicitly during shutdown.
+//
+// Example usage:
+//   Tenant* tenant = KeyedSingleton<Tenant, std::string>::get(tenant_id);
+//
+// get() is public because the key is a runtime value, so there is no single
+// GetInstance() to befriend. The same rule about not inlining accessors
+// across targets applies as for Singleton<>.
+template <typename Type,
+          typename Key,
+          typename Traits = DefaultKeyedSingletonTraits<Type, Key>,
+          typename DifferentiatingType = Type>
+class SINGLETON_EXPORT KeyedSingleton {
+ public:
+  // Returns the instance for |key|, creating it if needed.
+  static Type* get(const Key& key) {
+    Entry* entry = FindOrInsertEntry(key, true);
+
+    while (true) {
+      subtle::AtomicWord value = subtle::Acquire_Load(&entry->instance);
+      if (value != 0 && value != internal::kBeingCreatedMarker)
+        return reinterpret_cast<Type*>(value);
+
+      if (value == 0) {
+        // Lets a child forked from here on undo the marker if we set it.
+        int creation = internal::BeginSingletonCreation(&entry->instance);
+        if (subtle::Acquire_CompareAndSwap(&entry->instance, 0,
+                                           internal::kBeingCreatedMarker) ==
+            0) {
+          internal::SingletonCreation frame = {&entry->instance,
+                                               __PRETTY_FUNCTION__, NULL};
+          internal::PushSingletonCreation(&frame);
+          Type* newval = Traits::New(entry->key);
+          internal::PopSingletonCreation(&frame);
+          subtle::Release_Store(&entry->instance,
+                                reinterpret_cast<subtle::AtomicWord>(newval));
+          internal::EndSingletonCreation(creation);
+          return newval;
+        }
+        internal::EndSingletonCreation(creation);
+      }
+
+      // Somebody else is creating (or evicting) this key's instance. If it
+      // was evicted we go around and race to recreate it.
+      value = internal::WaitForInstance(&entry->instance);
+      if (value != 0)
+        return reinterpret_cast<Type*>(value);
+    }
+  }
+
+  // Destroys the instance for |key|, if any. Returns true if an instance was
+  // destroyed. Like Singleton<>::OnExit(), calling this while the instance is
+  // in use by other threads is a mistake: the caller must guarantee that no
+  // pointer previously returned by get(key) is still being used.
+  static bool Evict(const Key& key) {
+    static_assert(Traits::kAllowEviction,
+                  "Set Traits::kAllowEviction to use KeyedSingleton::Evict()");
+    Entry* entry = FindOrInsertEntry(key, false);
+    if (!entry)
+      return false;
+
+    subtle::AtomicWord value = subtle::Acquire_Load(&entry->instance);
+    if (value == 0 || value == internal::kBeingCreatedMarker)
+      return false;
+    int creation = internal::BeginSingletonCreation(&entry->instance);
+    if (subtle::Acquire_CompareAndSwap(&entry->instance, value,
+                                       internal::kBeingCreatedMarker) != value) {
+      internal::EndSingletonCreation(creation);
+      return false;
+    }
+    Traits::Delete(reinterpret_cast<Type*>(value));
+    subtle::Release_Store(&entry->instance, 0);
+    internal::EndSingletonCreation(creation);
+    return true;
+  }
+
+ private:
+  struct Entry {
+    explicit Entry(const Key& k) : key(k), instance(0) {}
+
+    const Key key;
+    subtle::AtomicWord instance;
+  };
+
+  struct Table {
+    size_t mask;
+    subtle::AtomicWord next;
+    subtle::AtomicWord slots[1];
+  };
+
+  static_assert(Traits::kInitialCapacity != 0 &&
+                    (Traits::kInitialCapacity &
+                     (Traits::kInitialCapacity - 1)) == 0,
+                "kInitialCapacity must be a power of two");
+
+  // Bounds the probe sequence inside one table so that lookups stay short;
+  // once exhausted, probing continues in the next (larger) table.
+  static const size_t kMaxProbes = 8;
+
+  // Returns the table stored in |*link|, publishing a new one of |capacity|
+  // slots if there is none yet. Losers of the publication race free theirs.
+  static Table* GetOrCreateTable(subtle::AtomicWord* link, size_t capacity) {
+    subtle::AtomicWord value = subtle::Acquire_Load(link);
+    if (value != 0)
+      return reinterpret_cast<Table*>(value);
+
+    size_t bytes = sizeof(Table) + (capacity - 1) * sizeof(subtle::AtomicWord);
+    Table* table = static_cast<Table*>(::operator new(bytes));
+    table->mask = capacity - 1;
+    table->next = 0;
+    for (size_t i = 0; i < capacity; ++i)
+      table->slots[i] = 0;
+
+    value = subtle::Release_CompareAndSwap(
+        link, 0, reinterpret_cast<subtle::AtomicWord>(table));
+    if (value == 0)
+      return table;
+    ::operator delete(table);
+    // Pairs with the winner's release.
+    return reinterpret_cast<Table*>(subtle::Acquire_Load(link));
+  }
+
+  // Spreads weak hashes such as std::hash<int> across the table.
+  static size_t MixHash(size_t hash) {
+    uint64_t h = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  // Returns the entry for |key|. If there is none, inserts it when |insert| is
+  // true and returns NULL otherwise.
+  static Entry* FindOrInsertEntry(const Key& key, bool insert) {
+    size_t hash = MixHash(Traits::Hash(key));
+    subtle::AtomicWord* link = &table_;
+    size_t capacity = Traits::kInitialCapacity;
+
+    while (true) {
+      Table* table;
+      if (insert) {
+        table = GetOrCreateTable(link, capacity);
+      } else {
+        table = reinterpret_cast<Table*>(subtle::Acquire_Load(link));
+        if (!table)
+          return NULL;
+      }
+
+      size_t probes = kMaxProbes;
+      if (probes > capacity)
+        probes = capacity;
+      for (size_t i = 0; i < probes; ++i) {
+        subtle::AtomicWord* slot = &table->slots[(hash + i) & table->mask];
+        subtle::AtomicWord value = subtle::Acquire_Load(slot);
+
+        if (value == 0) {
+          if (!insert)
+            return NULL;
+          int creation = internal::BeginSingletonCreation(slot);
+          if (subtle::Acquire_CompareAndSwap(
+                  slot, 0, internal::kBeingCreatedMarker) == 0) {
+            Entry* entry = new Entry(key);
+            subtle::Release_Store(slot,
+                                  reinterpret_cast<subtle::AtomicWord>(entry));
+            internal::EndSingletonCreation(creation);
+            return entry;
+          }
+          internal::EndSingletonCreation(creation);
+          value = subtle::Acquire_Load(slot);
+        }
+        if (value == internal::kBeingCreatedMarker)
+          value = internal::WaitForInstance(slot);
+
+        Entry* entry = reinterpret_cast<Entry*>(value);
+        if (entry->key == key)
+          return entry;
+      }
+
+      link = &table->next;
+      capacity *= 2;
+    }
+  }
+
+  static subtle::AtomicWord table_;
+};
+
+template <typename Type,
+          typename Key,
+          typename Traits,
+          typename DifferentiatingType>
+subtle::AtomicWord
+    KeyedSingleton<Type, Key, Traits, DifferentiatingType>::table_ = 0;
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_KEYED_SINGLETON_H_
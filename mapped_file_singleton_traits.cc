@@ -0,0 +1,105 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "mapped_file_singleton_traits.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace base {
+namespace internal {
+
+namespace {
+
+// Sizes of the live mappings, needed to unmap them. There is one per mapped
+// file singleton, so a list is fine.
+struct Mapping {
+  const void* address;
+  size_t size;
+  Mapping* next;
+};
+
+pthread_mutex_t g_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+Mapping* g_mappings = NULL;
+
+void LogFailure(const char* path, const char* what, const char* reason) {
+  fprintf(stderr, "Failed to map %s: %s: %s\n", path, what, reason);
+}
+
+}  // namespace
+
+const void* MapReadOnlyFile(const char* path,
+                            size_t* size,
+                            MappedFilePrefetch prefetch) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LogFailure(path, "open()", strerror(errno));
+    return NULL;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    LogFailure(path, "fstat()", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  // mmap() refuses empty files, and there would be nothing to validate.
+  if (info.st_size == 0) {
+    LogFailure(path, "fstat()", "empty file");
+    close(fd);
+    return NULL;
+  }
+
+  // MAP_PRIVATE with PROT_READ shares the page cache pages with every other
+  // process mapping the file; nothing is copied unless written, which
+  // PROT_READ rules out.
+  size_t file_size = static_cast<size_t>(info.st_size);
+  void* data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LogFailure(path, "mmap()", strerror(errno));
+    return NULL;
+  }
+  if (prefetch == kMappedFileWillNeed)
+    madvise(data, file_size, MADV_WILLNEED);
+
+  Mapping* mapping = new Mapping;
+  mapping->address = data;
+  mapping->size = file_size;
+  pthread_mutex_lock(&g_mappings_lock);
+  mapping->next = g_mappings;
+  g_mappings = mapping;
+  pthread_mutex_unlock(&g_mappings_lock);
+  ChargeSingletonMemoryBlock(data, file_size);
+
+  *size = file_size;
+  return data;
+}
+
+void UnmapReadOnlyFile(const void* address) {
+  Mapping* found = NULL;
+  pthread_mutex_lock(&g_mappings_lock);
+  for (Mapping** link = &g_mappings; *link; link = &(*link)->next) {
+    if ((*link)->address == address) {
+      found = *link;
+      *link = found->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_mappings_lock);
+
+  if (found) {
+    CreditSingletonMemoryBlock(found->address);
+    munmap(const_cast<void*>(found->address), found->size);
+    delete found;
+  }
+}
+
+}  // namespace internal
+}  // namespace base
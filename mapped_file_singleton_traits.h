@@ -0,0 +1,147 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// MappedFileSingletonTraits<Type> makes Singleton<Type> map a data file
+// read-only and return its contents as the instance, instead of constructing
+// an object and filling it from the file. Nothing is read, parsed or copied at
+// startup: pages are faulted in from the page cache as they are first used,
+// and every process mapping the file shares them.
+//
+// The file is a binary image of Type. Type must be trivially copyable, and
+// anything it points to must be stored in the file as well, referenced
+// through OffsetPtr<> so that the layout does not depend on where the file
+// ends up mapped:
+//   struct WordList {
+//     uint32_t magic;
+//     uint32_t count;
+//     OffsetPtr<Word> words;  // |count| Words, elsewhere in the file.
+//   };
+//
+//   struct WordListTraits
+//       : MappedFileSingletonTraits<WordList, WordListTraits> {
+//     static const char* Path() { return "/usr/share/foo/words.bin"; }
+//     static bool Validate(const WordList* list, size_t size) { ... }
+//   };
+//
+//   WordList* WordList::GetInstance() {
+//     return Singleton<WordList, WordListTraits>::get();
+//   }
+//
+// The mapping is read-only; writing to the instance crashes. If the file
+// can't be mapped or fails validation, get() returns NULL and the next call
+// tries again.
+
+#ifndef BASE_MEMORY_MAPPED_FILE_SINGLETON_TRAITS_H_
+#define BASE_MEMORY_MAPPED_FILE_SINGLETON_TRAITS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+// A pointer stored as the distance from itself to its target, so that a
+// structure made of OffsetPtrs can be written to a file and used at any
+// address it is mapped at. A null OffsetPtr has an offset of 0.
+template <typename T>
+class OffsetPtr {
+ public:
+  OffsetPtr() : offset_(0) {}
+
+  // For tools that build the image in memory before writing it out.
+  void set(const T* target) {
+    offset_ = target ? reinterpret_cast<intptr_t>(target) -
+                           reinterpret_cast<intptr_t>(this)
+                     : 0;
+  }
+
+  const T* get() const {
+    if (!offset_)
+      return NULL;
+    return reinterpret_cast<const T*>(reinterpret_cast<intptr_t>(this) +
+                                      static_cast<intptr_t>(offset_));
+  }
+
+  const T* operator->() const { return get(); }
+  const T& operator*() const { return *get(); }
+  const T& operator[](size_t index) const { return get()[index]; }
+
+  // Whether |count| Ts at the target lie within [base, base + size). Use it
+  // to validate an image before trusting its offsets.
+  bool IsWithin(const void* base, size_t size, size_t count) const {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(base);
+    uintptr_t target = reinterpret_cast<uintptr_t>(get());
+    if (!target || target < begin || target - begin > size ||
+        target % alignof(T) != 0) {
+      return false;
+    }
+    return count <= (size - (target - begin)) / sizeof(T);
+  }
+
+ private:
+  int64_t offset_;
+};
+
+enum MappedFilePrefetch {
+  // Pages are read in when first touched.
+  kMappedFileLazy,
+  // Ask the kernel to start reading the whole file in the background as soon
+  // as it is mapped (MADV_WILLNEED). get() still doesn't wait for it.
+  kMappedFileWillNeed,
+};
+
+namespace internal {
+
+// Maps the file at |path| read-only and stores its size in |size|. Returns
+// NULL and logs the reason if the file can't be opened or mapped.
+BASE_EXPORT const void* MapReadOnlyFile(const char* path,
+                                        size_t* size,
+                                        MappedFilePrefetch prefetch);
+
+// Unmaps memory returned by MapReadOnlyFile().
+BASE_EXPORT void UnmapReadOnlyFile(const void* address);
+
+}  // namespace internal
+
+// Traits for Singleton<Type> that map the file named by Derived::Path().
+// Derived is the traits struct deriving from this one, which provides Path()
+// and, if the file comes from outside the build, Validate().
+template <typename Type,
+          typename Derived,
+          MappedFilePrefetch kPrefetch = kMappedFileLazy>
+struct SINGLETON_EXPORT MappedFileSingletonTraits {
+  static_assert(std::is_trivially_copyable<Type>::value,
+                "Type must be a plain image of the file's bytes");
+
+  static Type* New() {
+    size_t size = 0;
+    const void* data =
+        internal::MapReadOnlyFile(Derived::Path(), &size, kPrefetch);
+    if (!data)
+      return NULL;
+    if (!Derived::Validate(static_cast<const Type*>(data), size)) {
+      internal::UnmapReadOnlyFile(data);
+      return NULL;
+    }
+    return static_cast<Type*>(const_cast<void*>(data));
+  }
+
+  static void Delete(Type* x) { internal::UnmapReadOnlyFile(x); }
+
+  // Checks the mapped image before it is handed out. |size| is the size of
+  // the file. The default only checks that the file is large enough.
+  static bool Validate(const Type* /*data*/, size_t size) {
+    return size >= sizeof(Type);
+  }
+
+  static const bool kRegisterAtExit = false;
+};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_MAPPED_FILE_SINGLETON_TRAITS_H_
@@ -0,0 +1,168 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "numa_singleton_traits.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "atomicops.h"
+#include "singleton_memory.h"
+
+namespace base {
+
+namespace {
+
+// From <linux/mempolicy.h>, which not every toolchain ships.
+const int kMpolPreferred = 1;
+const int kMpolBind = 2;
+const int kMpolInterleave = 3;
+
+// Large enough for any node count the kernel supports by default.
+const int kMaxNodes = 1024;
+const int kBitsPerWord = sizeof(unsigned long) * 8;
+
+struct NodeMask {
+  unsigned long bits[kMaxNodes / kBitsPerWord];
+  // One more than the highest node in |bits|, 0 if empty.
+  int size;
+};
+
+void AddNode(NodeMask* mask, int node) {
+  mask->bits[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+  if (node >= mask->size)
+    mask->size = node + 1;
+}
+
+// Parses a node list such as "0-3,5" from |path|. Returns false if the file
+// can't be read or names a node outside the mask.
+bool ReadNodeList(const char* path, NodeMask* mask) {
+  memset(mask, 0, sizeof(*mask));
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return false;
+  bool valid = true;
+  int first = 0;
+  while (fscanf(file, "%d", &first) == 1) {
+    int last = first;
+    int separator = fgetc(file);
+    if (separator == '-') {
+      if (fscanf(file, "%d", &last) != 1)
+        break;
+      separator = fgetc(file);
+    }
+    if (first < 0 || last < first || last >= kMaxNodes) {
+      valid = false;
+      break;
+    }
+    for (int node = first; node <= last; ++node)
+      AddNode(mask, node);
+    if (separator != ',')
+      break;
+  }
+  fclose(file);
+  return valid && mask->size > 0;
+}
+
+size_t RoundUpToPage(size_t size) {
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+int CountNodes() {
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (!dir)
+    return 1;
+  int count = 0;
+  while (struct dirent* entry = readdir(dir)) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' &&
+        entry->d_name[4] <= '9') {
+      ++count;
+    }
+  }
+  closedir(dir);
+  return count > 0 ? count : 1;
+}
+
+int CurrentNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    return 0;
+  return static_cast<int>(node);
+}
+
+}  // namespace
+
+namespace internal {
+
+bool ApplyNumaPolicy(void* address, size_t size, NumaPlacement placement,
+                     int node) {
+  NodeMask mask;
+  int mode = kMpolBind;
+  if (placement == kNumaInterleave) {
+    mode = kMpolInterleave;
+    // Only nodes with memory: the kernel rejects the whole mask if it names
+    // a node that isn't online or that the cpuset doesn't allow.
+    if (!ReadNodeList("/sys/devices/system/node/has_memory", &mask))
+      return false;
+  } else {
+    if (placement == kNumaFirstAccessor) {
+      // Preferred rather than bound, so that the kernel falls back to other
+      // nodes once this one is full instead of failing the allocation.
+      mode = kMpolPreferred;
+      node = CurrentNode();
+    }
+    if (node < 0 || node >= kMaxNodes)
+      return false;
+    memset(&mask, 0, sizeof(mask));
+    AddNode(&mask, node);
+  }
+  // The kernel reads |maxnode| - 1 bits.
+  return syscall(SYS_mbind, address, size, mode, mask.bits,
+                 static_cast<unsigned long>(mask.size + 1), 0) == 0;
+}
+
+}  // namespace internal
+
+int GetNumaNodeCount() {
+  static subtle::Atomic32 node_count = 0;
+  subtle::Atomic32 count = subtle::Acquire_Load(&node_count);
+  if (count == 0) {
+    count = CountNodes();
+    subtle::Release_Store(&node_count, count);
+  }
+  return count;
+}
+
+void* AllocateNumaMemory(size_t size,
+                         NumaPlacement placement,
+                         int node,
+                         bool* policy_applied) {
+  size = RoundUpToPage(size ? size : 1);
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    abort();
+  // The policy only affects pages faulted in after it is set, so it has to
+  // go before the constructor touches anything.
+  bool applied = GetNumaNodeCount() > 1 &&
+                 internal::ApplyNumaPolicy(memory, size, placement, node);
+  if (policy_applied)
+    *policy_applied = applied;
+  internal::ChargeSingletonMemoryBlock(memory, size);
+  return memory;
+}
+
+void FreeNumaMemory(void* address, size_t size) {
+  internal::CreditSingletonMemoryBlock(address);
+  munmap(address, RoundUpToPage(size ? size : 1));
+}
+
+}  // namespace base
@@ -0,0 +1,95 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// NumaSingletonTraits<Type> controls which NUMA node(s) back the memory of a
+// singleton that can't be replicated per node. Shared read-mostly tables are
+// best interleaved so that no node's memory controller serves every access;
+// objects used by threads pinned to one node are best bound to that node.
+//
+// Example usage:
+//   Dictionary* Dictionary::GetInstance() {
+//     return Singleton<Dictionary,
+//         NumaSingletonTraits<Dictionary, kNumaInterleave> >::get();
+//   }
+//
+// The policy is applied with the mbind() system call directly, there is no
+// dependency on libnuma. On a host with a single node the memory is mapped
+// without any policy.
+
+#ifndef BASE_MEMORY_NUMA_SINGLETON_TRAITS_H_
+#define BASE_MEMORY_NUMA_SINGLETON_TRAITS_H_
+
+#include <stddef.h>
+
+#include <new>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+enum NumaPlacement {
+  // Pages are spread round-robin over all nodes with memory.
+  kNumaInterleave,
+  // Pages come from the given node only.
+  kNumaBind,
+  // Pages come from the node of the CPU the creating thread, that is the
+  // first accessor, runs on, or from another node once that one is full.
+  kNumaFirstAccessor,
+};
+
+// Returns the number of possible NUMA nodes, 1 if that can't be determined.
+BASE_EXPORT int GetNumaNodeCount();
+
+// Maps at least |size| bytes of zeroed, read-write, page aligned memory and
+// applies |placement| to it before any page is touched. |node| is only used
+// with kNumaBind. Aborts if the memory can't be mapped. A policy that can't
+// be applied (node without memory, kernel without NUMA support) leaves the
+// default policy, which still works, only slower; |policy_applied|, if not
+// NULL, tells whether the policy was set.
+BASE_EXPORT void* AllocateNumaMemory(size_t size,
+                                     NumaPlacement placement,
+                                     int node,
+                                     bool* policy_applied);
+
+// Unmaps memory returned by AllocateNumaMemory() for the same |size|.
+BASE_EXPORT void FreeNumaMemory(void* address, size_t size);
+
+namespace internal {
+
+// Sets the policy of the pages in [|address|, |address| + |size|) with
+// mbind(), whatever the node count. kNumaInterleave uses the nodes listed in
+// /sys/devices/system/node/has_memory. Returns false if it failed.
+BASE_EXPORT bool ApplyNumaPolicy(void* address,
+                                 size_t size,
+                                 NumaPlacement placement,
+                                 int node);
+
+}  // namespace internal
+
+// Traits for Singleton<Type> that place the instance in memory returned by
+// AllocateNumaMemory(). The instance gets pages of its own, since the policy
+// applies to whole pages.
+template <typename Type,
+          NumaPlacement kPlacement = kNumaInterleave,
+          int kNode = 0>
+struct SINGLETON_EXPORT NumaSingletonTraits {
+  static Type* New() {
+    void* memory = AllocateNumaMemory(sizeof(Type), kPlacement, kNode, NULL);
+    // The parenthesis is very important here; it forces POD type
+    // initialization.
+    return new (memory) Type();
+  }
+
+  static void Delete(Type* x) {
+    x->~Type();
+    FreeNumaMemory(x, sizeof(Type));
+  }
+
+  static const bool kRegisterAtExit = false;
+};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_NUMA_SINGLETON_TRAITS_H_
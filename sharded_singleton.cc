@@ -0,0 +1,32 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sharded_singleton.h"
+
+#include <sched.h>
+
+namespace base {
+namespace internal {
+
+namespace {
+
+subtle::AtomicWord g_next_shard_seed = 0;
+
+}  // namespace
+
+size_t NextShardSeed() {
+  return static_cast<size_t>(
+      subtle::NoBarrier_AtomicIncrement(&g_next_shard_seed, 1) - 1);
+}
+
+int GetCurrentCpu() {
+#if defined(OS_LINUX)
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,158 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// ShardedSingleton<Type, N> splits a write-heavy singleton (counters, pools,
+// free lists) into N independent Singleton<Type> instances. Each thread is
+// routed to one shard, so unrelated threads don't bounce the same cache lines.
+// Use it only for objects whose state can be meaningfully aggregated across
+// shards, see ForEachShard().
+
+#ifndef BASE_MEMORY_SHARDED_SINGLETON_H_
+#define BASE_MEMORY_SHARDED_SINGLETON_H_
+
+#include <stddef.h>
+
+#include "atomicops.h"
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+namespace internal {
+
+// Returns a new, process-wide unique, thread seed.
+BASE_EXPORT size_t NextShardSeed();
+
+// Returns the CPU the calling thread is running on, or -1 if unknown.
+BASE_EXPORT int GetCurrentCpu();
+
+// Returns a small number that is stable for the lifetime of the calling
+// thread. Consecutive threads get consecutive numbers, which spreads them
+// evenly across shards.
+inline size_t CurrentThreadShardSeed() {
+  static __thread size_t seed_plus_one;
+  if (!seed_plus_one)
+    seed_plus_one = NextShardSeed() + 1;
+  return seed_plus_one - 1;
+}
+
+template <size_t... Indices>
+struct IndexSequence {};
+
+template <size_t N, size_t... Indices>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Indices...> {};
+
+template <size_t... Indices>
+struct MakeIndexSequence<0, Indices...> {
+  typedef IndexSequence<Indices...> Type;
+};
+
+}  // namespace internal
+
+// Example usage:
+//
+//   class HitCounter {
+//    public:
+//     static HitCounter* GetInstance();  // Returns the caller's shard.
+//     void Increment() { hits_.fetch_add(1, std::memory_order_relaxed); }
+//     ...
+//   };
+//
+//   HitCounter* HitCounter::GetInstance() {
+//     return ShardedSingleton<HitCounter, 16>::get();
+//   }
+//
+//   size_t total = 0;
+//   ShardedSingleton<HitCounter, 16>::ForEachShard(
+//       [&total](HitCounter* shard) { total += shard->hits(); });
+//
+// Shard i is Singleton<Type, Traits, internal::ShardTag<DifferentiatingType,
+// i>>, whose instance_ word is aligned to its own cache line. Shards are
+// created lazily by the first thread routed to them.
+template <typename Type,
+          size_t N,
+          typename Traits = DefaultSingletonTraits<Type>,
+          typename DifferentiatingType = Type>
+class ShardedSingleton {
+ public:
+  static_assert(N > 0, "ShardedSingleton needs at least one shard");
+  static_assert(!internal::UsesConstantStorage<Type, Traits>::value,
+                "Shards need an instance_ word for ForEachShard()");
+
+  // Calls |function| with every shard that has been created so far. Shards
+  // that were never used are skipped rather than created.
+  template <typename Function>
+  static void ForEachShard(Function function) {
+    for (size_t i = 0; i < N; ++i) {
+      subtle::AtomicWord value = subtle::Acquire_Load(Shards::instances[i]);
+      if (value != 0 && value != internal::kBeingCreatedMarker)
+        function(reinterpret_cast<Type*>(value));
+    }
+  }
+
+  // Returns the shard for the CPU the caller is currently running on. The
+  // thread may migrate right after, so this only helps spreading contention.
+  // Falls back to the thread's shard when the CPU is unknown.
+  static Type* GetForCurrentCpu() {
+    int cpu = internal::GetCurrentCpu();
+    if (cpu < 0)
+      return get();
+    return GetShard(static_cast<size_t>(cpu) % N);
+  }
+
+#if defined(SINGLETON_INLINE_ACCESS)
+ public:
+#else
+ private:
+  // Classes using the ShardedSingleton<T> pattern should declare a
+  // GetInstance() method and call ShardedSingleton::get() from within that.
+  friend Type* Type::GetInstance();
+#endif
+
+  // Returns the calling thread's shard.
+  static Type* get() { return GetShard(internal::CurrentThreadShardSeed() % N); }
+
+ private:
+  static Type* GetShard(size_t index) {
+    subtle::AtomicWord value = subtle::Acquire_Load(Shards::instances[index]);
+    if (value != 0 && value != internal::kBeingCreatedMarker)
+      return reinterpret_cast<Type*>(value);
+    return Shards::getters[index]();
+  }
+
+  template <size_t Index>
+  static Type* GetShardAt() {
+    return Singleton<Type, Traits,
+                     internal::ShardTag<DifferentiatingType, Index> >::get();
+  }
+
+  // Maps a runtime shard index to the compile-time Singleton of that shard.
+  template <typename Sequence>
+  struct ShardTable;
+
+  template <size_t... Indices>
+  struct ShardTable<internal::IndexSequence<Indices...> > {
+    static subtle::AtomicWord* const instances[N];
+    static Type* (*const getters[N])();
+  };
+
+  typedef ShardTable<typename internal::MakeIndexSequence<N>::Type> Shards;
+};
+
+template <typename Type, size_t N, typename Traits, typename DifferentiatingType>
+template <size_t... Indices>
+subtle::AtomicWord* const ShardedSingleton<Type, N, Traits, DifferentiatingType>::
+    ShardTable<internal::IndexSequence<Indices...> >::instances[N] = {
+        &Singleton<Type, Traits, internal::ShardTag<DifferentiatingType,
+                                                    Indices> >::instance_...};
+
+template <typename Type, size_t N, typename Traits, typename DifferentiatingType>
+template <size_t... Indices>
+Type* (*const ShardedSingleton<Type, N, Traits, DifferentiatingType>::
+           ShardTable<internal::IndexSequence<Indices...> >::getters[N])() = {
+    &ShardedSingleton<Type, N, Traits, DifferentiatingType>::GetShardAt<
+        Indices>...};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SHARDED_SINGLETON_H_
@@ -0,0 +1,174 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "shared_memory_singleton.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace base {
+namespace internal {
+
+namespace {
+
+// SegmentHeader::lock_state goes from kLockUninitialized to the PID of the
+// first process while it sets the mutex up, then to kLockInitialized.
+const subtle::Atomic32 kLockUninitialized = 0;
+const subtle::Atomic32 kLockInitialized = -1;
+
+// SegmentHeader::state is kSegmentReady once the object is constructed.
+const subtle::Atomic32 kSegmentReady = 1;
+
+// Lives in the first page of the segment; the object starts on the next page
+// so that it can be write protected on its own.
+struct SegmentHeader {
+  volatile subtle::Atomic32 lock_state;
+  volatile subtle::Atomic32 state;
+  uint64_t object_size;
+  // Held by the creator from AttachSharedSegment() to PublishSharedSegment().
+  // It is robust: if the creator dies, the kernel hands it to the next
+  // waiter with EOWNERDEAD.
+  pthread_mutex_t lock;
+};
+
+size_t PageSize() {
+  return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+size_t RoundUpToPage(size_t size) {
+  return (size + PageSize() - 1) & ~(PageSize() - 1);
+}
+
+SegmentHeader* HeaderOf(void* object) {
+  return reinterpret_cast<SegmentHeader*>(static_cast<char*>(object) -
+                                          PageSize());
+}
+
+void Fail(const char* name, const char* what) {
+  fprintf(stderr, "FATAL: shared memory singleton %s: %s\n", name, what);
+  abort();
+}
+
+void CreateLock(const char* name, SegmentHeader* header) {
+  pthread_mutexattr_t attributes;
+  if (pthread_mutexattr_init(&attributes) != 0 ||
+      pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) != 0 ||
+      pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) != 0 ||
+      pthread_mutex_init(&header->lock, &attributes) != 0) {
+    Fail(name, "can't create a robust process-shared mutex");
+  }
+  pthread_mutexattr_destroy(&attributes);
+  subtle::Release_Store(&header->lock_state, kLockInitialized);
+}
+
+// Sets up the mutex of a new segment, or waits for the process doing it.
+// Initialization makes no blocking call, so the wait is short, unless that
+// process died in the middle: nobody can have locked the mutex yet, so the
+// first waiter to notice takes over and initializes it again. PIDs are only
+// compared within one PID namespace.
+void InitializeLock(const char* name, SegmentHeader* header) {
+  subtle::Atomic32 self = static_cast<subtle::Atomic32>(getpid());
+  subtle::Atomic32 lock_state = subtle::Acquire_CompareAndSwap(
+      &header->lock_state, kLockUninitialized, self);
+  if (lock_state == kLockUninitialized) {
+    CreateLock(name, header);
+    return;
+  }
+  for (int spins = 1;; ++spins) {
+    lock_state = subtle::Acquire_Load(&header->lock_state);
+    if (lock_state == kLockInitialized)
+      return;
+    // Checking costs a system call; initialization normally completes well
+    // within the first few yields.
+    if (spins % 64 == 0 && kill(static_cast<pid_t>(lock_state), 0) != 0 &&
+        errno == ESRCH &&
+        subtle::Acquire_CompareAndSwap(&header->lock_state, lock_state,
+                                       self) == lock_state) {
+      CreateLock(name, header);
+      return;
+    }
+    sched_yield();
+  }
+}
+
+}  // namespace
+
+void* AttachSharedSegment(const char* name, size_t size, bool* creator) {
+  size_t mapping_size = PageSize() + RoundUpToPage(size ? size : 1);
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    Fail(name, "shm_open() failed");
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+    Fail(name, "fstat() failed");
+  // Concurrent first users all truncate to the same size, which is harmless.
+  if (info.st_size == 0 && ftruncate(fd, mapping_size) != 0)
+    Fail(name, "ftruncate() failed");
+  else if (info.st_size != 0 &&
+           static_cast<size_t>(info.st_size) != mapping_size)
+    Fail(name, "segment was created for an object of a different size");
+
+  void* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    Fail(name, "mmap() failed");
+
+  SegmentHeader* header = static_cast<SegmentHeader*>(mapping);
+  void* object = static_cast<char*>(mapping) + PageSize();
+  if (subtle::Acquire_Load(&header->state) != kSegmentReady) {
+    InitializeLock(name, header);
+    // Waiters sleep in the kernel until the creator publishes or dies.
+    int result = pthread_mutex_lock(&header->lock);
+    if (result == EOWNERDEAD) {
+      // The creator died mid-construction. The object is constructed again
+      // from scratch over whatever it left behind.
+      pthread_mutex_consistent(&header->lock);
+    } else if (result != 0) {
+      Fail(name, "can't lock the segment");
+    }
+    if (subtle::Acquire_Load(&header->state) != kSegmentReady) {
+      header->object_size = size;
+      *creator = true;
+      return object;
+    }
+    pthread_mutex_unlock(&header->lock);
+  }
+
+  if (header->object_size != size)
+    Fail(name, "segment was created for an object of a different size");
+  *creator = false;
+  return object;
+}
+
+void PublishSharedSegment(void* object, size_t size, bool read_only) {
+  if (read_only)
+    ProtectSharedSegment(object, size);
+  SegmentHeader* header = HeaderOf(object);
+  // Releases the visibility over the object to the other processes; the
+  // unlock lets the waiters see it.
+  subtle::Release_Store(&header->state, kSegmentReady);
+  pthread_mutex_unlock(&header->lock);
+}
+
+void ProtectSharedSegment(void* object, size_t size) {
+  mprotect(object, RoundUpToPage(size ? size : 1), PROT_READ);
+}
+
+void UnlinkSharedSegment(const char* name) {
+  shm_unlink(name);
+}
+
+}  // namespace internal
+}  // namespace base
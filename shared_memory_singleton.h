@@ -0,0 +1,162 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// SharedMemorySingleton<Type> places the instance in a named POSIX shared
+// memory segment, so that worker processes on the same host share a single
+// copy of a large read-only object (an index, a dictionary) instead of each
+// building their own. The first process to get() the singleton constructs it
+// in the segment; the others map the segment and sleep on a process-shared
+// mutex until it is ready.
+//
+// Type must be usable at a different address in every process: no pointers,
+// vtables or heap allocations, only offsets into the object itself. Its size
+// must be the same in every process using the segment.
+//
+// A process that dies while constructing the instance does not block the
+// others forever: the mutex is robust, so the kernel hands it to a waiter,
+// which takes the construction over. One that dies while setting the mutex
+// itself up is noticed through its PID, and a waiter sets it up again.
+
+#ifndef BASE_MEMORY_SHARED_MEMORY_SINGLETON_H_
+#define BASE_MEMORY_SHARED_MEMORY_SINGLETON_H_
+
+#include <stddef.h>
+
+#include <new>
+
+#include "atomicops.h"
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+namespace internal {
+
+// Maps the segment |name| sized for an object of |size| bytes and returns the
+// address of the object in it. Sets |*creator| to true if the caller must
+// construct the object and then call PublishSharedSegment() from the same
+// thread; in every other case the object is ready when this returns. Aborts if the segment can't be
+// mapped or was created for a different size.
+BASE_EXPORT void* AttachSharedSegment(const char* name,
+                                      size_t size,
+                                      bool* creator);
+
+// Marks the object returned by AttachSharedSegment() as constructed and wakes
+// up waiting processes. Write protects it if |read_only|.
+BASE_EXPORT void PublishSharedSegment(void* object,
+                                      size_t size,
+                                      bool read_only);
+
+// Write protects an object returned by AttachSharedSegment().
+BASE_EXPORT void ProtectSharedSegment(void* object, size_t size);
+
+// Removes the name of segment |name|. Processes that mapped it keep it.
+BASE_EXPORT void UnlinkSharedSegment(const char* name);
+
+}  // namespace internal
+
+// Traits for SharedMemorySingleton<Type>. Derive from them and provide the
+// segment name:
+//   struct IndexTraits : DefaultSharedMemorySingletonTraits<Index> {
+//     static const char* Name() { return "/myservice.index.v3"; }
+//   };
+// Put a version in the name: a segment outlives the processes that use it,
+// and a new binary must not attach to an instance laid out by an older one.
+template <typename Type>
+struct SINGLETON_EXPORT DefaultSharedMemorySingletonTraits {
+  // Write protect the instance once it is constructed.
+  static const bool kReadOnly = true;
+};
+
+// Example usage:
+//   Index* Index::GetInstance() {
+//     return SharedMemorySingleton<Index, IndexTraits>::get();
+//   }
+//
+// Within a process, get() costs the same acquire load as Singleton::get().
+// The instance is never destroyed; call Unlink() from a supervisor to have a
+// new segment created by the next process that starts.
+template <typename Type,
+          typename Traits,
+          typename DifferentiatingType = Type>
+class SINGLETON_EXPORT SharedMemorySingleton {
+ public:
+  // Removes the segment name. Processes already attached keep their mapping.
+  static void Unlink() { internal::UnlinkSharedSegment(Traits::Name()); }
+
+#if defined(SINGLETON_INLINE_ACCESS)
+ public:
+#else
+ private:
+  // Classes using the SharedMemorySingleton<T> pattern should declare a
+  // GetInstance() method and call SharedMemorySingleton::get() from within
+  // that.
+  friend Type* Type::GetInstance();
+#endif
+
+  // Return a pointer to the one true instance of the class.
+  static Type* get() {
+    subtle::AtomicWord value = subtle::Acquire_Load(&instance_);
+    if (value != 0 && value != internal::kBeingCreatedMarker)
+      return reinterpret_cast<Type*>(value);
+    return CreateInstance();
+  }
+
+ private:
+  SINGLETON_SLOW_PATH static Type* CreateInstance() {
+    // Threads of this process race as in Singleton::get(); the winner then
+    // races the other processes for the segment.
+    int creation = internal::BeginSingletonCreation(&instance_);
+    if (subtle::Acquire_CompareAndSwap(&instance_, 0,
+                                       internal::kBeingCreatedMarker) == 0) {
+      if (SingletonsSealed())
+        internal::OnSingletonCreatedAfterSeal(__PRETTY_FUNCTION__);
+
+      internal::SingletonCreation frame = {&instance_, __PRETTY_FUNCTION__,
+                                           NULL};
+      internal::PushSingletonCreation(&frame);
+      bool creator = false;
+      void* memory =
+          internal::AttachSharedSegment(Traits::Name(), sizeof(Type), &creator);
+      Type* newval;
+      if (creator) {
+        // The parenthesis is very important here; it forces POD type
+        // initialization.
+        newval = new (memory) Type();
+        internal::PublishSharedSegment(memory, sizeof(Type),
+                                       Traits::kReadOnly);
+      } else {
+        newval = static_cast<Type*>(memory);
+        if (Traits::kReadOnly)
+          internal::ProtectSharedSegment(memory, sizeof(Type));
+      }
+      internal::PopSingletonCreation(&frame);
+
+      subtle::Release_Store(&instance_,
+                            reinterpret_cast<subtle::AtomicWord>(newval));
+      internal::EndSingletonCreation(creation);
+      internal::RegisterSingleton(&record_, __PRETTY_FUNCTION__, &instance_,
+                                  frame.duration_ns);
+      return newval;
+    }
+    internal::EndSingletonCreation(creation);
+
+    return reinterpret_cast<Type*>(internal::WaitForInstance(&instance_));
+  }
+
+  static subtle::AtomicWord instance_;
+  static internal::SingletonRecord record_;
+};
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+subtle::AtomicWord
+    SharedMemorySingleton<Type, Traits, DifferentiatingType>::instance_ = 0;
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+internal::SingletonRecord
+    SharedMemorySingleton<Type, Traits, DifferentiatingType>::record_ = {
+        NULL, NULL, 0, NULL};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SHARED_MEMORY_SINGLETON_H_
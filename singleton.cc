@@ -3,13 +3,135 @@
 // found in the LICENSE file.
 
 #include "singleton.h"
+#include "singleton_wait_sampler.h"
 //#include "platform_thread.h"
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+#include <fcntl.h>
+#include <linux/membarrier.h>
+#include <signal.h>
+#include <string.h>
+#include <ucontext.h>
+#endif
 
 namespace base {
 namespace internal {
 
-subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance) {
+namespace {
+
+// What a thread takes part in the creation protocol with. Only read by other
+// threads under g_creations_lock.
+struct CreationThread {
+  pid_t tid;
+  // The instance word this thread is in WaitForInstance() for, or NULL.
+  const void* waiting_for;
+};
+
+// An entry of the table of creations in progress.
+struct CreationOwner {
+  const void* key;
+  const char* pretty_name;
+  CreationThread* thread;
+};
+
+// Innermost Traits::New() call in progress on this thread.
+__thread SingletonCreation* g_current_creation = NULL;
+__thread CreationThread g_creation_thread;
+
+// Creations in progress across the process. Only touched on the creation
+// slow path and before waiting for a creation, never by get() once the
+// instance exists. Leaked so that creations during static destruction work.
+pthread_mutex_t g_creations_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<CreationOwner>* g_creations = NULL;
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+CreationThread* CurrentCreationThread() {
+  if (!g_creation_thread.tid)
+    g_creation_thread.tid = static_cast<pid_t>(syscall(SYS_gettid));
+  return &g_creation_thread;
+}
+
+// Requires g_creations_lock.
+const CreationOwner* FindCreationOwner(const void* key) {
+  if (!g_creations)
+    return NULL;
+  for (size_t i = 0; i < g_creations->size(); ++i) {
+    if ((*g_creations)[i].key == key)
+      return &(*g_creations)[i];
+  }
+  return NULL;
+}
+
+// Records that the calling thread is about to wait for |instance|, and aborts
+// if that wait can never end: following who creates what we wait for, and
+// what that thread waits for in turn, leads back to us. Returns the pretty
+// name of the singleton, if its creation is known. Requires
+// g_creations_lock.
+const char* CheckForCreationDeadlock(const void* instance) {
+  CreationThread* self = CurrentCreationThread();
+  self->waiting_for = instance;
+
+  // A creation may also not be registered yet; its thread then sees the
+  // cycle when it gets to wait itself.
+  const CreationOwner* owner = FindCreationOwner(instance);
+  if (!owner)
+    return NULL;
+  const void* key = instance;
+  size_t limit = g_creations->size();
+  bool deadlock = false;
+  for (size_t hops = 0; key && hops <= limit && !deadlock; ++hops) {
+    const CreationOwner* next = FindCreationOwner(key);
+    if (!next)
+      return owner->pretty_name;
+    deadlock = next->thread == self;
+    key = next->thread->waiting_for;
+  }
+  if (!deadlock)
+    return owner->pretty_name;
+
+  char name[256];
+  if (owner->thread == self) {
+    GetSingletonTypeName(owner->pretty_name, name, sizeof(name));
+    fprintf(stderr,
+            "FATAL: Singleton<%s> is needed by its own construction on thread "
+            "%d; the constructor, or something it calls, gets the singleton "
+            "being constructed.\n",
+            name, self->tid);
+    abort();
+  }
+
+  fprintf(stderr, "FATAL: singletons constructing each other across threads:\n");
+  key = instance;
+  CreationThread* waiter = self;
+  do {
+    owner = FindCreationOwner(key);
+    GetSingletonTypeName(owner->pretty_name, name, sizeof(name));
+    fprintf(stderr,
+            "  thread %d waits for Singleton<%s>, being created by thread %d\n",
+            waiter->tid, name, owner->thread->tid);
+    waiter = owner->thread;
+    key = waiter->waiting_for;
+  } while (waiter != self);
+  abort();
+}
+
+}  // namespace
+
+subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance,
+                                   const char* pretty_name) {
   // Handle the race. Another thread beat us and either:
   // - Has the object in BeingCreated state
   // - Already has the object created...
@@ -17,7 +139,23 @@ subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance) {
   // Unless your constructor can be very time consuming, it is very unlikely
   // to hit this race.  When it does, we just spin and yield the thread until
   // the object has been created.
-  subtle::AtomicWord value;
+  subtle::AtomicWord value = subtle::Acquire_Load(instance);
+  if (value != kBeingCreatedMarker)
+    return value;
+
+  // Whichever thread closes a cycle of waits is the one that sees it here,
+  // since every waiter records itself under the lock before checking.
+  int64_t wait_start_ns = NowNs();
+  pthread_mutex_lock(&g_creations_lock);
+  // The creator may not have pushed its creation yet.
+  const char* owner_name = CheckForCreationDeadlock(instance);
+  pthread_mutex_unlock(&g_creations_lock);
+  if (owner_name)
+    pretty_name = owner_name;
+
+  if (SingletonWaitSamplingEnabled())
+    SampleSingletonWait(instance, pretty_name);
+
   while (true) {
     // The load has acquire memory ordering as the thread which reads the
     // instance pointer must acquire visibility over the associated data.
@@ -28,9 +166,325 @@ subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance) {
     //PlatformThread::YieldCurrentThread();
     sched_yield();
   }
+
+  pthread_mutex_lock(&g_creations_lock);
+  CurrentCreationThread()->waiting_for = NULL;
+  pthread_mutex_unlock(&g_creations_lock);
+
+  RecordSingletonWait(instance, NowNs() - wait_start_ns);
   return value;
 }
 
+void PushSingletonCreation(SingletonCreation* creation) {
+  creation->parent = g_current_creation;
+  g_current_creation = creation;
+  creation->start_ns = NowNs();
+
+  CreationOwner owner = {creation->key, creation->pretty_name,
+                         CurrentCreationThread()};
+  pthread_mutex_lock(&g_creations_lock);
+  if (!g_creations)
+    g_creations = new std::vector<CreationOwner>;
+  g_creations->push_back(owner);
+  pthread_mutex_unlock(&g_creations_lock);
+}
+
+void PopSingletonCreation(SingletonCreation* creation) {
+  g_current_creation = creation->parent;
+  creation->duration_ns = NowNs() - creation->start_ns;
+
+  pthread_mutex_lock(&g_creations_lock);
+  for (size_t i = 0; i < g_creations->size(); ++i) {
+    if ((*g_creations)[i].key == creation->key) {
+      (*g_creations)[i] = g_creations->back();
+      g_creations->pop_back();
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_creations_lock);
+}
+
+void ResetSingletonCreationsInChild() {
+  // The lock may have been held by a thread that doesn't exist here.
+  pthread_mutex_init(&g_creations_lock, NULL);
+  if (g_creations)
+    g_creations->clear();
+  g_creation_thread.tid = 0;
+  g_creation_thread.waiting_for = NULL;
+}
+
+void* AlignedAlloc(size_t size, size_t alignment) {
+  // posix_memalign() wants at least the alignment of a pointer.
+  if (alignment < sizeof(void*))
+    alignment = sizeof(void*);
+  void* memory = NULL;
+  if (posix_memalign(&memory, alignment, size ? size : 1) != 0)
+    abort();
+  ChargeSingletonMemoryBlock(memory, size);
+  return memory;
+}
+
+void AlignedFree(void* memory) {
+  CreditSingletonMemoryBlock(memory);
+  free(memory);
+}
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+
+namespace {
+
+// Serializes patching: the SIGTRAP handler knows of one site at a time.
+pthread_mutex_t g_static_key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Sites are written through /proc/self/mem, which writes to read-only pages,
+// so that text is never mapped writable, nor without execute permission while
+// other threads may run code on the page. Opened under g_static_key_lock by
+// the process that writes: the descriptor a forked child inherits writes into
+// its parent.
+int g_mem_fd = -1;
+pid_t g_mem_fd_pid = 0;
+
+const unsigned char kJmpOpcode = 0xe9;
+const unsigned char kInt3 = 0xcc;
+const unsigned char kNop5[] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
+const size_t kJmpSize = sizeof(kNop5);
+// The movabs after the jmp is a REX.W prefix, a B8+r opcode and the
+// immediate.
+const size_t kImmediateOffset = kJmpSize + 2;
+const size_t kSiteSize = kImmediateOffset + sizeof(uint64_t);
+
+// The jump tables EnableStaticKey() was called with, one per module, for the
+// SIGTRAP handler. Modules with singletons are never unloaded: their
+// STB_GNU_UNIQUE data makes them nodelete.
+struct StaticKeyTable {
+  const StaticKeyEntry* begin;
+  const StaticKeyEntry* end;
+};
+const size_t kMaxStaticKeyTables = 64;
+StaticKeyTable g_static_key_tables[kMaxStaticKeyTables];
+subtle::AtomicWord g_static_key_table_count = 0;
+
+// The site being patched, and where a thread that hits its int3 resumes.
+// Written under g_static_key_lock; g_patch_sequence is odd while they change.
+subtle::AtomicWord g_patch_sequence = 0;
+subtle::AtomicWord g_patch_site = 0;
+subtle::AtomicWord g_patch_resume = 0;
+
+struct sigaction g_previous_sigtrap_action;
+
+// -1 until the first EnableStaticKey(), then whether sites can be patched.
+int g_can_patch = -1;
+
+// Makes every thread of the process execute a serializing instruction, so
+// that none of them runs a stale copy of patched code.
+void SyncCores() {
+  syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE, 0);
+}
+
+bool IsStaticKeySite(uintptr_t address) {
+  subtle::AtomicWord count = subtle::Acquire_Load(&g_static_key_table_count);
+  for (subtle::AtomicWord i = 0; i < count; ++i) {
+    const StaticKeyTable& table = g_static_key_tables[i];
+    for (const StaticKeyEntry* entry = table.begin; entry < table.end;
+         ++entry) {
+      if (entry->site == address)
+        return true;
+    }
+  }
+  return false;
+}
+
+void OnSigtrap(int signal, siginfo_t* info, void* context) {
+  greg_t* registers = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+  uintptr_t site = static_cast<uintptr_t>(registers[REG_RIP]) - 1;
+  if (info->si_code == SI_KERNEL && IsStaticKeySite(site)) {
+    // Emulate the instruction being patched if the int3 is still there.
+    // Otherwise, or if the patch changed under us, run the site again.
+    registers[REG_RIP] = static_cast<greg_t>(site);
+    subtle::AtomicWord sequence = subtle::Acquire_Load(&g_patch_sequence);
+    if (sequence & 1)
+      return;
+    uintptr_t patch_site =
+        static_cast<uintptr_t>(subtle::Acquire_Load(&g_patch_site));
+    greg_t resume = static_cast<greg_t>(subtle::Acquire_Load(&g_patch_resume));
+    unsigned char opcode = *reinterpret_cast<volatile unsigned char*>(site);
+    if (patch_site == site && opcode == kInt3 &&
+        subtle::Acquire_Load(&g_patch_sequence) == sequence) {
+      registers[REG_RIP] = resume;
+    }
+    return;
+  }
+
+  if (g_previous_sigtrap_action.sa_flags & SA_SIGINFO) {
+    g_previous_sigtrap_action.sa_sigaction(signal, info, context);
+  } else if (g_previous_sigtrap_action.sa_handler == SIG_DFL) {
+    // Delivered with the default action once this handler returns.
+    sigaction(SIGTRAP, &g_previous_sigtrap_action, NULL);
+    raise(SIGTRAP);
+  } else if (g_previous_sigtrap_action.sa_handler != SIG_IGN) {
+    g_previous_sigtrap_action.sa_handler(signal);
+  }
+}
+
+bool CanPatch() {
+  if (g_can_patch != -1)
+    return g_can_patch == 1;
+  g_can_patch = 0;
+  long commands = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+  if (commands < 0 || !(commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE))
+    return false;
+  if (syscall(__NR_membarrier,
+              MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0) != 0) {
+    return false;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &OnSigtrap;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGTRAP, &action, &g_previous_sigtrap_action) != 0)
+    return false;
+  g_can_patch = 1;
+  return true;
+}
+
+// Returns false if there are too many modules to patch another one.
+bool AddStaticKeyTable(const StaticKeyEntry* begin, const StaticKeyEntry* end) {
+  subtle::AtomicWord count = subtle::NoBarrier_Load(&g_static_key_table_count);
+  for (subtle::AtomicWord i = 0; i < count; ++i) {
+    if (g_static_key_tables[i].begin == begin)
+      return true;
+  }
+  if (count == static_cast<subtle::AtomicWord>(kMaxStaticKeyTables))
+    return false;
+  g_static_key_tables[count].begin = begin;
+  g_static_key_tables[count].end = end;
+  subtle::Release_Store(&g_static_key_table_count, count + 1);
+  return true;
+}
+
+// Writes |size| bytes at |address| of the text of this process. Returns false
+// if nothing was written.
+bool WriteText(uintptr_t address, const void* bytes, size_t size) {
+  pid_t pid = getpid();
+  if (g_mem_fd_pid != pid) {
+    if (g_mem_fd != -1)
+      close(g_mem_fd);
+    g_mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+    g_mem_fd_pid = pid;
+  }
+  return g_mem_fd != -1 &&
+         pwrite(g_mem_fd, bytes, size, static_cast<off_t>(address)) ==
+             static_cast<ssize_t>(size);
+}
+
+// Replaces the 5 byte instruction at |site| while other threads may execute
+// it: an int3 first, then the last four bytes, then the first one, with every
+// core serialized after each step. A thread hitting the int3 continues at
+// |resume|, where the old or the new instruction would take it. Returns false
+// if the site is left unchanged.
+bool ReplaceInstruction(uintptr_t site,
+                        const unsigned char* instruction,
+                        uintptr_t resume) {
+  subtle::NoBarrier_Store(&g_patch_sequence, g_patch_sequence + 1);
+  subtle::MemoryBarrier();
+  subtle::NoBarrier_Store(&g_patch_site, static_cast<subtle::AtomicWord>(site));
+  subtle::NoBarrier_Store(&g_patch_resume,
+                          static_cast<subtle::AtomicWord>(resume));
+  subtle::Release_Store(&g_patch_sequence, g_patch_sequence + 1);
+
+  if (!WriteText(site, &kInt3, 1))
+    return false;
+  SyncCores();
+  // Once the next patch starts, threads would loop on a leftover int3.
+  if (!WriteText(site + 1, instruction + 1, kJmpSize - 1))
+    abort();
+  SyncCores();
+  if (!WriteText(site, instruction, 1))
+    abort();
+  SyncCores();
+  return true;
+}
+
+// Returns false if the site isn't a jmp followed by a movabs, e.g. because it
+// was already patched, or if it couldn't be written.
+bool PatchSite(uintptr_t site, subtle::AtomicWord instance) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(site);
+  if (bytes[0] != kJmpOpcode || (bytes[kJmpSize] & 0xfe) != 0x48 ||
+      (bytes[kJmpSize + 1] & 0xf8) != 0xb8) {
+    return false;
+  }
+
+  // Nothing executes the movabs until the jmp is gone.
+  uint64_t immediate = static_cast<uint64_t>(instance);
+  if (!WriteText(site + kImmediateOffset, &immediate, sizeof(immediate)))
+    return false;
+  return ReplaceInstruction(site, kNop5, site + kJmpSize);
+}
+
+// Turns a patched site back into its jmp. A thread that hits the int3 goes
+// to the slow path.
+void RestoreSite(const StaticKeyEntry& entry) {
+  uintptr_t site = entry.site;
+  if (*reinterpret_cast<const unsigned char*>(site) != kNop5[0])
+    return;
+
+  unsigned char jump[sizeof(kNop5)];
+  int32_t offset = static_cast<int32_t>(entry.target - (site + kJmpSize));
+  jump[0] = kJmpOpcode;
+  memcpy(&jump[1], &offset, sizeof(offset));
+  // It was written when patched. Leaving it would return the deleted
+  // instance.
+  if (!ReplaceInstruction(site, jump, entry.target))
+    abort();
+}
+
+}  // namespace
+
+void EnableStaticKey(StaticKey* key,
+                     StaticKey** keys,
+                     const subtle::AtomicWord* instance_word,
+                     const StaticKeyEntry* begin,
+                     const StaticKeyEntry* end) {
+  pthread_mutex_lock(&g_static_key_lock);
+  // Checked under the lock, so that DisableStaticKeys() can't clear the
+  // instance while we patch it in.
+  subtle::AtomicWord instance = subtle::NoBarrier_Load(instance_word);
+  if (!subtle::NoBarrier_Load(&key->enabled) && instance != 0 &&
+      instance != kBeingCreatedMarker) {
+    // A site that can't be patched keeps jumping to the Acquire_Load path,
+    // which stays correct; don't retry on every call.
+    if (CanPatch() && AddStaticKeyTable(begin, end)) {
+      for (const StaticKeyEntry* entry = begin; entry < end; ++entry) {
+        if (entry->key == reinterpret_cast<uintptr_t>(key))
+          PatchSite(entry->site, instance);
+      }
+    }
+    key->begin = begin;
+    key->end = end;
+    key->next = *keys;
+    *keys = key;
+    subtle::Release_Store(&key->enabled, kStaticKeyEnabled);
+  }
+  pthread_mutex_unlock(&g_static_key_lock);
+}
+
+void DisableStaticKeys(StaticKey** keys, subtle::AtomicWord* instance_word) {
+  pthread_mutex_lock(&g_static_key_lock);
+  for (StaticKey* key = *keys; key; key = key->next) {
+    for (const StaticKeyEntry* entry = key->begin; entry < key->end; ++entry) {
+      if (entry->key == reinterpret_cast<uintptr_t>(key))
+        RestoreSite(*entry);
+    }
+    subtle::Release_Store(&key->enabled, kStaticKeyDisabled);
+  }
+  *keys = NULL;
+  subtle::NoBarrier_Store(instance_word, 0);
+  pthread_mutex_unlock(&g_static_key_lock);
+}
+
+#endif  // defined(SINGLETON_USE_STATIC_KEYS)
+
 }  // namespace internal
 }  // namespace base
 
@@ -19,9 +19,76 @@
 #ifndef BASE_MEMORY_SINGLETON_H_
 #define BASE_MEMORY_SINGLETON_H_
 
+#include "at_exit.h"
 #include "atomicops.h"
 #include "base_export.h"
+#include "singleton_fork.h"
+#include "singleton_memory.h"
+#include "singleton_registry.h"
 #include <new>
+#include <stddef.h>
+#include <cstddef>
+#include <type_traits>
+
+// Asserts that a variable with static storage duration is constant
+// initialized, where the compiler supports it.
+#if !defined(CONSTINIT)
+#if defined(__cpp_constinit)
+#define CONSTINIT constinit
+#else
+#define CONSTINIT
+#endif
+#endif
+
+// Build with ENABLE_SINGLETON_STATIC_KEYS defined (make STATIC_KEYS=1) to
+// turn the "already created" check of Singleton::get() into a jump that is
+// patched into a nop once the instance is published, after which get()
+// returns the instance as an immediate instead of loading instance_. Only
+// available for x86-64 Linux with compilers that support asm goto with
+// outputs (GCC 11, clang 11); other configurations keep the Acquire_Load
+// check.
+#if defined(ENABLE_SINGLETON_STATIC_KEYS) && defined(OS_LINUX) && \
+    defined(ARCH_CPU_X86_64) && defined(COMPILER_GCC) &&          \
+    (defined(__clang__) || __GNUC__ >= 11)
+#define SINGLETON_USE_STATIC_KEYS 1
+#endif
+
+#if defined(COMPILER_GCC)
+// Keeps the creation path out of the instruction stream of get() callers.
+#define SINGLETON_SLOW_PATH __attribute__((noinline, cold))
+#else
+#define SINGLETON_SLOW_PATH
+#endif
+
+#if defined(COMPILER_GCC)
+// Marks the singleton class templates, whose static data must exist once per
+// process even when several modules instantiate the same singleton, e.g. a
+// library built with -fvisibility=hidden and a plugin loaded with dlopen().
+// With default visibility the dynamic linker binds every module to the first
+// definition loaded, and GCC emits the template data as STB_GNU_UNIQUE so that
+// holds for RTLD_LOCAL plugins as well. An instantiation is only as visible as
+// its template arguments, so Type must not be hidden either: export it like
+// any other type shared across modules. Executables don't export symbols by
+// default; link them with -Wl,--dynamic-list-data (or -rdynamic) so that
+// plugins see the executable's instances.
+#define SINGLETON_EXPORT __attribute__((visibility("default")))
+#else
+#define SINGLETON_EXPORT
+#endif
+
+// Build with ENABLE_SINGLETON_INLINE_ACCESS defined (and -std=c++17, see the
+// makefile's INLINE_SINGLETONS switch) to make Singleton::get() public.
+// instance_ is then a C++17 inline variable, emitted with vague linkage and
+// merged into one definition per program by the linker, so get() can be
+// inlined into any caller without risking a second copy of the singleton and
+// Type no longer needs a GetInstance() method. All translation units of a
+// program must agree on this setting.
+#if defined(ENABLE_SINGLETON_INLINE_ACCESS)
+#if __cplusplus < 201703L
+#error "ENABLE_SINGLETON_INLINE_ACCESS requires C++17 inline variables"
+#endif
+#define SINGLETON_INLINE_ACCESS 1
+#endif
 
 namespace base {
 namespace internal {
@@ -32,28 +99,267 @@ static const subtle::AtomicWord kBeingCreatedMarker = 1;
 
 // We pull out some of the functionality into a non-templated function, so that
 // we can implement the more complicated pieces out of line in the .cc file.
-BASE_EXPORT subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance);
+//
+// Aborts with a diagnostic instead of waiting forever if the instance is
+// being created by the calling thread itself (a constructor that needs its
+// own singleton), or by a thread that transitively waits for one the calling
+// thread is creating. Only creations bracketed by PushSingletonCreation() and
+// PopSingletonCreation() are known. |pretty_name| names the singleton for the
+// wait sampler when its creation isn't pushed yet; it may be NULL.
+BASE_EXPORT subtle::AtomicWord WaitForInstance(subtle::AtomicWord* instance,
+                                               const char* pretty_name = NULL);
 
 class DeleteTraceLogForTesting;
 
+// A Traits::New() call in progress on the current thread. Creations that
+// happen inside another one are nested in it: the outer singleton may use the
+// inner one until it is destroyed.
+struct SingletonCreation {
+  // The instance_ word of the singleton being created.
+  const void* key;
+  // __PRETTY_FUNCTION__ of the creating function, for diagnostics.
+  const char* pretty_name;
+  SingletonCreation* parent;
+  // Set by Push and Pop, for the singleton registry.
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+// Maintain the current thread's stack of creations, and the process-wide
+// table of which thread creates what that WaitForInstance() checks. Push
+// must be called once |creation->key| holds kBeingCreatedMarker, and sets
+// |creation->parent|. Pop sets |creation->duration_ns|.
+BASE_EXPORT void PushSingletonCreation(SingletonCreation* creation);
+BASE_EXPORT void PopSingletonCreation(SingletonCreation* creation);
+
+// Forgets the creations of the parent's threads in a forked child.
+BASE_EXPORT void ResetSingletonCreationsInChild();
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+// A patchable site emitted by Singleton::get(). |site| is the address of a
+// 5 byte jmp to |target|, the slow path, followed by a movabs of a 64 bit
+// immediate into the result register. |key| identifies the singleton.
+struct StaticKeyEntry {
+  uintptr_t site;
+  uintptr_t key;
+  uintptr_t target;
+};
+
+// The sites of one singleton in one module. Enabled keys are linked into a
+// list per singleton, so that they can all be disabled.
+struct StaticKey {
+  // 0, then kStaticKeyEnabled or kStaticKeyDisabled.
+  subtle::AtomicWord enabled;
+  StaticKey* next;
+  const StaticKeyEntry* begin;
+  const StaticKeyEntry* end;
+};
+
+static const subtle::AtomicWord kStaticKeyEnabled = 1;
+static const subtle::AtomicWord kStaticKeyDisabled = 2;
+
+// Writes the instance held by |instance_word| into the movabs of every entry
+// in [begin, end) that belongs to |key|, then turns its jump into a nop, and
+// links |key| into |keys|. The jump is replaced through an int3 while other
+// threads may execute it, with every core serialized between the steps, so
+// this needs membarrier() with MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE and
+// installs a SIGTRAP handler that chains to the previous one. Does nothing if
+// |key| was already enabled or disabled, or if |instance_word| holds no
+// instance. The text stays read-only and executable: sites are written through
+// /proc/self/mem. Sites that can't be patched, e.g. without membarrier support
+// or where /proc/self/mem can't be written, keep using the Acquire_Load path.
+BASE_EXPORT void EnableStaticKey(StaticKey* key,
+                                 StaticKey** keys,
+                                 const subtle::AtomicWord* instance_word,
+                                 const StaticKeyEntry* begin,
+                                 const StaticKeyEntry* end);
+
+// Turns the sites of every key in |keys| back into jumps for good, then
+// stores 0 into |instance_word|. Called when the instance is deleted.
+BASE_EXPORT void DisableStaticKeys(StaticKey** keys,
+                                   subtle::AtomicWord* instance_word);
+
+// The key of the jumps that get() of Singleton S emits in this module. Hidden,
+// because GCC only accepts the address of an object that binds locally as an
+// "i" operand in position independent code. Every module thus enables its own
+// jumps.
+template <typename S>
+struct StaticKeyHolder {
+  static StaticKey key __attribute__((visibility("hidden")));
+};
+
+template <typename S>
+StaticKey StaticKeyHolder<S>::key = {0};
+#endif  // defined(SINGLETON_USE_STATIC_KEYS)
+
+// Assumed size of a cache line, used to keep hot words apart.
+static const size_t kCacheLineSize = 64;
+
+// DifferentiatingType of the Index-th shard of a ShardedSingleton.
+template <typename DifferentiatingType, size_t Index>
+struct SINGLETON_EXPORT ShardTag {};
+
+// Alignment of Singleton<>::instance_ for a given DifferentiatingType. Shards
+// get a cache line each so that neighbouring shards don't false-share.
+template <typename DifferentiatingType>
+struct SingletonInstanceAlignment {
+  static const size_t value = alignof(subtle::AtomicWord);
+};
+
+template <typename DifferentiatingType, size_t Index>
+struct SingletonInstanceAlignment<ShardTag<DifferentiatingType, Index> > {
+  static const size_t value = kCacheLineSize;
+};
+
+// Whether plain operator new can't be trusted with Type's alignment. Before
+// C++17 it only guarantees alignof(max_align_t), whatever alignas() says.
+template <typename Type>
+struct IsOverAligned
+    : std::integral_constant<bool,
+                             (alignof(Type) > alignof(std::max_align_t))> {};
+
+// Returns |size| bytes aligned to |alignment|, a power of two. Aborts on
+// failure. Release with AlignedFree().
+BASE_EXPORT void* AlignedAlloc(size_t size, size_t alignment);
+BASE_EXPORT void AlignedFree(void* memory);
+
+// Whether Type has a public default constructor usable in a constant
+// expression. Such a Type can live in constant initialized static storage.
+template <typename Type>
+class IsConstexprDefaultConstructible {
+  template <typename T, int = (T(), 0)>
+  static char Test(int);
+  template <typename T>
+  static long Test(...);
+
+ public:
+  static const bool value = sizeof(Test<Type>(0)) == sizeof(char);
+};
+
+// Whether Traits asks for constant initialized storage, see
+// ConstantSingletonTraits.
+template <typename Traits>
+class HasConstantInitializedTrait {
+  template <typename T>
+  static char Test(
+      typename std::enable_if<T::kConstantInitialized, int>::type);
+  template <typename T>
+  static long Test(...);
+
+ public:
+  static const bool value = sizeof(Test<Traits>(0)) == sizeof(char);
+};
+
+// Whether Traits marks the singleton as safe to destroy concurrently with
+// other such singletons, see AtExitManager::SetTeardownThreadCount().
+template <typename Traits>
+class HasIndependentTeardownTrait {
+  template <typename T>
+  static char Test(
+      typename std::enable_if<T::kIndependentTeardown, int>::type);
+  template <typename T>
+  static long Test(...);
+
+ public:
+  static const bool value = sizeof(Test<Traits>(0)) == sizeof(char);
+};
+
+// Whether Traits has a static void Flush(Type*), called at exit instead of
+// Traits::Delete() in fast shutdown mode.
+template <typename Type, typename Traits>
+class HasFlushHook {
+  template <typename T>
+  static char Test(decltype(T::Flush(static_cast<Type*>(NULL)))*);
+  template <typename T>
+  static long Test(...);
+
+ public:
+  static const bool value = sizeof(Test<Traits>(NULL)) == sizeof(char);
+};
+
+// Traits::kForkPolicy, or kForkShare if Traits doesn't have one.
+template <typename Traits>
+class ForkPolicyOf {
+  template <typename T>
+  static std::integral_constant<ForkPolicy, T::kForkPolicy> Test(int);
+  template <typename T>
+  static std::integral_constant<ForkPolicy, kForkShare> Test(...);
+
+ public:
+  static const ForkPolicy value = decltype(Test<Traits>(0))::value;
+};
+
 }  // namespace internal
 
+template <typename Type, size_t N, typename Traits,
+          typename DifferentiatingType>
+class ShardedSingleton;
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+// Bounds of the jump table of the current module, provided by the linker.
+extern "C" {
+extern const base::internal::StaticKeyEntry __start___singleton_static_keys[]
+    __attribute__((weak, visibility("hidden")));
+extern const base::internal::StaticKeyEntry __stop___singleton_static_keys[]
+    __attribute__((weak, visibility("hidden")));
+}
+#endif  // defined(SINGLETON_USE_STATIC_KEYS)
+
+
+// Charges the allocations made by the calling thread during its lifetime to
+// Type, see singleton_memory.h. Singleton<Type> creates one around
+// Traits::New(). Tags nest; the innermost one wins. Does nothing unless built
+// with ENABLE_SINGLETON_MEMORY_ACCOUNTING.
+template <typename Type>
+class SINGLETON_EXPORT ScopedSingletonMemoryTag {
+ public:
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+  ScopedSingletonMemoryTag()
+      : previous_(internal::SwapSingletonMemoryAccount(&account_,
+                                                       __PRETTY_FUNCTION__)) {}
+  ~ScopedSingletonMemoryTag() {
+    internal::SwapSingletonMemoryAccount(previous_, NULL);
+  }
+#else
+  ScopedSingletonMemoryTag() {}
+  ~ScopedSingletonMemoryTag() {}
+#endif
+
+ private:
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+  internal::SingletonMemoryAccount* previous_;
+  static internal::SingletonMemoryAccount account_;
+#endif
+
+  ScopedSingletonMemoryTag(const ScopedSingletonMemoryTag&) = delete;
+  ScopedSingletonMemoryTag& operator=(const ScopedSingletonMemoryTag&) =
+      delete;
+};
+
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+template <typename Type>
+internal::SingletonMemoryAccount ScopedSingletonMemoryTag<Type>::account_ = {
+    NULL, 0, 0, 0, 0, NULL};
+#endif
+
 
 // Default traits for Singleton<Type>. Calls operator new and operator delete on
 // the object. Registers automatic deletion at process exit.
 // Overload if you need arguments or another memory allocation function.
+//
+// An over-aligned Type (alignas() larger than alignof(max_align_t)) is
+// allocated with internal::AlignedAlloc() instead, as operator new ignores
+// its alignment before C++17.
 template<typename Type>
-struct DefaultSingletonTraits {
+struct SINGLETON_EXPORT DefaultSingletonTraits {
   // Allocates the object.
   static Type* New() {
-    // The parenthesis is very important here; it forces POD type
-    // initialization.
-    return new Type();
+    return New(internal::IsOverAligned<Type>());
   }
 
   // Destroys the object.
   static void Delete(Type* x) {
-    delete x;
+    Delete(x, internal::IsOverAligned<Type>());
   }
 
   // Set to true to automatically register deletion of the object on process
@@ -66,9 +372,114 @@ struct DefaultSingletonTraits {
   // access on non-joinable threads, and gracefully handles this.
   //static const bool kAllowedToAccessOnNonjoinableThread = false;
 //#endif
+
+ private:
+  static Type* New(std::false_type) {
+    // The parenthesis is very important here; it forces POD type
+    // initialization.
+    return new Type();
+  }
+
+  static Type* New(std::true_type) {
+    return new (internal::AlignedAlloc(sizeof(Type), alignof(Type))) Type();
+  }
+
+  static void Delete(Type* x, std::false_type) {
+    delete x;
+  }
+
+  static void Delete(Type* x, std::true_type) {
+    x->~Type();
+    internal::AlignedFree(x);
+  }
 };
 
 
+// Alternate traits for use with the Singleton<Type>.  Identical to
+// DefaultSingletonTraits except that the Singleton will not be cleaned up
+// at exit.
+template<typename Type>
+struct SINGLETON_EXPORT LeakySingletonTraits
+    : public DefaultSingletonTraits<Type> {
+  static const bool kRegisterAtExit = false;
+};
+
+
+// Traits for singletons that must start on their own cache line, such as
+// objects holding per-core counters: the instance is aligned to alignof(Type)
+// or to kCacheLineSize, whichever is larger, and its size is rounded up to
+// that alignment so that no other allocation shares its last line. With
+// kPadToCacheLine set to false only alignof(Type) is honored, which is what
+// DefaultSingletonTraits already does for over-aligned types.
+template <typename Type, bool kPadToCacheLine = true>
+struct SINGLETON_EXPORT AlignedSingletonTraits {
+  static const size_t kAlignment =
+      kPadToCacheLine && alignof(Type) < internal::kCacheLineSize
+          ? internal::kCacheLineSize
+          : alignof(Type);
+  static const size_t kSize =
+      (sizeof(Type) + kAlignment - 1) & ~(kAlignment - 1);
+
+  static Type* New() {
+    // The parenthesis is very important here; it forces POD type
+    // initialization.
+    return new (internal::AlignedAlloc(kSize, kAlignment)) Type();
+  }
+
+  static void Delete(Type* x) {
+    x->~Type();
+    internal::AlignedFree(x);
+  }
+
+  static const bool kRegisterAtExit = false;
+};
+
+
+// Traits for singletons that can be built at compile time (tables, registries
+// with a fixed capacity). The instance lives in constant initialized static
+// storage instead of the heap: there is no static initializer, get() returns a
+// link time constant address without any check, and the instance is never
+// destroyed. Type needs a public constexpr default constructor and a trivial
+// destructor.
+//
+// Such a singleton has no instance_ word, so nothing that enumerates instance
+// words sees it: it isn't registered, sealed, exported in metrics or given a
+// fork policy, and it can't be a ShardedSingleton shard. It is only used when
+// asked for with these traits.
+template <typename Type>
+struct SINGLETON_EXPORT ConstantSingletonTraits {
+  static_assert(internal::IsConstexprDefaultConstructible<Type>::value,
+                "Type needs a public constexpr default constructor");
+  static_assert(std::is_trivially_destructible<Type>::value,
+                "Type needs a trivial destructor");
+
+  static const bool kConstantInitialized = true;
+
+  // The instance is never deleted.
+  static const bool kRegisterAtExit = false;
+};
+
+namespace internal {
+
+// Whether Singleton<Type, Traits> keeps its instance in constant initialized
+// storage, which only ConstantSingletonTraits asks for.
+template <typename Type, typename Traits>
+struct UsesConstantStorage
+    : std::integral_constant<bool,
+                             HasConstantInitializedTrait<Traits>::value> {};
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+struct SINGLETON_EXPORT ConstantSingletonStorage {
+  static Type instance;
+};
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+CONSTINIT Type
+    ConstantSingletonStorage<Type, Traits, DifferentiatingType>::instance;
+
+}  // namespace internal
+
+
 // The Singleton<Type, Traits, DifferentiatingType> class manages a single
 // instance of Type which will be created on first use and will be destroyed at
 // normal process exit). The Trait::Delete function will not be called on
@@ -106,7 +517,8 @@ struct DefaultSingletonTraits {
 // and it is important that FooClass::GetInstance() is not inlined in the
 // header. This makes sure that when source files from multiple targets include
 // this header they don't end up with different copies of the inlined code
-// creating multiple copies of the singleton.
+// creating multiple copies of the singleton. Neither applies when building
+// with ENABLE_SINGLETON_INLINE_ACCESS, see above.
 //
 // Singleton<> has no non-static members and doesn't need to actually be
 // instantiated.
@@ -129,6 +541,19 @@ struct DefaultSingletonTraits {
 // shouldn't be false unless absolutely necessary. Remember that the heap where
 // the object is allocated may be destroyed by the CRT anyway.
 //
+// Traits may also have a lightweight static void Flush(Type*) hook, for
+// singletons holding data that must not be lost (log writers, stat
+// exporters). It is called at exit when the singleton isn't deleted: always
+// after AtExitManager::FastShutdownAndExit(), which deletes no singleton, and
+// otherwise if Traits::RAE is false.
+//
+// Singletons whose destructors are slow (joining threads, flushing files) can
+// set Traits::kIndependentTeardown to be destroyed concurrently with each
+// other when AtExitManager::SetTeardownThreadCount() allows it. They are only
+// ordered with respect to the singletons created while they were being
+// constructed, which outlive them; the destructor of such a singleton must
+// not use any other independent singleton.
+//
 // Caveats:
 // (a) Every call to get(), operator->() and operator*() incurs some overhead
 //     (16ns on my P4/2.8GHz) to check whether the object has already been
@@ -142,71 +567,246 @@ struct DefaultSingletonTraits {
 template <typename Type,
           typename Traits = DefaultSingletonTraits<Type>,
           typename DifferentiatingType = Type>
-class Singleton {
+class SINGLETON_EXPORT Singleton {
+#if defined(SINGLETON_INLINE_ACCESS)
+ public:
+  // Return a pointer to the one true instance of the class.
+  static Type* get() {
+    return get(internal::UsesConstantStorage<Type, Traits>());
+  }
+
+ private:
+#else
  private:
   // Classes using the Singleton<T> pattern should declare a GetInstance()
   // method and call Singleton::get() from within that.
   friend Type* Type::GetInstance();
+#endif
 
   // Allow TraceLog tests to test tracing after OnExit.
   friend class internal::DeleteTraceLogForTesting;
 
+  // Shards are Singletons differentiated by internal::ShardTag.
+  template <typename, size_t, typename, typename>
+  friend class ShardedSingleton;
+
   // This class is safe to be constructed and copy-constructed since it has no
   // member.
 
+#if !defined(SINGLETON_INLINE_ACCESS)
   // Return a pointer to the one true instance of the class.
   static Type* get() {
+    return get(internal::UsesConstantStorage<Type, Traits>());
+  }
+#endif
+
+  // The instance is constant initialized: nothing to check.
+  static Type* get(std::true_type) {
+    return &internal::ConstantSingletonStorage<Type, Traits,
+                                               DifferentiatingType>::instance;
+  }
+
+  static Type* get(std::false_type) {
 //#if DCHECK_IS_ON()
     // Avoid making TLS lookup on release builds.
     //if (!Traits::kAllowedToAccessOnNonjoinableThread)
       //ThreadRestrictions::AssertSingletonAllowed();
 //#endif
 
+#if defined(SINGLETON_USE_STATIC_KEYS)
+    // Jumps to the regular path below until EnableStaticKey() has written the
+    // instance into the movabs and turned the jmp into a 5 byte nop. The "?"
+    // puts the entry in the COMDAT group of this copy of get(), so that the
+    // linker drops it along with the copy.
+    subtle::AtomicWord patched;
+    asm goto(
+        "1: .byte 0xe9\n"
+        ".long %l[not_enabled] - 2f\n"
+        "2: movabs $0, %0\n"
+        ".pushsection __singleton_static_keys, \"aw?\"\n"
+        ".balign 8\n"
+        ".quad 1b, %c1, %l[not_enabled]\n"
+        ".popsection\n"
+        : "=r"(patched)
+        : "i"(&internal::StaticKeyHolder<Singleton>::key)
+        : : not_enabled);
+    // The instance was published and every core serialized before the jump
+    // became a nop.
+    return reinterpret_cast<Type*>(patched);
+
+  not_enabled:
+#endif  // defined(SINGLETON_USE_STATIC_KEYS)
+
     // The load has acquire memory ordering as the thread which reads the
     // instance_ pointer must acquire visibility over the singleton data.
     subtle::AtomicWord value = subtle::Acquire_Load(&instance_);
     if (value != 0 && value != internal::kBeingCreatedMarker) {
+#if defined(SINGLETON_USE_STATIC_KEYS)
+      // The key is taken here rather than in a helper, which could be the
+      // copy of another module.
+      EnableStaticKey(&internal::StaticKeyHolder<Singleton>::key);
+#endif
       return reinterpret_cast<Type*>(value);
     }
 
+    return CreateInstance();
+  }
+
+  SINGLETON_SLOW_PATH static Type* CreateInstance() {
+    // Lets a child forked from here on undo the marker if we set it.
+    int creation = internal::BeginSingletonCreation(&instance_);
+
     // Object isn't created yet, maybe we will get to create it, let's try...
     if (subtle::Acquire_CompareAndSwap(&instance_, 0,
                                        internal::kBeingCreatedMarker) == 0) {
       // instance_ was NULL and is now kBeingCreatedMarker.  Only one thread
       // will ever get here.  Threads might be spinning on us, and they will
       // stop right after we do this store.
-      Type* newval = Traits::New();
+      if (SingletonsSealed())
+        internal::OnSingletonCreatedAfterSeal(__PRETTY_FUNCTION__);
+
+      internal::SingletonCreation frame = {&instance_, __PRETTY_FUNCTION__,
+                                           NULL};
+      internal::PushSingletonCreation(&frame);
+      Type* newval;
+      {
+        ScopedSingletonMemoryTag<Type> memory_tag;
+        newval = Traits::New();
+      }
+      internal::PopSingletonCreation(&frame);
 
       // Releases the visibility over instance_ to the readers.
       subtle::Release_Store(&instance_,
                             reinterpret_cast<subtle::AtomicWord>(newval));
+      internal::EndSingletonCreation(creation);
 
-      //if (newval != NULL && Traits::kRegisterAtExit)
-        //AtExitManager::RegisterCallback(OnExit, NULL);
+      if (newval != NULL &&
+          (Traits::kRegisterAtExit ||
+           internal::HasFlushHook<Type, Traits>::value)) {
+        AtExitManager::RegisterSingletonCallback(
+            OnExit, NULL, &instance_, frame.parent ? frame.parent->key : NULL,
+            __PRETTY_FUNCTION__,
+            internal::HasIndependentTeardownTrait<Traits>::value);
+      }
 
+      if (newval != NULL) {
+        internal::RegisterSingleton(&record_, __PRETTY_FUNCTION__, &instance_,
+                                    frame.duration_ns);
+        if (internal::ForkPolicyOf<Traits>::value != kForkShare) {
+          internal::RegisterForkRecord(
+              &fork_record_, &instance_, internal::ForkPolicyOf<Traits>::value,
+              &ReinitInChild);
+        }
+      }
       return newval;
     }
+    internal::EndSingletonCreation(creation);
 
     // We hit a race. Wait for the other thread to complete it.
-    value = internal::WaitForInstance(&instance_);
+    subtle::AtomicWord value =
+        internal::WaitForInstance(&instance_, __PRETTY_FUNCTION__);
 
     return reinterpret_cast<Type*>(value);
   }
 
+#if defined(SINGLETON_USE_STATIC_KEYS)
+  // Switches the get() sites of |key| to the patched fast path, once instance_
+  // holds the published instance.
+  static void EnableStaticKey(internal::StaticKey* key) {
+    // The patched path doesn't see instance_ go back to 0, which a child does
+    // for kForkDropInChild.
+    if (internal::ForkPolicyOf<Traits>::value == kForkDropInChild)
+      return;
+    if (subtle::Acquire_Load(&key->enabled))
+      return;
+    internal::EnableStaticKey(key, &static_keys_, &instance_,
+                              __start___singleton_static_keys,
+                              __stop___singleton_static_keys);
+  }
+#endif
+
+  // Called in a forked child for kForkReinitInChild.
+  static void ReinitInChild(void* instance) {
+    ReinitInChild(instance,
+                  std::integral_constant<bool,
+                                         internal::ForkPolicyOf<Traits>::value ==
+                                             kForkReinitInChild>());
+  }
+
+  static void ReinitInChild(void* instance, std::true_type) {
+    Traits::ReinitInChild(static_cast<Type*>(instance));
+  }
+
+  static void ReinitInChild(void* /*instance*/, std::false_type) {}
+
   // Adapter function for use with AtExit().  This should be called single
   // threaded, so don't use atomic operations.
   // Calling OnExit while singleton is in use by other threads is a mistake.
   static void OnExit(void* /*unused*/) {
     // AtExit should only ever be register after the singleton instance was
     // created.  We should only ever get here with a valid instance_ pointer.
-    //Traits::Delete(reinterpret_cast<Type*>(subtle::NoBarrier_Load(&instance_)));
-    //instance_ = 0;
+    Type* instance = reinterpret_cast<Type*>(subtle::NoBarrier_Load(&instance_));
+    if (Traits::kRegisterAtExit && !AtExitManager::IsFastShutdown()) {
+      Traits::Delete(instance);
+      ClearInstance();
+      return;
+    }
+    Flush(instance, std::integral_constant<
+                        bool, internal::HasFlushHook<Type, Traits>::value>());
+  }
+
+  static void Flush(Type* instance, std::true_type) {
+    Traits::Flush(instance);
   }
-  static subtle::AtomicWord instance_;
+
+  static void Flush(Type* /*instance*/, std::false_type) {}
+
+  // Lets the next get() create a new instance once the current one is
+  // deleted.
+  static void ClearInstance() {
+#if defined(SINGLETON_USE_STATIC_KEYS)
+    // Patched get() sites return the old instance without reading instance_.
+    internal::DisableStaticKeys(&static_keys_, &instance_);
+#else
+    subtle::NoBarrier_Store(&instance_, 0);
+#endif
+  }
+
+  alignas(internal::SingletonInstanceAlignment<DifferentiatingType>::value)
+#if defined(SINGLETON_INLINE_ACCESS)
+      static inline subtle::AtomicWord instance_ = 0;
+#else
+      static subtle::AtomicWord instance_;
+#endif
+
+  static internal::SingletonRecord record_;
+
+  static internal::ForkRecord fork_record_;
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+  // The enabled keys of every module.
+  static internal::StaticKey* static_keys_;
+#endif
 };
 
+#if !defined(SINGLETON_INLINE_ACCESS)
 template <typename Type, typename Traits, typename DifferentiatingType>
 subtle::AtomicWord Singleton<Type, Traits, DifferentiatingType>::instance_ = 0;
+#endif
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+internal::SingletonRecord Singleton<Type, Traits, DifferentiatingType>::record_ =
+    {NULL, NULL, 0, NULL};
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+internal::ForkRecord Singleton<Type, Traits, DifferentiatingType>::fork_record_ =
+    {NULL, kForkShare, NULL, NULL};
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+template <typename Type, typename Traits, typename DifferentiatingType>
+internal::StaticKey* Singleton<Type, Traits, DifferentiatingType>::static_keys_ =
+    NULL;
+#endif
 
 }  // namespace base
 
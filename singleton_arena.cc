@@ -0,0 +1,113 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_arena.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+namespace base {
+
+namespace {
+
+// Chunks are mapped directly so that they never share pages with the heap.
+const size_t kChunkSize = 64 * 1024;
+
+struct Chunk {
+  Chunk* next;
+  size_t size;
+  size_t used;
+};
+
+// Allocation only happens on the singleton creation slow path, so a lock is
+// good enough; get() never touches the arena.
+pthread_mutex_t g_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+Chunk* g_current_chunks[kSingletonArenaHintCount];
+SingletonArenaStats g_stats;
+
+uintptr_t AlignUp(uintptr_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+}
+
+// Maps a chunk large enough for |size| bytes at |alignment|.
+Chunk* NewChunk(size_t size, size_t alignment) {
+  size_t needed = AlignUp(sizeof(Chunk), alignment) + size;
+  size_t chunk_size = AlignUp(needed > kChunkSize ? needed : kChunkSize,
+                              kChunkSize);
+  void* memory = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    abort();
+
+  Chunk* chunk = static_cast<Chunk*>(memory);
+  chunk->next = NULL;
+  chunk->size = chunk_size;
+  chunk->used = sizeof(Chunk);
+  g_stats.reserved_bytes += chunk_size;
+  ++g_stats.chunk_count;
+  return chunk;
+}
+
+}  // namespace
+
+void GetSingletonArenaStats(SingletonArenaStats* stats) {
+  pthread_mutex_lock(&g_arena_lock);
+  *stats = g_stats;
+  pthread_mutex_unlock(&g_arena_lock);
+}
+
+bool IsInSingletonArena(const void* address, size_t size) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(address);
+  bool found = false;
+  pthread_mutex_lock(&g_arena_lock);
+  for (int hint = 0; hint < kSingletonArenaHintCount && !found; ++hint) {
+    for (Chunk* chunk = g_current_chunks[hint]; chunk && !found;
+         chunk = chunk->next) {
+      uintptr_t base = reinterpret_cast<uintptr_t>(chunk);
+      found = begin >= base + sizeof(Chunk) && begin <= base + chunk->used &&
+              size <= base + chunk->used - begin;
+    }
+  }
+  pthread_mutex_unlock(&g_arena_lock);
+  return found;
+}
+
+namespace internal {
+
+void* AllocateFromSingletonArena(size_t size,
+                                 size_t alignment,
+                                 SingletonArenaHint hint) {
+  if (alignment < kCacheLineSize)
+    alignment = kCacheLineSize;
+
+  pthread_mutex_lock(&g_arena_lock);
+  Chunk* chunk = g_current_chunks[hint];
+  uintptr_t base = reinterpret_cast<uintptr_t>(chunk);
+  uintptr_t begin = chunk ? AlignUp(base + chunk->used, alignment) : 0;
+  if (!chunk || begin + size > base + chunk->size) {
+    Chunk* new_chunk = NewChunk(size, alignment);
+    new_chunk->next = chunk;
+    g_current_chunks[hint] = chunk = new_chunk;
+    base = reinterpret_cast<uintptr_t>(chunk);
+    begin = AlignUp(base + chunk->used, alignment);
+    // NewChunk() sizes for the padding, this only guards the arithmetic.
+    if (begin + size > base + chunk->size)
+      abort();
+  }
+
+  size_t consumed = begin + size - (base + chunk->used);
+  chunk->used += consumed;
+  g_stats.used_bytes += consumed;
+  g_stats.used_bytes_per_hint[hint] += consumed;
+  ++g_stats.allocation_count;
+  pthread_mutex_unlock(&g_arena_lock);
+  ChargeSingletonMemoryBlock(reinterpret_cast<void*>(begin), size);
+
+  return reinterpret_cast<void*>(begin);
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,94 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// ArenaSingletonTraits<Type> allocates singletons from a dedicated arena
+// instead of the general heap. Objects created by DefaultSingletonTraits end
+// up interleaved with short lived allocations, spread over many pages; arena
+// allocated singletons are packed next to each other, on few pages that stay
+// hot in the cache and the TLB.
+//
+// Example usage:
+//   class FooClass {
+//    ...
+//    private:
+//     friend struct ArenaSingletonTraits<FooClass, kSingletonArenaHot>;
+//   };
+//
+//   FooClass* FooClass::GetInstance() {
+//     return Singleton<FooClass,
+//         ArenaSingletonTraits<FooClass, kSingletonArenaHot> >::get();
+//   }
+
+#ifndef BASE_MEMORY_SINGLETON_ARENA_H_
+#define BASE_MEMORY_SINGLETON_ARENA_H_
+
+#include <stddef.h>
+
+#include <new>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+// Placement hints. Singletons with the same hint are packed into the same
+// region of the arena, in creation order, so the ones accessed on every
+// request can be kept adjacent to each other.
+enum SingletonArenaHint {
+  kSingletonArenaHot = 0,
+  kSingletonArenaWarm,
+  kSingletonArenaCold,
+  kSingletonArenaHintCount
+};
+
+struct SingletonArenaStats {
+  // Bytes mapped for the arena.
+  size_t reserved_bytes;
+  // Bytes handed out, including alignment padding.
+  size_t used_bytes;
+  // Bytes handed out per SingletonArenaHint.
+  size_t used_bytes_per_hint[kSingletonArenaHintCount];
+  size_t allocation_count;
+  size_t chunk_count;
+};
+
+// Fills |stats| with the current arena usage.
+BASE_EXPORT void GetSingletonArenaStats(SingletonArenaStats* stats);
+
+// Returns true if the |size| bytes at |address| lie within a single chunk of
+// the arena.
+BASE_EXPORT bool IsInSingletonArena(const void* address, size_t size);
+
+namespace internal {
+
+// Returns |size| bytes from the arena region of |hint|, aligned to a cache
+// line or to |alignment| if that is larger. Never returns NULL; memory is
+// never given back.
+BASE_EXPORT void* AllocateFromSingletonArena(size_t size,
+                                             size_t alignment,
+                                             SingletonArenaHint hint);
+
+}  // namespace internal
+
+// Traits for Singleton<Type> that place the instance in the singleton arena.
+// Delete() runs the destructor but the memory stays with the arena: it is
+// meant for singletons that live until process exit.
+template <typename Type, SingletonArenaHint kHint = kSingletonArenaWarm>
+struct SINGLETON_EXPORT ArenaSingletonTraits {
+  static Type* New() {
+    void* memory = internal::AllocateFromSingletonArena(sizeof(Type),
+                                                        alignof(Type), kHint);
+    // The parenthesis is very important here; it forces POD type
+    // initialization.
+    return new (memory) Type();
+  }
+
+  static void Delete(Type* x) { x->~Type(); }
+
+  static const bool kRegisterAtExit = false;
+};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_ARENA_H_
@@ -0,0 +1,102 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_fork.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "singleton.h"
+
+namespace base {
+namespace internal {
+
+namespace {
+
+// Creations in progress, by address of the instance_ word. Only as many as
+// there are threads creating singletons at once, plus nesting; a creation
+// that finds no free slot runs untracked.
+const int kMaxCreationsInProgress = 256;
+subtle::AtomicWord g_creations[kMaxCreationsInProgress];
+
+subtle::AtomicWord g_fork_records = 0;
+
+pthread_once_t g_install_once = PTHREAD_ONCE_INIT;
+
+// Runs in the child, single threaded, before fork() returns.
+void OnForkInChild() {
+  ResetSingletonCreationsInChild();
+
+  // Whoever was creating these is gone. The half built objects are leaked.
+  for (int i = 0; i < kMaxCreationsInProgress; ++i) {
+    subtle::AtomicWord* instance =
+        reinterpret_cast<subtle::AtomicWord*>(g_creations[i]);
+    if (!instance)
+      continue;
+    if (subtle::NoBarrier_Load(instance) == kBeingCreatedMarker)
+      subtle::NoBarrier_Store(instance, 0);
+    g_creations[i] = 0;
+  }
+
+  for (ForkRecord* record = reinterpret_cast<ForkRecord*>(g_fork_records);
+       record; record = record->next) {
+    subtle::AtomicWord value = subtle::NoBarrier_Load(record->instance);
+    if (value == 0 || value == kBeingCreatedMarker)
+      continue;
+    if (record->policy == kForkReinitInChild)
+      record->reinit(reinterpret_cast<void*>(value));
+    else if (record->policy == kForkDropInChild)
+      subtle::NoBarrier_Store(record->instance, 0);
+  }
+}
+
+void InstallForkHandler() {
+  pthread_atfork(NULL, NULL, &OnForkInChild);
+}
+
+}  // namespace
+
+void RegisterForkRecord(ForkRecord* record,
+                        subtle::AtomicWord* instance,
+                        ForkPolicy policy,
+                        void (*reinit)(void*)) {
+  pthread_once(&g_install_once, &InstallForkHandler);
+  // A dropped singleton that is created again in the child is already linked
+  // in.
+  if (record->instance)
+    return;
+  record->instance = instance;
+  record->policy = policy;
+  record->reinit = reinit;
+
+  subtle::AtomicWord head = subtle::NoBarrier_Load(&g_fork_records);
+  while (true) {
+    record->next = reinterpret_cast<ForkRecord*>(head);
+    subtle::AtomicWord previous = subtle::Release_CompareAndSwap(
+        &g_fork_records, head, reinterpret_cast<subtle::AtomicWord>(record));
+    if (previous == head)
+      break;
+    head = previous;
+  }
+}
+
+int BeginSingletonCreation(subtle::AtomicWord* instance) {
+  pthread_once(&g_install_once, &InstallForkHandler);
+  subtle::AtomicWord address = reinterpret_cast<subtle::AtomicWord>(instance);
+  for (int i = 0; i < kMaxCreationsInProgress; ++i) {
+    if (subtle::NoBarrier_Load(&g_creations[i]) == 0 &&
+        subtle::Acquire_CompareAndSwap(&g_creations[i], 0, address) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void EndSingletonCreation(int handle) {
+  if (handle >= 0)
+    subtle::Release_Store(&g_creations[handle], 0);
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,75 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// fork() support for Singleton<>, for servers that build their singletons in
+// a master process and then fork workers.
+//
+// What a child does with an instance inherited from its parent is chosen per
+// singleton, by a kForkPolicy constant in its traits:
+//   struct ConnectionPoolTraits : DefaultSingletonTraits<ConnectionPool> {
+//     static const ForkPolicy kForkPolicy = kForkDropInChild;
+//   };
+//
+// Independently of the policies, a child never deadlocks on a singleton whose
+// creation was in progress on another thread of the parent when it forked:
+// that thread doesn't exist in the child, so the creation is abandoned and
+// the first get() in the child starts it over. This covers Singleton<>,
+// ShardedSingleton<>, KeyedSingleton<> (instances, evictions and table
+// slots), WeakSingleton<> (creations and reaps, a reaped instance is
+// forgotten) and SharedMemorySingleton<>. A SharedMemorySingleton<> child
+// still waits on the segment like any other process if the parent was the
+// creator; it gets it once the parent publishes. The WeakSingleton<> reaper
+// thread is restarted in the child, with the reaps pending in the parent.
+
+#ifndef BASE_MEMORY_SINGLETON_FORK_H_
+#define BASE_MEMORY_SINGLETON_FORK_H_
+
+#include "atomicops.h"
+#include "base_export.h"
+
+namespace base {
+
+enum ForkPolicy {
+  // The child keeps using the parent's instance. Its pages stay shared with
+  // the parent for as long as neither of them writes to them, so this is the
+  // policy for read-mostly data built before forking.
+  kForkShare,
+  // Traits::ReinitInChild(Type*) is called in the child before fork()
+  // returns, to reset locks, thread handles or other per-process state. The
+  // child is single threaded at that point, and only async-signal-safe
+  // functions may be called.
+  kForkReinitInChild,
+  // The child forgets the parent's instance, without destroying it, and its
+  // first get() creates a new one. For objects that can't be repaired, such
+  // as ones owning threads.
+  kForkDropInChild,
+};
+
+namespace internal {
+
+// A singleton whose policy isn't kForkShare. Lives next to its instance_,
+// linked in once the instance is published.
+struct ForkRecord {
+  subtle::AtomicWord* instance;
+  ForkPolicy policy;
+  void (*reinit)(void* instance);
+  ForkRecord* next;
+};
+
+BASE_EXPORT void RegisterForkRecord(ForkRecord* record,
+                                    subtle::AtomicWord* instance,
+                                    ForkPolicy policy,
+                                    void (*reinit)(void*));
+
+// Brackets the creation race of a singleton, so that a child forked while
+// the creation is in progress can undo its kBeingCreatedMarker. Begin must be
+// called before |instance| can hold the marker, End after it no longer does;
+// Begin returns the handle to pass to End.
+BASE_EXPORT int BeginSingletonCreation(subtle::AtomicWord* instance);
+BASE_EXPORT void EndSingletonCreation(int handle);
+
+}  // namespace internal
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_FORK_H_
@@ -0,0 +1,286 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_memory.h"
+
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <new>
+#endif
+
+namespace base {
+
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+
+namespace {
+
+// Every block returned by the operator new below is preceded by this header,
+// so that operator delete knows which account to credit. 16 bytes keep the
+// block aligned like malloc() does.
+struct BlockHeader {
+  internal::SingletonMemoryAccount* account;
+  size_t size;
+};
+static_assert(sizeof(BlockHeader) == 16, "BlockHeader must keep alignment");
+
+// Account of the innermost tag on this thread.
+__thread internal::SingletonMemoryAccount* g_current_account = NULL;
+
+subtle::AtomicWord g_accounts = 0;
+
+// Blocks charged by ChargeSingletonMemoryBlock(). Nodes come from malloc(),
+// so that the list itself is never charged to anyone.
+struct ChargedBlock {
+  const void* address;
+  size_t size;
+  internal::SingletonMemoryAccount* account;
+  ChargedBlock* next;
+};
+
+pthread_mutex_t g_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+ChargedBlock* g_blocks = NULL;
+
+void* Allocate(size_t size, size_t alignment) {
+  // Over-aligned blocks put the header right before the aligned address too;
+  // the start of the allocation is then |alignment| bytes before it.
+  size_t offset = alignment > sizeof(BlockHeader) ? alignment
+                                                  : sizeof(BlockHeader);
+  void* memory = NULL;
+  if (offset == sizeof(BlockHeader)) {
+    memory = malloc(size + offset);
+  } else if (posix_memalign(&memory, alignment, size + offset) != 0) {
+    memory = NULL;
+  }
+  if (!memory)
+    return NULL;
+
+  char* block = static_cast<char*>(memory) + offset;
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(block) - 1;
+  header->account = g_current_account;
+  header->size = size;
+  if (header->account) {
+    subtle::NoBarrier_AtomicIncrement(&header->account->allocated_bytes,
+                                      static_cast<subtle::AtomicWord>(size));
+    subtle::NoBarrier_AtomicIncrement(&header->account->allocation_count, 1);
+  }
+  return block;
+}
+
+void Free(void* block, size_t alignment) {
+  if (!block)
+    return;
+  BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+  if (header->account) {
+    subtle::NoBarrier_AtomicIncrement(
+        &header->account->freed_bytes,
+        static_cast<subtle::AtomicWord>(header->size));
+  }
+  size_t offset = alignment > sizeof(BlockHeader) ? alignment
+                                                  : sizeof(BlockHeader);
+  free(static_cast<char*>(block) - offset);
+}
+
+void* AllocateOrThrow(size_t size, size_t alignment) {
+  while (true) {
+    void* block = Allocate(size, alignment);
+    if (block)
+      return block;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+}  // namespace
+
+bool SingletonMemoryAccountingEnabled() {
+  return true;
+}
+
+std::vector<SingletonMemoryUsage> GetSingletonMemoryUsage() {
+  std::vector<SingletonMemoryUsage> usage;
+  for (internal::SingletonMemoryAccount* account =
+           reinterpret_cast<internal::SingletonMemoryAccount*>(
+               subtle::Acquire_Load(&g_accounts));
+       account; account = account->next) {
+    SingletonMemoryUsage entry;
+    entry.pretty_name = account->pretty_name;
+    size_t allocated = static_cast<size_t>(
+        subtle::NoBarrier_Load(&account->allocated_bytes));
+    size_t freed =
+        static_cast<size_t>(subtle::NoBarrier_Load(&account->freed_bytes));
+    entry.allocated_bytes = allocated;
+    entry.live_bytes = allocated > freed ? allocated - freed : 0;
+    entry.allocation_count = static_cast<size_t>(
+        subtle::NoBarrier_Load(&account->allocation_count));
+    usage.push_back(entry);
+  }
+  return usage;
+}
+
+namespace internal {
+
+SingletonMemoryAccount* SwapSingletonMemoryAccount(
+    SingletonMemoryAccount* account,
+    const char* pretty_name) {
+  if (account && pretty_name &&
+      subtle::NoBarrier_CompareAndSwap(&account->registered, 0, 1) == 0) {
+    account->pretty_name = pretty_name;
+    subtle::AtomicWord head = subtle::NoBarrier_Load(&g_accounts);
+    while (true) {
+      account->next = reinterpret_cast<SingletonMemoryAccount*>(head);
+      subtle::AtomicWord previous = subtle::Release_CompareAndSwap(
+          &g_accounts, head, reinterpret_cast<subtle::AtomicWord>(account));
+      if (previous == head)
+        break;
+      head = previous;
+    }
+  }
+
+  SingletonMemoryAccount* previous = g_current_account;
+  g_current_account = account;
+  return previous;
+}
+
+void ChargeSingletonMemoryBlock(const void* address, size_t size) {
+  SingletonMemoryAccount* account = g_current_account;
+  if (!account || !address)
+    return;
+  ChargedBlock* block = static_cast<ChargedBlock*>(malloc(sizeof(*block)));
+  if (!block)
+    return;
+  block->address = address;
+  block->size = size;
+  block->account = account;
+  pthread_mutex_lock(&g_blocks_lock);
+  block->next = g_blocks;
+  g_blocks = block;
+  pthread_mutex_unlock(&g_blocks_lock);
+  subtle::NoBarrier_AtomicIncrement(&account->allocated_bytes,
+                                    static_cast<subtle::AtomicWord>(size));
+  subtle::NoBarrier_AtomicIncrement(&account->allocation_count, 1);
+}
+
+void CreditSingletonMemoryBlock(const void* address) {
+  ChargedBlock* found = NULL;
+  pthread_mutex_lock(&g_blocks_lock);
+  for (ChargedBlock** link = &g_blocks; *link; link = &(*link)->next) {
+    if ((*link)->address == address) {
+      found = *link;
+      *link = found->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_blocks_lock);
+  if (!found)
+    return;
+  subtle::NoBarrier_AtomicIncrement(
+      &found->account->freed_bytes,
+      static_cast<subtle::AtomicWord>(found->size));
+  free(found);
+}
+
+}  // namespace internal
+
+#else  // defined(SINGLETON_MEMORY_ACCOUNTING)
+
+bool SingletonMemoryAccountingEnabled() {
+  return false;
+}
+
+std::vector<SingletonMemoryUsage> GetSingletonMemoryUsage() {
+  return std::vector<SingletonMemoryUsage>();
+}
+
+#endif  // defined(SINGLETON_MEMORY_ACCOUNTING)
+
+}  // namespace base
+
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+
+// Replacements of the global allocation functions. They must stay visible to
+// the rest of the process when built into a library with hidden visibility.
+#define SINGLETON_ALLOCATOR __attribute__((visibility("default")))
+
+SINGLETON_ALLOCATOR void* operator new(size_t size) {
+  return base::AllocateOrThrow(size, 0);
+}
+
+SINGLETON_ALLOCATOR void* operator new[](size_t size) {
+  return base::AllocateOrThrow(size, 0);
+}
+
+SINGLETON_ALLOCATOR void* operator new(size_t size,
+                                       const std::nothrow_t&) noexcept {
+  return base::Allocate(size, 0);
+}
+
+SINGLETON_ALLOCATOR void* operator new[](size_t size,
+                                         const std::nothrow_t&) noexcept {
+  return base::Allocate(size, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete(void* block) noexcept {
+  base::Free(block, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete[](void* block) noexcept {
+  base::Free(block, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete(void* block,
+                                         const std::nothrow_t&) noexcept {
+  base::Free(block, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete[](void* block,
+                                           const std::nothrow_t&) noexcept {
+  base::Free(block, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete(void* block, size_t) noexcept {
+  base::Free(block, 0);
+}
+
+SINGLETON_ALLOCATOR void operator delete[](void* block, size_t) noexcept {
+  base::Free(block, 0);
+}
+
+#if defined(__cpp_aligned_new)
+SINGLETON_ALLOCATOR void* operator new(size_t size, std::align_val_t align) {
+  return base::AllocateOrThrow(size, static_cast<size_t>(align));
+}
+
+SINGLETON_ALLOCATOR void* operator new[](size_t size,
+                                         std::align_val_t align) {
+  return base::AllocateOrThrow(size, static_cast<size_t>(align));
+}
+
+SINGLETON_ALLOCATOR void operator delete(void* block,
+                                         std::align_val_t align) noexcept {
+  base::Free(block, static_cast<size_t>(align));
+}
+
+SINGLETON_ALLOCATOR void operator delete[](void* block,
+                                           std::align_val_t align) noexcept {
+  base::Free(block, static_cast<size_t>(align));
+}
+
+SINGLETON_ALLOCATOR void operator delete(void* block,
+                                         size_t,
+                                         std::align_val_t align) noexcept {
+  base::Free(block, static_cast<size_t>(align));
+}
+
+SINGLETON_ALLOCATOR void operator delete[](void* block,
+                                           size_t,
+                                           std::align_val_t align) noexcept {
+  base::Free(block, static_cast<size_t>(align));
+}
+#endif  // defined(__cpp_aligned_new)
+
+#endif  // defined(SINGLETON_MEMORY_ACCOUNTING)
@@ -0,0 +1,99 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Attributes heap memory to the singletons that own it. Built only with
+// ENABLE_SINGLETON_MEMORY_ACCOUNTING (make MEMORY_ACCOUNTING=1), which
+// replaces the global operator new and operator delete; without it, nothing
+// in here generates any code and GetSingletonMemoryUsage() reports nothing.
+//
+// Allocations made through operator new while a Singleton<Type> is being
+// constructed are charged to Type. So are allocations made later within a
+// ScopedSingletonMemoryTag<Type> (see singleton.h), e.g. when the singleton
+// fills a cache:
+//   void Cache::Insert(...) {
+//     ScopedSingletonMemoryTag<Cache> tag;
+//     entries_.push_back(...);
+//   }
+// Memory freed is credited back to the type that allocated it, whoever frees
+// it.
+//
+// The same goes for memory that the singleton helpers get without operator
+// new: internal::AlignedAlloc() for over-aligned instances, and the arena,
+// huge page, NUMA and mapped file traits, which charge what they map. Arena
+// memory is never given back, so it is never credited. malloc() and mmap()
+// calls made directly are not seen, and neither are SharedMemorySingleton
+// segments, which belong to no single process.
+
+#ifndef BASE_MEMORY_SINGLETON_MEMORY_H_
+#define BASE_MEMORY_SINGLETON_MEMORY_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "atomicops.h"
+#include "base_export.h"
+
+#if defined(ENABLE_SINGLETON_MEMORY_ACCOUNTING)
+#define SINGLETON_MEMORY_ACCOUNTING
+#endif
+
+namespace base {
+
+struct SingletonMemoryUsage {
+  // __PRETTY_FUNCTION__ naming the type, see
+  // internal::GetSingletonTypeName().
+  const char* pretty_name;
+  // Bytes allocated and not freed yet.
+  size_t live_bytes;
+  size_t allocated_bytes;
+  size_t allocation_count;
+};
+
+// Whether allocations are being accounted for in this build.
+BASE_EXPORT bool SingletonMemoryAccountingEnabled();
+
+// Returns the usage of every type that has been charged for memory, in no
+// particular order.
+BASE_EXPORT std::vector<SingletonMemoryUsage> GetSingletonMemoryUsage();
+
+namespace internal {
+
+// What is charged to one type. Linked into a process-wide list the first time
+// it becomes current.
+struct SingletonMemoryAccount {
+  const char* pretty_name;
+  subtle::AtomicWord allocated_bytes;
+  subtle::AtomicWord freed_bytes;
+  subtle::AtomicWord allocation_count;
+  subtle::AtomicWord registered;
+  SingletonMemoryAccount* next;
+};
+
+// Makes |account| the one the calling thread's allocations are charged to,
+// registering it under |pretty_name| if needed, and returns the previous
+// one. |account| may be NULL.
+BASE_EXPORT SingletonMemoryAccount* SwapSingletonMemoryAccount(
+    SingletonMemoryAccount* account,
+    const char* pretty_name);
+
+#if defined(SINGLETON_MEMORY_ACCOUNTING)
+// Charges the |size| bytes at |address|, which don't come from operator new,
+// to the calling thread's current account, if any. Blocks are kept in a
+// locked list: meant for a few large ones, such as singleton instances.
+BASE_EXPORT void ChargeSingletonMemoryBlock(const void* address, size_t size);
+
+// Credits the block charged at |address| back to its account, if it was.
+BASE_EXPORT void CreditSingletonMemoryBlock(const void* address);
+#else
+inline void ChargeSingletonMemoryBlock(const void* /*address*/,
+                                       size_t /*size*/) {}
+inline void CreditSingletonMemoryBlock(const void* /*address*/) {}
+#endif
+
+}  // namespace internal
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_MEMORY_H_
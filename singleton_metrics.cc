@@ -0,0 +1,395 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "singleton_memory.h"
+#include "singleton_reclaimer.h"
+#include "singleton_registry.h"
+
+namespace base {
+
+namespace {
+
+const char kUnixPrefix[] = "unix:";
+
+struct Exporter {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  std::string destination;
+  int interval_ms;
+  bool stop;
+};
+
+// Guards g_exporter. Only taken by Start/Stop, never by the exporter thread.
+pthread_mutex_t g_exporter_lock = PTHREAD_MUTEX_INITIALIZER;
+Exporter* g_exporter = NULL;
+
+// Appends |value| as a label value, escaped as the text format requires.
+void AppendLabelValue(const char* value, std::string* out) {
+  for (; *value; ++value) {
+    if (*value == '\\' || *value == '"') {
+      out->push_back('\\');
+      out->push_back(*value);
+    } else if (*value == '\n') {
+      out->append("\\n");
+    } else {
+      out->push_back(*value);
+    }
+  }
+}
+
+void AppendHeader(const char* name,
+                  const char* type,
+                  const char* help,
+                  std::string* out) {
+  out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+// Appends |name|="|value|" to a label set.
+void AppendLabel(const char* name, const char* value, std::string* labels) {
+  if (!labels->empty())
+    labels->push_back(',');
+  labels->append(name).append("=\"");
+  AppendLabelValue(value, labels);
+  labels->push_back('"');
+}
+
+// Returns the label set of each of |pretty_names|: the Type, Traits and
+// DifferentiatingType template arguments, so that shards and variants of a
+// singleton of the same type are told apart. Types that print the same, e.g.
+// from anonymous namespaces in different files, additionally get an
+// "instance" label, as a scrape with repeated series is rejected.
+std::vector<std::string> MakeLabels(
+    const std::vector<const char*>& pretty_names) {
+  static const char* const kArguments[][2] = {
+      {"Traits", "traits"},
+      {"DifferentiatingType", "differentiating_type"},
+  };
+  std::vector<std::string> labels(pretty_names.size());
+  char value[1024];
+  for (size_t i = 0; i < pretty_names.size(); ++i) {
+    internal::GetSingletonTypeName(pretty_names[i], value, sizeof(value));
+    AppendLabel("type", value, &labels[i]);
+    for (size_t j = 0; j < sizeof(kArguments) / sizeof(kArguments[0]); ++j) {
+      if (internal::GetSingletonTemplateArgument(
+              pretty_names[i], kArguments[j][0], value, sizeof(value))) {
+        AppendLabel(kArguments[j][1], value, &labels[i]);
+      }
+    }
+  }
+
+  std::vector<std::string> unique(labels);
+  for (size_t i = 0; i < labels.size(); ++i) {
+    int earlier = 0;
+    bool repeated = false;
+    for (size_t j = 0; j < labels.size(); ++j) {
+      if (j != i && labels[j] == labels[i]) {
+        repeated = true;
+        if (j < i)
+          ++earlier;
+      }
+    }
+    if (!repeated)
+      continue;
+    char instance[16];
+    snprintf(instance, sizeof(instance), "%d", earlier + 1);
+    AppendLabel("instance", instance, &unique[i]);
+  }
+  return unique;
+}
+
+// Appends "name{labels} value", or "name value" if |labels| is NULL.
+void AppendSample(const char* name,
+                  const std::string* labels,
+                  const char* value,
+                  std::string* out) {
+  out->append(name);
+  if (labels)
+    out->append("{").append(*labels).append("}");
+  out->append(" ").append(value).append("\n");
+}
+
+void AppendInteger(const char* name,
+                   const std::string* labels,
+                   long long value,
+                   std::string* out) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%lld", value);
+  AppendSample(name, labels, buffer, out);
+}
+
+void AppendSeconds(const char* name,
+                   const std::string* labels,
+                   int64_t ns,
+                   std::string* out) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9f", ns / 1e9);
+  AppendSample(name, labels, buffer, out);
+}
+
+bool WriteAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = write(fd, data.data() + written, data.size() - written);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return false;
+    written += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+bool WriteToSocket(const std::string& path, const std::string& data) {
+  struct sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path.c_str(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  bool ok = connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+                    sizeof(address)) == 0 &&
+            WriteAll(fd, data);
+  close(fd);
+  return ok;
+}
+
+// Scrapers must never see a partially written file.
+bool WriteToFile(const std::string& path, const std::string& data) {
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0)
+    return false;
+  bool ok = WriteAll(fd, data);
+  ok = close(fd) == 0 && ok;
+  if (ok)
+    ok = rename(temporary.c_str(), path.c_str()) == 0;
+  if (!ok)
+    unlink(temporary.c_str());
+  return ok;
+}
+
+void Export(const std::string& destination) {
+  std::string metrics = GetSingletonMetrics();
+  size_t prefix = sizeof(kUnixPrefix) - 1;
+  if (destination.compare(0, prefix, kUnixPrefix) == 0)
+    WriteToSocket(destination.substr(prefix), metrics);
+  else
+    WriteToFile(destination, metrics);
+}
+
+void* ExporterMain(void* param) {
+  Exporter* exporter = static_cast<Exporter*>(param);
+  pthread_mutex_lock(&exporter->lock);
+  while (true) {
+    bool stop = exporter->stop;
+    pthread_mutex_unlock(&exporter->lock);
+    Export(exporter->destination);
+    pthread_mutex_lock(&exporter->lock);
+    if (stop)
+      break;
+
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += exporter->interval_ms / 1000;
+    until.tv_nsec += (exporter->interval_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      ++until.tv_sec;
+      until.tv_nsec -= 1000000000L;
+    }
+    while (!exporter->stop &&
+           pthread_cond_timedwait(&exporter->cond, &exporter->lock, &until) !=
+               ETIMEDOUT) {
+    }
+  }
+  pthread_mutex_unlock(&exporter->lock);
+  return NULL;
+}
+
+}  // namespace
+
+std::string GetSingletonMetrics() {
+  std::vector<internal::SingletonRecord*> records;
+  std::vector<const char*> pretty_names;
+  for (internal::SingletonRecord* record = internal::GetSingletonRecords();
+       record; record = record->next) {
+    records.push_back(record);
+    pretty_names.push_back(record->pretty_name);
+  }
+  std::vector<std::string> labels = MakeLabels(pretty_names);
+
+  std::string out;
+  AppendHeader("singleton_instances", "gauge",
+               "Singletons created in this process.", &out);
+  AppendInteger("singleton_instances", NULL,
+                static_cast<long long>(records.size()), &out);
+
+  AppendHeader("singleton_sealed", "gauge",
+               "1 once SealSingletons() was called.", &out);
+  AppendInteger("singleton_sealed", NULL, SingletonsSealed() ? 1 : 0, &out);
+
+  AppendHeader("singleton_construction_seconds", "gauge",
+               "Time Traits::New() took, nested creations included.", &out);
+  for (size_t i = 0; i < records.size(); ++i) {
+    AppendSeconds("singleton_construction_seconds", &labels[i],
+                  records[i]->construction_ns, &out);
+  }
+
+  AppendHeader("singleton_creation_waits_total", "counter",
+               "Threads that waited for another thread to create the "
+               "singleton.",
+               &out);
+  for (size_t i = 0; i < records.size(); ++i) {
+    internal::SingletonWaitStats waits =
+        internal::GetSingletonWaitStats(records[i]->instance);
+    AppendInteger("singleton_creation_waits_total", &labels[i], waits.waits,
+                  &out);
+  }
+
+  AppendHeader("singleton_creation_wait_seconds_total", "counter",
+               "Time threads spent waiting for another thread to create the "
+               "singleton.",
+               &out);
+  for (size_t i = 0; i < records.size(); ++i) {
+    internal::SingletonWaitStats waits =
+        internal::GetSingletonWaitStats(records[i]->instance);
+    AppendSeconds("singleton_creation_wait_seconds_total", &labels[i],
+                  waits.wait_ns, &out);
+  }
+
+  // Also counts waits on KeyedSingleton and WeakSingleton instances, which
+  // have no record.
+  internal::SingletonWaitStats total = internal::GetTotalSingletonWaitStats();
+  AppendHeader("singleton_all_creation_waits_total", "counter",
+               "Creation waits on any singleton instance word.", &out);
+  AppendInteger("singleton_all_creation_waits_total", NULL, total.waits, &out);
+  AppendHeader("singleton_all_creation_wait_seconds_total", "counter",
+               "Time spent in creation waits on any singleton instance word.",
+               &out);
+  AppendSeconds("singleton_all_creation_wait_seconds_total", NULL,
+                total.wait_ns, &out);
+
+  if (SingletonMemoryAccountingEnabled()) {
+    std::vector<SingletonMemoryUsage> usage = GetSingletonMemoryUsage();
+    std::vector<const char*> usage_names;
+    for (size_t i = 0; i < usage.size(); ++i)
+      usage_names.push_back(usage[i].pretty_name);
+    std::vector<std::string> usage_labels = MakeLabels(usage_names);
+    AppendHeader("singleton_memory_live_bytes", "gauge",
+                 "Heap memory allocated during construction and still live.",
+                 &out);
+    for (size_t i = 0; i < usage.size(); ++i) {
+      AppendInteger("singleton_memory_live_bytes", &usage_labels[i],
+                    static_cast<long long>(usage[i].live_bytes), &out);
+    }
+    AppendHeader("singleton_memory_allocated_bytes_total", "counter",
+                 "Heap memory allocated during construction.", &out);
+    for (size_t i = 0; i < usage.size(); ++i) {
+      AppendInteger("singleton_memory_allocated_bytes_total",
+                    &usage_labels[i],
+                    static_cast<long long>(usage[i].allocated_bytes), &out);
+    }
+    AppendHeader("singleton_memory_allocations_total", "counter",
+                 "Heap allocations made during construction.", &out);
+    for (size_t i = 0; i < usage.size(); ++i) {
+      AppendInteger("singleton_memory_allocations_total", &usage_labels[i],
+                    static_cast<long long>(usage[i].allocation_count), &out);
+    }
+  }
+
+  // The reclaimer lock is only taken when instances are retired, never by
+  // get().
+  SingletonReclaimerStats reclaimer;
+  GetSingletonReclaimerStats(&reclaimer);
+  AppendHeader("singleton_reclaimer_pending", "gauge",
+               "Retired instances queued for destruction.", &out);
+  AppendInteger("singleton_reclaimer_pending", NULL,
+                static_cast<long long>(reclaimer.pending), &out);
+  AppendHeader("singleton_reclaimer_max_pending", "gauge",
+               "Largest number of queued retired instances.", &out);
+  AppendInteger("singleton_reclaimer_max_pending", NULL,
+                static_cast<long long>(reclaimer.max_pending), &out);
+  AppendHeader("singleton_reclaimer_completed_total", "counter",
+               "Retired instances destroyed by the reclaimer.", &out);
+  AppendInteger("singleton_reclaimer_completed_total", NULL,
+                static_cast<long long>(reclaimer.completed), &out);
+  AppendHeader("singleton_reclaimer_blocked_total", "counter",
+               "Retirements that waited for room in the reclaimer queue.",
+               &out);
+  AppendInteger("singleton_reclaimer_blocked_total", NULL,
+                static_cast<long long>(reclaimer.blocked), &out);
+  return out;
+}
+
+bool StartSingletonMetricsExporter(const std::string& destination,
+                                   int interval_ms) {
+  pthread_mutex_lock(&g_exporter_lock);
+  if (g_exporter) {
+    pthread_mutex_unlock(&g_exporter_lock);
+    return false;
+  }
+
+  Exporter* exporter = new Exporter;
+  pthread_mutex_init(&exporter->lock, NULL);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&exporter->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  exporter->destination = destination;
+  exporter->interval_ms = interval_ms > 0 ? interval_ms : 1;
+  exporter->stop = false;
+
+  if (pthread_create(&exporter->thread, NULL, &ExporterMain, exporter) != 0) {
+    pthread_cond_destroy(&exporter->cond);
+    pthread_mutex_destroy(&exporter->lock);
+    delete exporter;
+    pthread_mutex_unlock(&g_exporter_lock);
+    return false;
+  }
+  g_exporter = exporter;
+  pthread_mutex_unlock(&g_exporter_lock);
+  return true;
+}
+
+void StopSingletonMetricsExporter() {
+  pthread_mutex_lock(&g_exporter_lock);
+  Exporter* exporter = g_exporter;
+  g_exporter = NULL;
+  pthread_mutex_unlock(&g_exporter_lock);
+  if (!exporter)
+    return;
+
+  pthread_mutex_lock(&exporter->lock);
+  exporter->stop = true;
+  pthread_cond_signal(&exporter->cond);
+  pthread_mutex_unlock(&exporter->lock);
+  pthread_join(exporter->thread, NULL);
+
+  pthread_cond_destroy(&exporter->cond);
+  pthread_mutex_destroy(&exporter->lock);
+  delete exporter;
+}
+
+}  // namespace base
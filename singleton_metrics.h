@@ -0,0 +1,45 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Exports the statistics the singleton library keeps in the Prometheus text
+// exposition format: per singleton construction time, creation waits and,
+// when built with MEMORY_ACCOUNTING=1, heap usage, plus the state of the
+// reclaimer thread. Per singleton series are labelled with the type, traits
+// and differentiating_type template arguments of the Singleton<>.
+//
+// Example usage:
+//   // Picked up by node_exporter's textfile collector.
+//   StartSingletonMetricsExporter(
+//       "/var/lib/node_exporter/textfile/singletons.prom", 15000);
+//
+// Taking a snapshot never takes a lock that Singleton::get() may take, the
+// creation slow path included: the registry and the wait table are walked
+// lock-free, so a scrape can't stall, nor be stalled by, a slow constructor.
+
+#ifndef BASE_MEMORY_SINGLETON_METRICS_H_
+#define BASE_MEMORY_SINGLETON_METRICS_H_
+
+#include <string>
+
+#include "base_export.h"
+
+namespace base {
+
+// Returns the current statistics in the Prometheus text format.
+BASE_EXPORT std::string GetSingletonMetrics();
+
+// Starts a thread that writes GetSingletonMetrics() to |destination| every
+// |interval_ms| milliseconds. A destination of the form "unix:<path>" is a
+// Unix stream socket that is connected to and sent each snapshot; anything
+// else is a file, replaced atomically with rename(). Returns false if an
+// exporter is already running or the thread can't be started.
+BASE_EXPORT bool StartSingletonMetricsExporter(const std::string& destination,
+                                               int interval_ms);
+
+// Stops the exporter thread, after it wrote one last snapshot.
+BASE_EXPORT void StopSingletonMetricsExporter();
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_METRICS_H_
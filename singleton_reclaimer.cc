@@ -0,0 +1,184 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_reclaimer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "atomicops.h"
+
+namespace base {
+
+namespace {
+
+// Bound of the queue. Retirements are rare; reaching it means destruction
+// can't keep up and the retiring threads should slow down.
+const size_t kQueueCapacity = 256;
+
+struct ReclaimTask {
+  void (*deleter)(void*);
+  void* instance;
+};
+
+// State of the reclaimer thread. Leaked on purpose, like the WeakSingleton
+// reaper, so that retirements during static destruction still work.
+struct Reclaimer {
+  pthread_mutex_t lock;
+  // Signaled when a task is queued.
+  pthread_cond_t not_empty;
+  // Signaled when a task is dequeued or completed.
+  pthread_cond_t progress;
+  ReclaimTask tasks[kQueueCapacity];
+  size_t head;
+  size_t queued;
+  // Queued plus running.
+  size_t pending;
+  pthread_t thread;
+  SingletonReclaimerStats stats;
+};
+
+// The Reclaimer, published once its thread is started. Read with
+// GetReclaimer(): Drain and stats callers don't start it.
+subtle::AtomicWord g_reclaimer = 0;
+// Serializes starts. Not a pthread_once_t, which can't be reset in a forked
+// child.
+pthread_mutex_t g_start_lock = PTHREAD_MUTEX_INITIALIZER;
+bool g_hooks_installed = false;
+
+Reclaimer* GetReclaimer() {
+  return reinterpret_cast<Reclaimer*>(subtle::Acquire_Load(&g_reclaimer));
+}
+
+void* ReclaimerMain(void* arg) {
+  // Lowest priority: destruction is never urgent.
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+
+  Reclaimer* reclaimer = static_cast<Reclaimer*>(arg);
+  pthread_mutex_lock(&reclaimer->lock);
+  while (true) {
+    while (reclaimer->queued == 0)
+      pthread_cond_wait(&reclaimer->not_empty, &reclaimer->lock);
+
+    ReclaimTask task = reclaimer->tasks[reclaimer->head];
+    reclaimer->head = (reclaimer->head + 1) % kQueueCapacity;
+    --reclaimer->queued;
+    pthread_cond_broadcast(&reclaimer->progress);
+
+    pthread_mutex_unlock(&reclaimer->lock);
+    task.deleter(task.instance);
+    pthread_mutex_lock(&reclaimer->lock);
+
+    --reclaimer->pending;
+    ++reclaimer->stats.completed;
+    pthread_cond_broadcast(&reclaimer->progress);
+  }
+  return NULL;
+}
+
+void DrainAtExit() {
+  DrainSingletonReclaimer();
+}
+
+// The child has no reclaimer thread, and the lock may have been held by a
+// thread that isn't there either. Tasks queued in the parent are left to the
+// parent: the instances they retire are the parent's copies. The next
+// PostReclaim() in the child starts a reclaimer of its own.
+void OnForkInChild() {
+  subtle::NoBarrier_Store(&g_reclaimer, 0);
+  pthread_mutex_init(&g_start_lock, NULL);
+}
+
+Reclaimer* StartReclaimer() {
+  Reclaimer* reclaimer = new Reclaimer();
+  pthread_mutex_init(&reclaimer->lock, NULL);
+  pthread_cond_init(&reclaimer->not_empty, NULL);
+  pthread_cond_init(&reclaimer->progress, NULL);
+
+  pthread_attr_t thread_attr;
+  pthread_attr_init(&thread_attr);
+  pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+  pthread_create(&reclaimer->thread, &thread_attr, &ReclaimerMain, reclaimer);
+  pthread_attr_destroy(&thread_attr);
+
+  // Releases the initialized lock and |thread| to GetReclaimer() callers.
+  subtle::Release_Store(&g_reclaimer,
+                        reinterpret_cast<subtle::AtomicWord>(reclaimer));
+
+  if (!g_hooks_installed) {
+    g_hooks_installed = true;
+    // exit() doesn't wait for other threads; finish what was queued first.
+    atexit(&DrainAtExit);
+    pthread_atfork(NULL, NULL, &OnForkInChild);
+  }
+  return reclaimer;
+}
+
+Reclaimer* GetOrStartReclaimer() {
+  Reclaimer* reclaimer = GetReclaimer();
+  if (reclaimer)
+    return reclaimer;
+  pthread_mutex_lock(&g_start_lock);
+  reclaimer = GetReclaimer();
+  if (!reclaimer)
+    reclaimer = StartReclaimer();
+  pthread_mutex_unlock(&g_start_lock);
+  return reclaimer;
+}
+
+}  // namespace
+
+void GetSingletonReclaimerStats(SingletonReclaimerStats* stats) {
+  Reclaimer* reclaimer = GetReclaimer();
+  if (!reclaimer) {
+    *stats = SingletonReclaimerStats();
+    return;
+  }
+  pthread_mutex_lock(&reclaimer->lock);
+  *stats = reclaimer->stats;
+  stats->pending = reclaimer->pending;
+  pthread_mutex_unlock(&reclaimer->lock);
+}
+
+void DrainSingletonReclaimer() {
+  Reclaimer* reclaimer = GetReclaimer();
+  if (!reclaimer || pthread_equal(pthread_self(), reclaimer->thread))
+    return;
+  pthread_mutex_lock(&reclaimer->lock);
+  while (reclaimer->pending > 0)
+    pthread_cond_wait(&reclaimer->progress, &reclaimer->lock);
+  pthread_mutex_unlock(&reclaimer->lock);
+}
+
+namespace internal {
+
+void PostReclaim(void (*deleter)(void*), void* instance) {
+  Reclaimer* reclaimer = GetOrStartReclaimer();
+  if (pthread_equal(pthread_self(), reclaimer->thread)) {
+    deleter(instance);
+    return;
+  }
+
+  pthread_mutex_lock(&reclaimer->lock);
+  if (reclaimer->queued == kQueueCapacity) {
+    ++reclaimer->stats.blocked;
+    while (reclaimer->queued == kQueueCapacity)
+      pthread_cond_wait(&reclaimer->progress, &reclaimer->lock);
+  }
+  size_t tail = (reclaimer->head + reclaimer->queued) % kQueueCapacity;
+  reclaimer->tasks[tail].deleter = deleter;
+  reclaimer->tasks[tail].instance = instance;
+  ++reclaimer->queued;
+  ++reclaimer->pending;
+  if (reclaimer->pending > reclaimer->stats.max_pending)
+    reclaimer->stats.max_pending = reclaimer->pending;
+  pthread_cond_signal(&reclaimer->not_empty);
+  pthread_mutex_unlock(&reclaimer->lock);
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,71 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Moves the destruction of retired singleton instances off the thread that
+// retires them. Destructors that free large structures or join threads can
+// take milliseconds; with DeferredDeleteTraits they run on a dedicated low
+// priority reclaimer thread instead of, say, the request thread that evicted
+// a KeyedSingleton entry.
+//
+// Example usage:
+//   typedef KeyedSingleton<Shard, int,
+//                          DeferredDeleteTraits<Shard, ShardTraits> > Shards;
+//   Shards::Evict(id);  // Returns once the Shard is queued.
+//
+// Instances queued when the process exits normally are destroyed before the
+// atexit() handlers registered earlier run; call DrainSingletonReclaimer() to
+// wait for them at any other point. A forked child starts with an empty queue
+// and a reclaimer of its own; instances queued in the parent before fork()
+// are only destroyed there.
+
+#ifndef BASE_MEMORY_SINGLETON_RECLAIMER_H_
+#define BASE_MEMORY_SINGLETON_RECLAIMER_H_
+
+#include <stddef.h>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+struct SingletonReclaimerStats {
+  // Instances queued and not destroyed yet.
+  size_t pending;
+  // Largest value of |pending| so far.
+  size_t max_pending;
+  size_t completed;
+  // Retirements that had to wait because the queue was full.
+  size_t blocked;
+};
+
+// Fills |stats| with the current state of the reclaimer.
+BASE_EXPORT void GetSingletonReclaimerStats(SingletonReclaimerStats* stats);
+
+// Blocks until every instance queued so far has been destroyed.
+BASE_EXPORT void DrainSingletonReclaimer();
+
+namespace internal {
+
+// Queues |deleter|(|instance|) for the reclaimer thread. If the queue is
+// full, waits for room: retirement is throttled to the pace of destruction
+// rather than letting garbage pile up. Runs |deleter| inline when called from
+// the reclaimer thread itself, which would otherwise wait on itself.
+BASE_EXPORT void PostReclaim(void (*deleter)(void*), void* instance);
+
+}  // namespace internal
+
+// Wraps the traits of a Singleton<>, WeakSingleton<> or KeyedSingleton<> so
+// that Delete() hands the instance to the reclaimer thread. Everything else
+// is inherited from Traits.
+template <typename Type, typename Traits = DefaultSingletonTraits<Type> >
+struct SINGLETON_EXPORT DeferredDeleteTraits : public Traits {
+  static void Delete(Type* x) { internal::PostReclaim(&DeleteNow, x); }
+
+ private:
+  static void DeleteNow(void* x) { Traits::Delete(static_cast<Type*>(x)); }
+};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_RECLAIMER_H_
@@ -0,0 +1,195 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace base {
+
+namespace {
+
+// Head of the list of SingletonRecords, newest first.
+subtle::AtomicWord g_records = 0;
+
+subtle::Atomic32 g_sealed = 0;
+
+// Wait statistics by instance word, open addressed. Keys are never removed.
+const size_t kWaitSlots = 512;
+const size_t kMaxWaitProbes = 16;
+
+struct WaitSlot {
+  subtle::AtomicWord key;
+  subtle::AtomicWord waits;
+  subtle::AtomicWord wait_ns;
+};
+
+WaitSlot g_wait_slots[kWaitSlots];
+WaitSlot g_total_waits;
+
+// Returns the slot of |instance|, claiming one if |create|.
+WaitSlot* FindWaitSlot(const void* instance, bool create) {
+  subtle::AtomicWord key = reinterpret_cast<subtle::AtomicWord>(instance);
+  size_t index = (static_cast<size_t>(key) >> 3) % kWaitSlots;
+  for (size_t probe = 0; probe < kMaxWaitProbes; ++probe) {
+    WaitSlot* slot = &g_wait_slots[(index + probe) % kWaitSlots];
+    subtle::AtomicWord slot_key = subtle::NoBarrier_Load(&slot->key);
+    if (slot_key == 0) {
+      if (!create)
+        return NULL;
+      slot_key = subtle::NoBarrier_CompareAndSwap(&slot->key, 0, key);
+      if (slot_key == 0)
+        return slot;
+    }
+    if (slot_key == key)
+      return slot;
+  }
+  return NULL;
+}
+
+internal::SingletonWaitStats ReadWaitSlot(WaitSlot* slot) {
+  internal::SingletonWaitStats stats = {0, 0};
+  if (slot) {
+    stats.waits = subtle::NoBarrier_Load(&slot->waits);
+    stats.wait_ns = subtle::NoBarrier_Load(&slot->wait_ns);
+  }
+  return stats;
+}
+
+}  // namespace
+
+void SealSingletons() {
+  subtle::Release_Store(&g_sealed, 1);
+}
+
+bool SingletonsSealed() {
+  return subtle::Acquire_Load(&g_sealed) != 0;
+}
+
+namespace internal {
+
+void RegisterSingleton(SingletonRecord* record,
+                       const char* pretty_name,
+                       subtle::AtomicWord* instance,
+                       int64_t construction_ns) {
+  // A singleton that is recreated after OnExit() is already linked in.
+  if (record->instance)
+    return;
+  record->pretty_name = pretty_name;
+  record->instance = instance;
+  record->construction_ns = construction_ns;
+
+  subtle::AtomicWord head = subtle::NoBarrier_Load(&g_records);
+  while (true) {
+    record->next = reinterpret_cast<SingletonRecord*>(head);
+    subtle::AtomicWord previous = subtle::Release_CompareAndSwap(
+        &g_records, head, reinterpret_cast<subtle::AtomicWord>(record));
+    if (previous == head)
+      break;
+    head = previous;
+  }
+}
+
+SingletonRecord* GetSingletonRecords() {
+  return reinterpret_cast<SingletonRecord*>(subtle::Acquire_Load(&g_records));
+}
+
+void RecordSingletonWait(const void* instance, int64_t wait_ns) {
+  WaitSlot* slots[2] = {&g_total_waits, FindWaitSlot(instance, true)};
+  for (size_t i = 0; i < 2 && slots[i]; ++i) {
+    subtle::NoBarrier_AtomicIncrement(&slots[i]->waits, 1);
+    subtle::NoBarrier_AtomicIncrement(&slots[i]->wait_ns, wait_ns);
+  }
+}
+
+SingletonWaitStats GetSingletonWaitStats(const void* instance) {
+  return ReadWaitSlot(FindWaitSlot(instance, false));
+}
+
+SingletonWaitStats GetTotalSingletonWaitStats() {
+  return ReadWaitSlot(&g_total_waits);
+}
+
+bool GetSingletonTemplateArgument(const char* pretty_name,
+                                  const char* name,
+                                  char* buffer,
+                                  size_t size) {
+  if (!size)
+    return false;
+  buffer[0] = '\0';
+
+  // GCC: "... [with Type = Foo; Traits = ...]"
+  // Clang: "... [Type = Foo, Traits = ...]"
+  const char* argument = strstr(pretty_name, "[with ");
+  if (argument)
+    argument += strlen("[with ");
+  else if ((argument = strchr(pretty_name, '[')) != NULL)
+    ++argument;
+  else
+    return false;
+
+  size_t name_length = strlen(name);
+  while (true) {
+    const char* value = argument + name_length;
+    bool found = strncmp(argument, name, name_length) == 0 &&
+                 strncmp(value, " = ", 3) == 0;
+    if (found)
+      value += 3;
+
+    // The argument ends at the first separator that isn't nested in a
+    // template argument list.
+    const char* end = found ? value : argument;
+    int depth = 0;
+    for (; *end; ++end) {
+      if (*end == '<') {
+        ++depth;
+      } else if (*end == '>') {
+        --depth;
+      } else if (depth == 0 && (*end == ';' || *end == ',' || *end == ']')) {
+        break;
+      }
+    }
+
+    if (found) {
+      size_t length = static_cast<size_t>(end - value);
+      if (length >= size)
+        length = size - 1;
+      memcpy(buffer, value, length);
+      buffer[length] = '\0';
+      return true;
+    }
+    if (*end != ';' && *end != ',')
+      return false;
+    argument = end + 1;
+    while (*argument == ' ')
+      ++argument;
+  }
+}
+
+void GetSingletonTypeName(const char* pretty_name,
+                          char* buffer,
+                          size_t size) {
+  if (!size || GetSingletonTemplateArgument(pretty_name, "Type", buffer, size))
+    return;
+  size_t length = strlen(pretty_name);
+  if (length >= size)
+    length = size - 1;
+  memcpy(buffer, pretty_name, length);
+  buffer[length] = '\0';
+}
+
+void OnSingletonCreatedAfterSeal(const char* pretty_name) {
+  char name[256];
+  GetSingletonTypeName(pretty_name, name, sizeof(name));
+  fprintf(stderr,
+          "FATAL: Singleton<%s> created after SealSingletons(). Create it "
+          "during warm-up instead.\n",
+          name);
+  abort();
+}
+
+}  // namespace internal
+}  // namespace base
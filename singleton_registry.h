@@ -0,0 +1,97 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Process-wide bookkeeping of the Singleton<> instances that were created.
+// Nothing in here is on the Singleton::get() fast path: records are linked in
+// once, from the creation slow path.
+
+#ifndef BASE_MEMORY_SINGLETON_REGISTRY_H_
+#define BASE_MEMORY_SINGLETON_REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "atomicops.h"
+#include "base_export.h"
+
+namespace base {
+
+// Freezes the set of singletons. Call it once warm-up is over and every
+// singleton the process needs has been created. From then on, a
+// Singleton::get() that would have to create its instance is a fatal error
+// instead of a lazy creation. get() calls on created instances are unaffected.
+//
+// Accesses are only guaranteed to observe the sealed state if the call to
+// SealSingletons() happens-before them, e.g. it is made before the worker
+// threads are started or before they are released through a lock.
+BASE_EXPORT void SealSingletons();
+
+// Returns true once SealSingletons() has been called.
+BASE_EXPORT bool SingletonsSealed();
+
+namespace internal {
+
+// Bookkeeping for one Singleton<>. Lives in constant initialized static
+// storage next to the singleton's instance_, and is linked into the registry
+// when the instance is first published.
+struct SingletonRecord {
+  // __PRETTY_FUNCTION__ of the function that created the instance. See
+  // GetSingletonTypeName().
+  const char* pretty_name;
+  subtle::AtomicWord* instance;
+  // How long Traits::New() took, nested creations included.
+  int64_t construction_ns;
+  SingletonRecord* next;
+};
+
+// Links |record| into the registry. Called once per singleton, right after
+// its instance was published in |*instance|.
+BASE_EXPORT void RegisterSingleton(SingletonRecord* record,
+                                   const char* pretty_name,
+                                   subtle::AtomicWord* instance,
+                                   int64_t construction_ns);
+
+// Returns the most recently registered record. Records are never unlinked, so
+// the list can be walked without locking while singletons get registered.
+BASE_EXPORT SingletonRecord* GetSingletonRecords();
+
+// Time threads spent in WaitForInstance() for a creation by another thread.
+struct SingletonWaitStats {
+  int64_t waits;
+  int64_t wait_ns;
+};
+
+// Accounts one wait of |wait_ns| for the instance word |instance|. Waits are
+// kept in a fixed size lock-free table, by instance word rather than by
+// record: a waiter may be done before the creator registered the singleton.
+// Waits that don't fit in the table only count in the total.
+BASE_EXPORT void RecordSingletonWait(const void* instance, int64_t wait_ns);
+
+// Returns the waits recorded for |instance|, or for all instance words.
+BASE_EXPORT SingletonWaitStats GetSingletonWaitStats(const void* instance);
+BASE_EXPORT SingletonWaitStats GetTotalSingletonWaitStats();
+
+// Writes the template argument called |name|, e.g. "Traits", found in
+// |pretty_name| to |buffer|, as a NUL terminated string truncated to |size|
+// bytes. Returns false, leaving |buffer| empty, if there is none.
+BASE_EXPORT bool GetSingletonTemplateArgument(const char* pretty_name,
+                                              const char* name,
+                                              char* buffer,
+                                              size_t size);
+
+// Writes the "Type" template argument found in |pretty_name| to |buffer|, as
+// a NUL terminated string truncated to |size| bytes. Falls back to the whole
+// |pretty_name|.
+BASE_EXPORT void GetSingletonTypeName(const char* pretty_name,
+                                      char* buffer,
+                                      size_t size);
+
+// Reports a singleton created after SealSingletons() and aborts.
+BASE_EXPORT void OnSingletonCreatedAfterSeal(const char* pretty_name)
+    __attribute__((noreturn));
+
+}  // namespace internal
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_REGISTRY_H_
@@ -0,0 +1,264 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_snapshot.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicops.h"
+
+namespace base {
+
+namespace {
+
+// File layout, in host byte order: a FileHeader, then |record_count| records,
+// each a RecordHeader followed by the key, the data, and padding to a
+// multiple of 8 bytes.
+const char kMagic[8] = {'S', 'N', 'G', 'L', 'S', 'N', 'A', 'P'};
+const uint32_t kFormatVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t record_count;
+  uint64_t version;
+};
+
+struct RecordHeader {
+  uint32_t key_size;
+  uint32_t reserved;
+  uint64_t data_size;
+  // Checksum() of the key followed by the data.
+  uint64_t checksum;
+};
+
+// What LoadSingletonSnapshot() kept: the file contents, and the records whose
+// checksum matched.
+struct LoadedRecord {
+  const char* key;
+  size_t key_size;
+  const char* data;
+  size_t data_size;
+};
+
+struct LoadedSnapshot {
+  char* buffer;
+  LoadedRecord* records;
+  size_t record_count;
+};
+
+subtle::AtomicWord g_loaded = 0;
+
+pthread_mutex_t g_records_lock = PTHREAD_MUTEX_INITIALIZER;
+internal::SnapshotRecord* g_records = NULL;
+
+size_t Padding(size_t size) {
+  return (8 - size % 8) % 8;
+}
+
+// 64-bit FNV-1a.
+uint64_t Checksum(uint64_t hash, const char* data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+const uint64_t kChecksumSeed = 14695981039346656037ULL;
+
+bool ReadFile(const char* path, std::string* contents) {
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+  char buffer[64 * 1024];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents->append(buffer, read);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+void AppendRecord(const char* key, const std::string& data,
+                  std::string* out) {
+  RecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.key_size = static_cast<uint32_t>(strlen(key));
+  header.data_size = data.size();
+  header.checksum = Checksum(Checksum(kChecksumSeed, key, header.key_size),
+                             data.data(), data.size());
+  out->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  out->append(key, header.key_size);
+  out->append(data);
+  out->append(Padding(header.key_size + data.size()), '\0');
+}
+
+void FreeLoadedSnapshot(LoadedSnapshot* loaded) {
+  delete[] loaded->records;
+  delete[] loaded->buffer;
+  delete loaded;
+}
+
+}  // namespace
+
+bool LoadSingletonSnapshot(const char* path, uint64_t version) {
+  if (subtle::Acquire_Load(&g_loaded))
+    return false;
+  std::string contents;
+  if (!ReadFile(path, &contents) || contents.size() < sizeof(FileHeader))
+    return false;
+  FileHeader header;
+  memcpy(&header, contents.data(), sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.format_version != kFormatVersion || header.version != version) {
+    return false;
+  }
+
+  LoadedSnapshot* loaded = new LoadedSnapshot;
+  loaded->buffer = new char[contents.size()];
+  memcpy(loaded->buffer, contents.data(), contents.size());
+  loaded->records = new LoadedRecord[header.record_count ? header.record_count
+                                                         : 1];
+  loaded->record_count = 0;
+
+  size_t offset = sizeof(FileHeader);
+  for (uint32_t i = 0; i < header.record_count; ++i) {
+    RecordHeader record;
+    if (contents.size() - offset < sizeof(record))
+      break;
+    memcpy(&record, loaded->buffer + offset, sizeof(record));
+    offset += sizeof(record);
+    size_t available = contents.size() - offset;
+    if (record.key_size > available ||
+        record.data_size > available - record.key_size) {
+      break;  // Truncated; nothing after this can be trusted.
+    }
+
+    const char* key = loaded->buffer + offset;
+    const char* data = key + record.key_size;
+    size_t data_size = static_cast<size_t>(record.data_size);
+    offset += record.key_size + data_size;
+    offset += Padding(record.key_size + data_size);
+    if (offset > contents.size())
+      offset = contents.size();
+
+    if (Checksum(Checksum(kChecksumSeed, key, record.key_size), data,
+                 data_size) != record.checksum) {
+      continue;
+    }
+    LoadedRecord& loaded_record = loaded->records[loaded->record_count++];
+    loaded_record.key = key;
+    loaded_record.key_size = record.key_size;
+    loaded_record.data = data;
+    loaded_record.data_size = data_size;
+  }
+
+  // Records already handed out by FindSnapshotData() point into the loaded
+  // snapshot, so a concurrent load loses rather than replacing it.
+  if (subtle::Release_CompareAndSwap(
+          &g_loaded, 0, reinterpret_cast<subtle::AtomicWord>(loaded)) != 0) {
+    FreeLoadedSnapshot(loaded);
+    return false;
+  }
+  return true;
+}
+
+void DiscardSingletonSnapshot() {
+  LoadedSnapshot* loaded = reinterpret_cast<LoadedSnapshot*>(
+      subtle::NoBarrier_AtomicExchange(&g_loaded, 0));
+  if (loaded)
+    FreeLoadedSnapshot(loaded);
+}
+
+bool WriteSingletonSnapshot(const char* path, uint64_t version) {
+  std::string out;
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.version = version;
+  out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  uint32_t record_count = 0;
+  pthread_mutex_lock(&g_records_lock);
+  for (internal::SnapshotRecord* record = g_records; record;
+       record = record->next) {
+    std::string data;
+    if (record->instance && record->snapshot(record->instance, &data)) {
+      AppendRecord(record->key, data, &out);
+      ++record_count;
+    }
+  }
+  pthread_mutex_unlock(&g_records_lock);
+  header.record_count = record_count;
+  memcpy(&out[0], &header, sizeof(header));
+
+  // Write next to the destination and rename, so that a crash mid-write
+  // leaves the previous snapshot in place.
+  std::string temporary = std::string(path) + ".tmp";
+  FILE* file = fopen(temporary.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+  ok = fflush(file) == 0 && ok;
+  ok = fsync(fileno(file)) == 0 && ok;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(temporary.c_str(), path) != 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace internal {
+
+void RegisterSnapshotRecord(SnapshotRecord* record,
+                            const char* key,
+                            const void* instance,
+                            bool (*snapshot)(const void*, std::string*)) {
+  pthread_mutex_lock(&g_records_lock);
+  bool linked = false;
+  for (SnapshotRecord* it = g_records; it; it = it->next)
+    linked = linked || it == record;
+  strncpy(record->key, key, sizeof(record->key) - 1);
+  record->key[sizeof(record->key) - 1] = '\0';
+  record->instance = instance;
+  record->snapshot = snapshot;
+  if (!linked) {
+    record->next = g_records;
+    g_records = record;
+  }
+  pthread_mutex_unlock(&g_records_lock);
+}
+
+void ClearSnapshotRecord(SnapshotRecord* record) {
+  pthread_mutex_lock(&g_records_lock);
+  record->instance = NULL;
+  pthread_mutex_unlock(&g_records_lock);
+}
+
+bool FindSnapshotData(const char* key, const char** data, size_t* size) {
+  const LoadedSnapshot* loaded =
+      reinterpret_cast<const LoadedSnapshot*>(subtle::Acquire_Load(&g_loaded));
+  if (!loaded)
+    return false;
+  size_t key_size = strlen(key);
+  for (size_t i = 0; i < loaded->record_count; ++i) {
+    const LoadedRecord& record = loaded->records[i];
+    if (record.key_size == key_size &&
+        memcmp(record.key, key, key_size) == 0) {
+      *data = record.data;
+      *size = record.data_size;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace internal
+}  // namespace base
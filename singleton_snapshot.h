@@ -0,0 +1,156 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Warm restarts for singletons holding expensive state (caches, learned
+// tables). Singletons opt in with SnapshotSingletonTraits; on shutdown,
+// WriteSingletonSnapshot() serializes every opted-in instance into one file,
+// and on the next start LoadSingletonSnapshot() makes their creation restore
+// from that file instead of starting cold.
+//
+// Example usage:
+//   struct RouteCacheTraits
+//       : SnapshotSingletonTraits<RouteCache, RouteCacheTraits> {
+//     static bool Snapshot(const RouteCache& cache, std::string* data) {
+//       return cache.Serialize(data);
+//     }
+//     static RouteCache* Restore(const char* data, size_t size) {
+//       return RouteCache::Deserialize(data, size);  // NULL if it can't.
+//     }
+//   };
+//
+//   RouteCache* RouteCache::GetInstance() {
+//     return Singleton<RouteCache, RouteCacheTraits>::get();
+//   }
+//
+//   int main() {
+//     LoadSingletonSnapshot("/var/cache/foo/singletons", kBuildVersion);
+//     ...
+//     WriteSingletonSnapshot("/var/cache/foo/singletons", kBuildVersion);
+//   }
+
+#ifndef BASE_MEMORY_SINGLETON_SNAPSHOT_H_
+#define BASE_MEMORY_SINGLETON_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+// Reads the snapshot at |path|. Singletons created afterwards are restored
+// from it when it has a valid record for them. Returns false, and leaves
+// creation alone, if the file is missing, corrupt, or was written with a
+// different |version|; pass something that changes whenever the serialized
+// layout of any opted-in type does, e.g. a build id. Records that fail their
+// checksum are dropped individually. Call before the singletons are created.
+// Only one snapshot is loaded at a time: returns false if one already is,
+// until DiscardSingletonSnapshot().
+BASE_EXPORT bool LoadSingletonSnapshot(const char* path, uint64_t version);
+
+// Frees the data read by LoadSingletonSnapshot(). Call once every singleton
+// that could be restored has been created; must not race with their
+// creation.
+BASE_EXPORT void DiscardSingletonSnapshot();
+
+// Serializes every opted-in singleton created so far into |path|, replacing
+// it atomically. Snapshot hooks run on the calling thread, concurrently with
+// any other user of the instances. Returns false if the file couldn't be
+// written; singletons whose hook fails are left out.
+BASE_EXPORT bool WriteSingletonSnapshot(const char* path, uint64_t version);
+
+namespace internal {
+
+// Longest record key, including the terminating NUL.
+const size_t kMaxSnapshotKeySize = 256;
+
+// Opted-in singleton, linked in once its instance exists.
+struct SnapshotRecord {
+  char key[kMaxSnapshotKeySize];
+  const void* instance;
+  bool (*snapshot)(const void* instance, std::string* data);
+  SnapshotRecord* next;
+};
+
+// Links |record| in, or updates it if it already is. |key| is copied.
+BASE_EXPORT void RegisterSnapshotRecord(SnapshotRecord* record,
+                                        const char* key,
+                                        const void* instance,
+                                        bool (*snapshot)(const void*,
+                                                         std::string*));
+
+// Leaves |record| out of later snapshots, once its instance is deleted.
+BASE_EXPORT void ClearSnapshotRecord(SnapshotRecord* record);
+
+// Finds the loaded data for |key|. Returns false if there is none.
+BASE_EXPORT bool FindSnapshotData(const char* key,
+                                  const char** data,
+                                  size_t* size);
+
+}  // namespace internal
+
+// Traits for Singleton<Type> that take part in snapshots. Derived, the traits
+// struct deriving from this one, provides:
+//   static bool Snapshot(const Type& instance, std::string* data);
+//   static Type* Restore(const char* data, size_t size);
+// and may override
+//   static const char* SnapshotKey(char* buffer, size_t size);
+// which names the record in the file, either by returning a string of its
+// own or by writing one into |buffer| and returning that, at most |size| - 1
+// characters either way, and defaults to the name of Type. It may also
+// override NewFromScratch(), used when there is nothing to restore or
+// Restore() returned NULL. Restore() must allocate the way NewFromScratch()
+// does, so that Delete() can free either. Singletons of the same Type told
+// apart by DifferentiatingType need their own keys.
+template <typename Type, typename Derived>
+struct SINGLETON_EXPORT SnapshotSingletonTraits
+    : public DefaultSingletonTraits<Type> {
+  static Type* New() {
+    char buffer[internal::kMaxSnapshotKeySize];
+    const char* key = Derived::SnapshotKey(buffer, sizeof(buffer));
+    const char* data = NULL;
+    size_t size = 0;
+    Type* instance = NULL;
+    if (internal::FindSnapshotData(key, &data, &size))
+      instance = Derived::Restore(data, size);
+    if (!instance)
+      instance = Derived::NewFromScratch();
+
+    if (instance) {
+      internal::RegisterSnapshotRecord(&record_, key, instance,
+                                       &SnapshotThunk);
+    }
+    return instance;
+  }
+
+  static void Delete(Type* x) {
+    internal::ClearSnapshotRecord(&record_);
+    DefaultSingletonTraits<Type>::Delete(x);
+  }
+
+  static Type* NewFromScratch() { return DefaultSingletonTraits<Type>::New(); }
+
+  static const char* SnapshotKey(char* buffer, size_t size) {
+    internal::GetSingletonTypeName(__PRETTY_FUNCTION__, buffer, size);
+    return buffer;
+  }
+
+ private:
+  static bool SnapshotThunk(const void* instance, std::string* data) {
+    return Derived::Snapshot(*static_cast<const Type*>(instance), data);
+  }
+
+  static internal::SnapshotRecord record_;
+};
+
+template <typename Type, typename Derived>
+internal::SnapshotRecord SnapshotSingletonTraits<Type, Derived>::record_ = {
+    {0}, NULL, NULL, NULL};
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_SNAPSHOT_H_
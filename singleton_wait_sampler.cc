@@ -0,0 +1,236 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "singleton_wait_sampler.h"
+
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "singleton_registry.h"
+
+namespace base {
+
+namespace internal {
+subtle::AtomicWord g_singleton_wait_sample_interval_ns = 0;
+}  // namespace internal
+
+namespace {
+
+const int kMaxFrames = 32;
+
+// Per singleton rate limiting, by instance word.
+const size_t kRateSlots = 256;
+
+struct RateSlot {
+  subtle::AtomicWord key;
+  subtle::AtomicWord last_sample_ns;
+};
+
+RateSlot g_rate_slots[kRateSlots];
+
+// Distinct stacks. A slot goes from kSlotEmpty to kSlotWriting, claimed by
+// the thread that fills it, then to kSlotReady, after which only its count
+// changes.
+const size_t kStackSlots = 1024;
+const size_t kMaxProbes = 16;
+
+enum {
+  kSlotEmpty = 0,
+  kSlotWriting,
+  kSlotReady,
+};
+
+struct StackSlot {
+  subtle::AtomicWord state;
+  subtle::AtomicWord count;
+  uintptr_t hash;
+  const char* pretty_name;
+  int depth;
+  void* frames[kMaxFrames];
+};
+
+StackSlot g_stack_slots[kStackSlots];
+subtle::AtomicWord g_dropped = 0;
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+uintptr_t Mix(uintptr_t hash, uintptr_t value) {
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+// Returns true if |key| is due for a sample, and marks it sampled.
+bool TakeSample(const void* key, int64_t interval_ns) {
+  subtle::AtomicWord word = reinterpret_cast<subtle::AtomicWord>(key);
+  size_t index = Mix(0, word) % kRateSlots;
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    RateSlot& slot = g_rate_slots[(index + probe) % kRateSlots];
+    subtle::AtomicWord slot_key = subtle::NoBarrier_Load(&slot.key);
+    if (slot_key == 0) {
+      slot_key = subtle::NoBarrier_CompareAndSwap(&slot.key, 0, word);
+      if (slot_key == 0)
+        slot_key = word;
+    }
+    if (slot_key != word)
+      continue;
+
+    int64_t now = NowNs();
+    subtle::AtomicWord last = subtle::NoBarrier_Load(&slot.last_sample_ns);
+    if (last != 0 && now - last < interval_ns)
+      return false;
+    return subtle::NoBarrier_CompareAndSwap(&slot.last_sample_ns, last, now) ==
+           last;
+  }
+  return false;
+}
+
+bool SameStack(const StackSlot& slot, uintptr_t hash, const char* pretty_name,
+               void* const* frames, int depth) {
+  return slot.hash == hash && slot.pretty_name == pretty_name &&
+         slot.depth == depth &&
+         memcmp(slot.frames, frames, depth * sizeof(void*)) == 0;
+}
+
+void RecordStack(const char* pretty_name, void* const* frames, int depth) {
+  uintptr_t hash = Mix(0, reinterpret_cast<uintptr_t>(pretty_name));
+  for (int i = 0; i < depth; ++i)
+    hash = Mix(hash, reinterpret_cast<uintptr_t>(frames[i]));
+
+  size_t index = hash % kStackSlots;
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    StackSlot& slot = g_stack_slots[(index + probe) % kStackSlots];
+    subtle::AtomicWord state = subtle::Acquire_Load(&slot.state);
+    if (state == kSlotEmpty) {
+      state = subtle::Acquire_CompareAndSwap(&slot.state, kSlotEmpty,
+                                             kSlotWriting);
+      if (state == kSlotEmpty) {
+        slot.hash = hash;
+        slot.pretty_name = pretty_name;
+        slot.depth = depth;
+        memcpy(slot.frames, frames, depth * sizeof(void*));
+        subtle::NoBarrier_Store(&slot.count, 1);
+        subtle::Release_Store(&slot.state, kSlotReady);
+        return;
+      }
+    }
+    // A slot still being written may hold the same stack; it is then recorded
+    // twice, which the folded output tolerates.
+    if (state == kSlotReady &&
+        SameStack(slot, hash, pretty_name, frames, depth)) {
+      subtle::NoBarrier_AtomicIncrement(&slot.count, 1);
+      return;
+    }
+  }
+  subtle::NoBarrier_AtomicIncrement(&g_dropped, 1);
+}
+
+// Appends the name of the function of |symbol|, a backtrace_symbols() line
+// ("module(mangled+0x1f) [0x...]"), or its address if it has none.
+void AppendFrameName(const char* symbol, void* address, std::string* out) {
+  const char* open = strchr(symbol, '(');
+  const char* plus = open ? strchr(open, '+') : NULL;
+  if (open && plus && plus > open + 1) {
+    std::string mangled(open + 1, plus);
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled.c_str(), NULL, NULL, &status);
+    std::string name = status == 0 && demangled ? demangled : mangled;
+    free(demangled);
+    // ';' separates frames in the folded format.
+    for (size_t i = 0; i < name.size(); ++i) {
+      if (name[i] == ';')
+        name[i] = ':';
+    }
+    out->append(name);
+    return;
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%p", address);
+  out->append(buffer);
+}
+
+}  // namespace
+
+void EnableSingletonWaitSampling(int samples_per_second) {
+  if (samples_per_second > 0) {
+    // The first backtrace() loads the unwinder, which allocates; get that
+    // out of the way here rather than in a waiting thread.
+    void* frames[1];
+    backtrace(frames, 1);
+  }
+  subtle::AtomicWord interval =
+      samples_per_second > 0 ? 1000000000 / samples_per_second : 0;
+  subtle::NoBarrier_Store(&internal::g_singleton_wait_sample_interval_ns,
+                          interval);
+}
+
+std::string GetFoldedSingletonWaitStacks() {
+  std::string out;
+  for (size_t i = 0; i < kStackSlots; ++i) {
+    const StackSlot& slot = g_stack_slots[i];
+    if (subtle::Acquire_Load(&slot.state) != kSlotReady)
+      continue;
+
+    char** symbols = backtrace_symbols(slot.frames, slot.depth);
+    // backtrace() lists the innermost frame first; folded stacks start at
+    // the root.
+    for (int frame = slot.depth - 1; frame >= 0; --frame) {
+      if (symbols)
+        AppendFrameName(symbols[frame], slot.frames[frame], &out);
+      else
+        AppendFrameName("", slot.frames[frame], &out);
+      out.push_back(';');
+    }
+    free(symbols);
+
+    char name[256] = "?";
+    if (slot.pretty_name)
+      internal::GetSingletonTypeName(slot.pretty_name, name, sizeof(name));
+    char line[320];
+    snprintf(line, sizeof(line), "Singleton<%s> %ld\n", name,
+             static_cast<long>(subtle::NoBarrier_Load(&slot.count)));
+    out.append(line);
+  }
+
+  subtle::AtomicWord dropped = subtle::NoBarrier_Load(&g_dropped);
+  if (dropped) {
+    char line[64];
+    snprintf(line, sizeof(line), "[dropped] %ld\n", static_cast<long>(dropped));
+    out.append(line);
+  }
+  return out;
+}
+
+void ResetSingletonWaitSamples() {
+  for (size_t i = 0; i < kStackSlots; ++i)
+    subtle::Release_Store(&g_stack_slots[i].state, kSlotEmpty);
+  for (size_t i = 0; i < kRateSlots; ++i)
+    subtle::NoBarrier_Store(&g_rate_slots[i].last_sample_ns, 0);
+  subtle::NoBarrier_Store(&g_dropped, 0);
+}
+
+namespace internal {
+
+void SampleSingletonWait(const void* key, const char* pretty_name) {
+  int64_t interval = subtle::NoBarrier_Load(&g_singleton_wait_sample_interval_ns);
+  if (!interval || !TakeSample(key, interval))
+    return;
+
+  void* frames[kMaxFrames + 1];
+  int depth = backtrace(frames, kMaxFrames + 1);
+  // Leave out this function's own frame.
+  if (depth > 1)
+    RecordStack(pretty_name, frames + 1, depth - 1);
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,57 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Finds the code paths that run into singletons still being created. When
+// sampling is on, threads entering WaitForInstance() record their stack, at
+// most a few times per second per singleton, into a fixed-size lock-free
+// table. The table is dumped in the folded format flame graph tools read
+// ("root;caller;callee;Singleton<Type> count" per line):
+//   EnableSingletonWaitSampling(10);
+//   ...
+//   std::string folded = GetFoldedSingletonWaitStacks();
+//   // flamegraph.pl folded.txt > waits.svg
+//
+// Function names come from the dynamic symbol table: link executables with
+// -rdynamic to get theirs, otherwise their frames show up as addresses.
+
+#ifndef BASE_MEMORY_SINGLETON_WAIT_SAMPLER_H_
+#define BASE_MEMORY_SINGLETON_WAIT_SAMPLER_H_
+
+#include <string>
+
+#include "atomicops.h"
+#include "base_export.h"
+
+namespace base {
+
+// Starts sampling, keeping at most |samples_per_second| stacks per second for
+// each singleton. 0 stops sampling; collected stacks are kept.
+BASE_EXPORT void EnableSingletonWaitSampling(int samples_per_second);
+
+// Returns the stacks collected so far, one folded stack per line. Stacks
+// that didn't fit in the table are counted in a "[dropped]" line.
+BASE_EXPORT std::string GetFoldedSingletonWaitStacks();
+
+// Empties the table.
+BASE_EXPORT void ResetSingletonWaitSamples();
+
+namespace internal {
+
+// Minimum interval between two samples of the same singleton, 0 when
+// sampling is off.
+BASE_EXPORT extern subtle::AtomicWord g_singleton_wait_sample_interval_ns;
+
+// Records the calling thread's stack as waiting for the singleton whose
+// instance word is |key|, unless that singleton was sampled less than the
+// sampling interval ago. |pretty_name| names it; it may be NULL.
+BASE_EXPORT void SampleSingletonWait(const void* key, const char* pretty_name);
+
+inline bool SingletonWaitSamplingEnabled() {
+  return subtle::NoBarrier_Load(&g_singleton_wait_sample_interval_ns) != 0;
+}
+
+}  // namespace internal
+}  // namespace base
+
+#endif  // BASE_MEMORY_SINGLETON_WAIT_SAMPLER_H_
@@ -0,0 +1,201 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "at_exit.h"
+#include "atomicops.h"
+#include "singleton.h"
+#include "tests/test_util.h"
+
+namespace {
+
+int g_flush_pipe = -1;
+
+struct Buffered {
+  Buffered() {}
+  static Buffered* GetInstance() {
+    return base::Singleton<Buffered, BufferedTraits>::get();
+  }
+
+  struct BufferedTraits : public base::DefaultSingletonTraits<Buffered> {
+    static void Flush(Buffered* /*instance*/) {
+      char flushed = 'f';
+      if (write(g_flush_pipe, &flushed, 1) != 1)
+        _exit(2);
+    }
+  };
+};
+
+// Forks a child that runs |child| and returns its exit status. |flushed| is
+// set if a Flush() hook ran in the child.
+template <typename Child>
+int RunInChild(Child child, bool* flushed) {
+  int fds[2];
+  EXPECT_EQ(0, pipe(fds));
+  pid_t pid = fork();
+  EXPECT_TRUE(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    g_flush_pipe = fds[1];
+    child();
+    _exit(1);
+  }
+  close(fds[1]);
+  char byte;
+  *flushed = read(fds[0], &byte, 1) == 1;
+  close(fds[0]);
+  int status;
+  EXPECT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  return WEXITSTATUS(status);
+}
+
+void FastShutdownFlushesWithManager() {
+  bool flushed;
+  int status = RunInChild(
+      [] {
+        base::AtExitManager exit_manager;
+        Buffered::GetInstance();
+        base::AtExitManager::FastShutdownAndExit(3);
+      },
+      &flushed);
+  EXPECT_EQ(3, status);
+  EXPECT_TRUE(flushed);
+}
+
+void FastShutdownFlushesWithoutManager() {
+  bool flushed;
+  int status = RunInChild(
+      [] {
+        Buffered::GetInstance();
+        base::AtExitManager::FastShutdownAndExit(4);
+      },
+      &flushed);
+  EXPECT_EQ(4, status);
+  EXPECT_TRUE(flushed);
+}
+
+// Callbacks of the parallel teardown tests record the order they ran in.
+base::subtle::Atomic32 g_sequence = 0;
+
+struct Step {
+  const char* name;
+  base::subtle::Atomic32 ran_at;
+};
+
+void RecordStep(void* param) {
+  Step* step = static_cast<Step*>(param);
+  base::subtle::NoBarrier_Store(
+      &step->ran_at, base::subtle::NoBarrier_AtomicIncrement(&g_sequence, 1));
+}
+
+void RegisterStep(Step* step, const void* parent_key, bool independent) {
+  base::AtExitManager::RegisterSingletonCallback(
+      &RecordStep, step, step, parent_key, step->name, independent);
+}
+
+int64_t NowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// Independent singletons keep their dependencies: a parent is destroyed
+// before the singleton its creation created, and callbacks that aren't
+// independent stay in LIFO order with respect to everything.
+void ParallelTeardownKeepsDependencies() {
+  base::AtExitManager exit_manager;
+  base::AtExitManager::SetTeardownThreadCount(4);
+  Step plain = {"plain", 0};
+  Step child = {"child", 0};
+  Step parent = {"parent", 0};
+  Step other = {"other", 0};
+  Step last = {"last", 0};
+  RegisterStep(&plain, NULL, false);
+  // The child's creation completes first, so it is registered first.
+  RegisterStep(&child, &parent, true);
+  RegisterStep(&parent, NULL, true);
+  RegisterStep(&other, NULL, true);
+  RegisterStep(&last, NULL, false);
+  base::AtExitManager::ProcessCallbacksNow();
+  base::AtExitManager::SetTeardownThreadCount(1);
+
+  EXPECT_EQ(1, last.ran_at);
+  EXPECT_TRUE(parent.ran_at < child.ran_at);
+  EXPECT_TRUE(other.ran_at > last.ran_at && other.ran_at < plain.ran_at);
+  EXPECT_EQ(5, plain.ran_at);
+}
+
+// Two independent callbacks that each wait for the other to start only
+// finish if they run at the same time.
+base::subtle::Atomic32 g_started = 0;
+base::subtle::Atomic32 g_overlapped = 0;
+
+void WaitForPeer(void* /*param*/) {
+  base::subtle::NoBarrier_AtomicIncrement(&g_started, 1);
+  int64_t deadline = NowMs() + 5000;
+  while (base::subtle::NoBarrier_Load(&g_started) < 2 && NowMs() < deadline)
+    sched_yield();
+  if (base::subtle::NoBarrier_Load(&g_started) == 2)
+    base::subtle::NoBarrier_AtomicIncrement(&g_overlapped, 1);
+}
+
+void IndependentCallbacksRunInParallel() {
+  base::AtExitManager exit_manager;
+  base::AtExitManager::SetTeardownThreadCount(2);
+  static const char kFirst = 0, kSecond = 0;
+  base::AtExitManager::RegisterSingletonCallback(&WaitForPeer, NULL, &kFirst,
+                                                 NULL, "first", true);
+  base::AtExitManager::RegisterSingletonCallback(&WaitForPeer, NULL, &kSecond,
+                                                 NULL, "second", true);
+  base::AtExitManager::ProcessCallbacksNow();
+  base::AtExitManager::SetTeardownThreadCount(1);
+  EXPECT_EQ(2, base::subtle::NoBarrier_Load(&g_overlapped));
+}
+
+void Sleep20Ms(void* /*param*/) {
+  usleep(20 * 1000);
+}
+
+void Nothing(void* /*param*/) {}
+
+// Every callback is timed under the name it was registered with.
+void TeardownIsTimed() {
+  base::AtExitManager exit_manager;
+  static const char kSlow = 0, kFast = 0;
+  base::AtExitManager::RegisterSingletonCallback(&Sleep20Ms, NULL, &kSlow,
+                                                 NULL, "slow", true);
+  base::AtExitManager::RegisterSingletonCallback(&Nothing, NULL, &kFast, NULL,
+                                                 "fast", true);
+  base::AtExitManager::RegisterCallback(&Nothing, NULL);
+  base::AtExitManager::ProcessCallbacksNow();
+
+  std::vector<base::AtExitManager::CallbackTiming> timings =
+      base::AtExitManager::GetLastTeardownTimings();
+  EXPECT_EQ(3, timings.size());
+  EXPECT_TRUE(timings[0].pretty_name == NULL);
+  EXPECT_TRUE(strcmp("fast", timings[1].pretty_name) == 0);
+  EXPECT_TRUE(strcmp("slow", timings[2].pretty_name) == 0);
+  EXPECT_TRUE(timings[2].duration_ns >= 20 * 1000 * 1000);
+  EXPECT_TRUE(base::AtExitManager::GetLastTeardownDurationNs() >=
+              timings[2].duration_ns);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(FastShutdownFlushesWithManager);
+  RUN_TEST(FastShutdownFlushesWithoutManager);
+  RUN_TEST(ParallelTeardownKeepsDependencies);
+  RUN_TEST(IndependentCallbacksRunInParallel);
+  RUN_TEST(TeardownIsTimed);
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <unistd.h>
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "atomicops.h"
+#include "call_once.h"
+#include "tests/test_util.h"
+
+namespace {
+
+base::subtle::AtomicWord g_calls = 0;
+
+void Increment() {
+  base::subtle::NoBarrier_AtomicIncrement(&g_calls, 1);
+}
+
+void RunsOnce() {
+  static base::OnceFlag flag;
+  EXPECT_TRUE(!flag.is_done());
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i)
+    threads.emplace_back([] { base::CallOnce(flag, &Increment); });
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  EXPECT_EQ(1, g_calls);
+  EXPECT_TRUE(flag.is_done());
+}
+
+// Fails a few times before succeeding, and counts how many callers are in it
+// at once.
+struct Flaky {
+  base::subtle::AtomicWord running;
+  base::subtle::AtomicWord max_running;
+  base::subtle::AtomicWord attempts;
+  base::subtle::AtomicWord completions;
+  int failures;
+
+  void Run() {
+    base::subtle::AtomicWord now =
+        base::subtle::NoBarrier_AtomicIncrement(&running, 1);
+    base::subtle::AtomicWord max = base::subtle::NoBarrier_Load(&max_running);
+    while (now > max &&
+           base::subtle::NoBarrier_CompareAndSwap(&max_running, max, now) !=
+               max) {
+      max = base::subtle::NoBarrier_Load(&max_running);
+    }
+    usleep(200);
+    base::subtle::AtomicWord attempt =
+        base::subtle::NoBarrier_AtomicIncrement(&attempts, 1);
+    base::subtle::NoBarrier_AtomicIncrement(&running, -1);
+    if (attempt <= failures)
+      throw std::runtime_error("flaky");
+    base::subtle::NoBarrier_AtomicIncrement(&completions, 1);
+  }
+};
+
+void RetriesAfterExceptionOneCallerAtATime() {
+  const int kRounds = 50;
+  const int kThreads = 8;
+  for (int round = 0; round < kRounds; ++round) {
+    base::OnceFlag flag;
+    Flaky flaky = {0, 0, 0, 0, 3};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+      threads.emplace_back([&flag, &flaky] {
+        while (!flag.is_done()) {
+          try {
+            base::CallOnce(flag, [&flaky] { flaky.Run(); });
+          } catch (const std::runtime_error&) {
+          }
+        }
+      });
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+
+    EXPECT_EQ(1, flaky.max_running);
+    EXPECT_EQ(1, flaky.completions);
+    EXPECT_EQ(flaky.failures + 1, flaky.attempts);
+  }
+}
+
+// Same as above without the cost of exceptions, which makes the window
+// between a waiter's compare-and-swaps and a failed run much easier to hit.
+void FailedRunsNeverOverlap() {
+  const int kThreads = 4;
+  const int kIterations = 200000;
+  base::OnceFlag flag;
+  volatile base::subtle::Atomic32* state =
+      reinterpret_cast<volatile base::subtle::Atomic32*>(&flag);
+  base::subtle::AtomicWord owners = 0;
+  base::subtle::AtomicWord overlaps = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([state, &owners, &overlaps] {
+      for (int j = 0; j < kIterations; ++j) {
+        if (!base::internal::BeginCallOnce(state))
+          continue;
+        if (base::subtle::NoBarrier_AtomicIncrement(&owners, 1) != 1)
+          base::subtle::NoBarrier_AtomicIncrement(&overlaps, 1);
+        base::subtle::NoBarrier_AtomicIncrement(&owners, -1);
+        base::internal::EndCallOnce(state, false);
+      }
+    });
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  EXPECT_EQ(0, overlaps);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(RunsOnce);
+  RUN_TEST(RetriesAfterExceptionOneCallerAtATime);
+  RUN_TEST(FailedRunsNeverOverlap);
+  return 0;
+}
@@ -0,0 +1,15 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tests/dlopen_plugin.h"
+
+extern "C" __attribute__((visibility("default"))) void*
+PluginGetCreatedByTest() {
+  return CreatedByTest::GetInstance();
+}
+
+extern "C" __attribute__((visibility("default"))) void*
+PluginGetCreatedByPlugin() {
+  return CreatedByPlugin::GetInstance();
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Singletons that both dlopen_unittest and the plugin it loads instantiate.
+// The plugin is built with -fvisibility=hidden, like libsingleton.so, and
+// loaded with RTLD_LOCAL.
+
+#ifndef BASE_TESTS_DLOPEN_PLUGIN_H_
+#define BASE_TESTS_DLOPEN_PLUGIN_H_
+
+#include "singleton.h"
+
+// Created by the test before the plugin asks for it.
+struct SINGLETON_EXPORT CreatedByTest {
+  static CreatedByTest* GetInstance() {
+    return base::Singleton<CreatedByTest>::get();
+  }
+};
+
+// Created by the plugin before the test asks for it.
+struct SINGLETON_EXPORT CreatedByPlugin {
+  static CreatedByPlugin* GetInstance() {
+    return base::Singleton<CreatedByPlugin>::get();
+  }
+};
+
+// Functions exported by the plugin, returning its view of the instances.
+typedef void* (*PluginGetInstanceFunction)();
+#define kPluginGetCreatedByTest "PluginGetCreatedByTest"
+#define kPluginGetCreatedByPlugin "PluginGetCreatedByPlugin"
+
+#endif  // BASE_TESTS_DLOPEN_PLUGIN_H_
@@ -0,0 +1,69 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "tests/dlopen_plugin.h"
+#include "tests/test_util.h"
+
+namespace {
+
+void* g_plugin = NULL;
+
+// The plugin is built next to this test.
+std::string PluginPath() {
+  char path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  EXPECT_TRUE(length > 0);
+  path[length] = '\0';
+  std::string directory(path);
+  return directory.substr(0, directory.rfind('/')) + "/libdlopen_plugin.so";
+}
+
+PluginGetInstanceFunction PluginFunction(const char* name) {
+  PluginGetInstanceFunction function =
+      reinterpret_cast<PluginGetInstanceFunction>(dlsym(g_plugin, name));
+  EXPECT_TRUE(function != NULL);
+  return function;
+}
+
+void LoadPlugin() {
+  g_plugin = dlopen(PluginPath().c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!g_plugin)
+    fprintf(stderr, "%s\n", dlerror());
+  EXPECT_TRUE(g_plugin != NULL);
+}
+
+void PluginSeesInstanceCreatedByTest() {
+  CreatedByTest* instance = CreatedByTest::GetInstance();
+  EXPECT_TRUE(instance != NULL);
+  PluginGetInstanceFunction get = PluginFunction(kPluginGetCreatedByTest);
+  EXPECT_TRUE(get() == instance);
+  // Again, once both modules took their fast paths.
+  EXPECT_TRUE(get() == instance);
+  EXPECT_TRUE(CreatedByTest::GetInstance() == instance);
+}
+
+void TestSeesInstanceCreatedByPlugin() {
+  PluginGetInstanceFunction get = PluginFunction(kPluginGetCreatedByPlugin);
+  void* instance = get();
+  EXPECT_TRUE(instance != NULL);
+  EXPECT_TRUE(CreatedByPlugin::GetInstance() == instance);
+  EXPECT_TRUE(CreatedByPlugin::GetInstance() == instance);
+  EXPECT_TRUE(get() == instance);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(LoadPlugin);
+  RUN_TEST(PluginSeesInstanceCreatedByTest);
+  RUN_TEST(TestSeesInstanceCreatedByPlugin);
+  return 0;
+}
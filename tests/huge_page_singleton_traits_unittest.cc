@@ -0,0 +1,123 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "huge_page_singleton_traits.h"
+#include "tests/test_util.h"
+
+namespace {
+
+struct Table {
+  char bytes[8 * 1024 * 1024];
+};
+
+struct CountedTable {
+  CountedTable() : entries(0) {}
+  int entries;
+  char bytes[8 * 1024 * 1024];
+};
+
+size_t ResidentPages(void* address, size_t size) {
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> pages((size + page_size - 1) / page_size);
+  EXPECT_EQ(0, mincore(address, size, &pages[0]));
+  size_t resident = 0;
+  for (size_t i = 0; i < pages.size(); ++i)
+    resident += pages[i] & 1;
+  return resident;
+}
+
+bool IsPowerOfTwo(size_t size) {
+  return size != 0 && (size & (size - 1)) == 0;
+}
+
+void HugePageSizeMatchesTheKernel() {
+  size_t size = base::GetHugePageSize();
+  EXPECT_TRUE(IsPowerOfTwo(size));
+  FILE* meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo) {
+    char line[128];
+    unsigned long kilobytes = 0;
+    while (fgets(line, sizeof(line), meminfo)) {
+      if (sscanf(line, "Hugepagesize: %lu kB", &kilobytes) == 1)
+        break;
+    }
+    fclose(meminfo);
+    if (kilobytes)
+      EXPECT_EQ(kilobytes * 1024, size);
+  }
+
+  size_t transparent = base::GetTransparentHugePageSize();
+  EXPECT_TRUE(IsPowerOfTwo(transparent));
+  FILE* file =
+      fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+  unsigned long bytes = static_cast<unsigned long>(sysconf(_SC_PAGESIZE));
+  if (file) {
+    EXPECT_EQ(1, fscanf(file, "%lu", &bytes));
+    fclose(file);
+  }
+  EXPECT_EQ(bytes, transparent);
+}
+
+size_t AlignmentOf(base::HugePageBacking backing) {
+  return backing == base::kHugeTlbPages ? base::GetHugePageSize()
+                                        : base::GetTransparentHugePageSize();
+}
+
+void AllocationIsAligned() {
+  base::HugePageBacking backing;
+  void* memory =
+      base::AllocateHugePageMemory(4096, base::kLazyHugePages, &backing);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(memory) &
+                   (AlignmentOf(backing) - 1));
+  base::FreeHugePageMemory(memory, 4096);
+}
+
+// The fallback maps whole transparent huge pages, but only the bytes asked for
+// are faulted in. Turns transparent huge pages off for the rest of the
+// process, so that the first fault doesn't bring in a whole huge page.
+void PrefaultsRequestedBytes() {
+  EXPECT_EQ(0, prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0));
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  base::HugePageBacking backing;
+  void* memory = base::AllocateHugePageMemory(
+      3 * page_size - 1, base::kPrefaultHugePages, &backing);
+  if (backing != base::kHugeTlbPages) {
+    EXPECT_EQ(3, ResidentPages(memory, base::GetTransparentHugePageSize()));
+  }
+  base::FreeHugePageMemory(memory, 3 * page_size - 1);
+}
+
+// A trivial type is default-initialized: the memory is zero already, and
+// writing the zeroes again would fault the whole table in.
+void LazyTrivialTypeIsNotFaultedIn() {
+  Table* table = base::HugePageSingletonTraits<Table>::New();
+  EXPECT_EQ(0, ResidentPages(table, sizeof(Table)));
+  EXPECT_EQ(0, table->bytes[sizeof(table->bytes) - 1]);
+  base::HugePageSingletonTraits<Table>::Delete(table);
+}
+
+void NonTrivialTypeIsConstructed() {
+  CountedTable* table = base::HugePageSingletonTraits<CountedTable>::New();
+  EXPECT_EQ(0, table->entries);
+  base::HugePageSingletonTraits<CountedTable>::Delete(table);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(HugePageSizeMatchesTheKernel);
+  RUN_TEST(AllocationIsAligned);
+  RUN_TEST(LazyTrivialTypeIsNotFaultedIn);
+  RUN_TEST(NonTrivialTypeIsConstructed);
+  RUN_TEST(PrefaultsRequestedBytes);
+  return 0;
+}
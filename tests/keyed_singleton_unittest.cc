@@ -0,0 +1,106 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+
+#include <thread>
+#include <vector>
+
+#include "atomicops.h"
+#include "keyed_singleton.h"
+#include "tests/test_util.h"
+
+namespace {
+
+// Counts constructions and destructions; slow enough to construct that
+// concurrent getters overlap.
+struct Tenant {
+  explicit Tenant(int id) : id(id) {
+    base::subtle::NoBarrier_AtomicIncrement(&constructed, 1);
+    for (int i = 0; i < 100; ++i)
+      sched_yield();
+  }
+  ~Tenant() { base::subtle::NoBarrier_AtomicIncrement(&destroyed, 1); }
+
+  const int id;
+  static base::subtle::Atomic32 constructed;
+  static base::subtle::Atomic32 destroyed;
+};
+
+base::subtle::Atomic32 Tenant::constructed = 0;
+base::subtle::Atomic32 Tenant::destroyed = 0;
+
+// Every key hashes to the same slot, so each table only holds a few keys
+// before probing moves on to the next one.
+struct CollidingTraits : base::DefaultKeyedSingletonTraits<Tenant, int> {
+  static size_t Hash(const int&) { return 0; }
+  static const size_t kInitialCapacity = 4;
+};
+
+struct EvictableTraits : base::DefaultKeyedSingletonTraits<Tenant, int> {
+  static const bool kAllowEviction = true;
+};
+
+struct Concurrent {};
+struct Colliding {};
+struct Evictable {};
+
+void ConcurrentGetConstructsOnce() {
+  typedef base::KeyedSingleton<Tenant, int,
+                               base::DefaultKeyedSingletonTraits<Tenant, int>,
+                               Concurrent> Tenants;
+  base::subtle::NoBarrier_Store(&Tenant::constructed, 0);
+  std::vector<Tenant*> instances(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < instances.size(); ++i)
+    threads.emplace_back([&instances, i] { instances[i] = Tenants::get(7); });
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  EXPECT_EQ(1, base::subtle::NoBarrier_Load(&Tenant::constructed));
+  for (size_t i = 0; i < instances.size(); ++i)
+    EXPECT_TRUE(instances[i] == instances[0]);
+  EXPECT_EQ(7, instances[0]->id);
+}
+
+// At most 8 slots are probed per table, and only 4 in the first one, so 40
+// colliding keys need six tables.
+void CollisionsOverflowIntoChainedTables() {
+  typedef base::KeyedSingleton<Tenant, int, CollidingTraits, Colliding>
+      Tenants;
+  const int kKeys = 40;
+  std::vector<Tenant*> instances;
+  for (int key = 0; key < kKeys; ++key)
+    instances.push_back(Tenants::get(key));
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_TRUE(Tenants::get(key) == instances[key]);
+    EXPECT_EQ(key, instances[key]->id);
+  }
+}
+
+void EvictThenRecreate() {
+  typedef base::KeyedSingleton<Tenant, int, EvictableTraits, Evictable>
+      Tenants;
+  base::subtle::NoBarrier_Store(&Tenant::constructed, 0);
+  base::subtle::NoBarrier_Store(&Tenant::destroyed, 0);
+  EXPECT_TRUE(!Tenants::Evict(1));
+
+  EXPECT_EQ(1, Tenants::get(1)->id);
+  EXPECT_TRUE(Tenants::Evict(1));
+  EXPECT_EQ(1, base::subtle::NoBarrier_Load(&Tenant::destroyed));
+  EXPECT_TRUE(!Tenants::Evict(1));
+
+  EXPECT_EQ(1, Tenants::get(1)->id);
+  EXPECT_EQ(2, base::subtle::NoBarrier_Load(&Tenant::constructed));
+  EXPECT_TRUE(Tenants::get(1) == Tenants::get(1));
+  EXPECT_EQ(2, base::subtle::NoBarrier_Load(&Tenant::constructed));
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(ConcurrentGetConstructsOnce);
+  RUN_TEST(CollisionsOverflowIntoChainedTables);
+  RUN_TEST(EvictThenRecreate);
+  return 0;
+}
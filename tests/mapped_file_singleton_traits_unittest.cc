@@ -0,0 +1,148 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "mapped_file_singleton_traits.h"
+#include "tests/test_util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x57524453;
+const uint32_t kWords = 3;
+
+struct Word {
+  char text[8];
+};
+
+struct WordList {
+  static WordList* GetInstance();
+
+  uint32_t magic;
+  uint32_t count;
+  base::OffsetPtr<Word> words;
+};
+
+char g_path[64];
+
+struct WordListTraits
+    : base::MappedFileSingletonTraits<WordList, WordListTraits> {
+  static const char* Path() { return g_path; }
+  static bool Validate(const WordList* list, size_t size) {
+    return size >= sizeof(WordList) && list->magic == kMagic &&
+           list->words.IsWithin(list, size, list->count);
+  }
+};
+
+WordList* WordList::GetInstance() {
+  return base::Singleton<WordList, WordListTraits>::get();
+}
+
+// Builds the image of a WordList followed by its words, the way a tool would,
+// and writes it to |path|.
+void WriteWordList(const char* path, uint32_t magic) {
+  std::vector<char> image(sizeof(WordList) + kWords * sizeof(Word));
+  WordList* list = reinterpret_cast<WordList*>(&image[0]);
+  Word* words = reinterpret_cast<Word*>(&image[sizeof(WordList)]);
+  list->magic = magic;
+  list->count = kWords;
+  list->words.set(words);
+  const char* texts[kWords] = {"alpha", "beta", "gamma"};
+  for (uint32_t i = 0; i < kWords; ++i)
+    strcpy(words[i].text, texts[i]);
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  EXPECT_TRUE(fd >= 0);
+  EXPECT_EQ(static_cast<long long>(image.size()),
+            write(fd, &image[0], image.size()));
+  close(fd);
+}
+
+void OffsetPtrRoundTrips() {
+  struct Pair {
+    base::OffsetPtr<Word> first;
+    Word word;
+  } pair;
+  EXPECT_TRUE(pair.first.get() == NULL);
+  EXPECT_TRUE(!pair.first.IsWithin(&pair, sizeof(pair), 1));
+
+  pair.first.set(&pair.word);
+  EXPECT_TRUE(pair.first.get() == &pair.word);
+  EXPECT_TRUE(pair.first.IsWithin(&pair, sizeof(pair), 1));
+  EXPECT_TRUE(!pair.first.IsWithin(&pair, sizeof(pair), 2));
+
+  // The offset is relative, so a copy points into the copy.
+  Pair copy;
+  memcpy(&copy, &pair, sizeof(pair));
+  EXPECT_TRUE(copy.first.get() == &copy.word);
+
+  pair.first.set(NULL);
+  EXPECT_TRUE(pair.first.get() == NULL);
+}
+
+// A file that fails Validate() gives NULL, and the next get() tries again.
+void InvalidFileIsRejected() {
+  WriteWordList(g_path, kMagic + 1);
+  EXPECT_TRUE(WordList::GetInstance() == NULL);
+
+  WriteWordList(g_path, kMagic);
+  WordList* list = WordList::GetInstance();
+  EXPECT_TRUE(list != NULL);
+  EXPECT_TRUE(WordList::GetInstance() == list);
+}
+
+// The words are reached through the OffsetPtr stored in the file, wherever
+// it is mapped.
+void MapsTheFile() {
+  const WordList* list = WordList::GetInstance();
+  EXPECT_TRUE(list != NULL);
+  EXPECT_EQ(kMagic, list->magic);
+  EXPECT_EQ(kWords, list->count);
+  EXPECT_TRUE(strcmp("alpha", list->words[0].text) == 0);
+  EXPECT_TRUE(strcmp("gamma", list->words[2].text) == 0);
+}
+
+// Failures are reported with their own reason, not a stale errno.
+void EmptyFileIsReported() {
+  std::string empty = std::string(g_path) + ".empty";
+  close(open(empty.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  std::string log = std::string(g_path) + ".log";
+
+  fflush(stderr);
+  int saved_stderr = dup(STDERR_FILENO);
+  int log_fd = open(log.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  dup2(log_fd, STDERR_FILENO);
+  size_t size = 1;
+  const void* data = base::internal::MapReadOnlyFile(
+      empty.c_str(), &size, base::kMappedFileLazy);
+  fflush(stderr);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+
+  char output[256] = {0};
+  EXPECT_TRUE(pread(log_fd, output, sizeof(output) - 1, 0) > 0);
+  close(log_fd);
+  EXPECT_TRUE(data == NULL);
+  EXPECT_TRUE(strstr(output, "fstat(): empty file") != NULL);
+  unlink(empty.c_str());
+  unlink(log.c_str());
+}
+
+}  // namespace
+
+int main() {
+  snprintf(g_path, sizeof(g_path), "/tmp/mapped_file_unittest.%d", getpid());
+  RUN_TEST(OffsetPtrRoundTrips);
+  RUN_TEST(InvalidFileIsRejected);
+  RUN_TEST(MapsTheFile);
+  RUN_TEST(EmptyFileIsReported);
+  unlink(g_path);
+  return 0;
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <string>
+
+#include "numa_singleton_traits.h"
+#include "tests/test_util.h"
+
+namespace {
+
+const size_t kSize = 64 * 4096;
+
+// Returns the first line of |path| without its newline.
+std::string ReadLine(const char* path) {
+  std::string line;
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return line;
+  char buffer[256];
+  if (fgets(buffer, sizeof(buffer), file))
+    line = buffer;
+  fclose(file);
+  if (!line.empty() && line[line.size() - 1] == '\n')
+    line.erase(line.size() - 1);
+  return line;
+}
+
+// Returns the policy /proc/self/numa_maps reports for the mapping at
+// |address|, such as "interleave:0-1" or "default".
+std::string PolicyOf(void* address) {
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "%lx ",
+           reinterpret_cast<unsigned long>(address));
+  std::string policy;
+  FILE* maps = fopen("/proc/self/numa_maps", "r");
+  if (!maps)
+    return policy;
+  char line[1024];
+  while (fgets(line, sizeof(line), maps)) {
+    if (strncmp(line, prefix, strlen(prefix)) == 0) {
+      const char* begin = line + strlen(prefix);
+      policy.assign(begin, strcspn(begin, " \n"));
+      break;
+    }
+  }
+  fclose(maps);
+  return policy;
+}
+
+// MAP_NORESERVE keeps the kernel from merging the mapping with neighbouring
+// ones, whose policy numa_maps would then report.
+void* Map() {
+  void* memory = mmap(NULL, kSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  EXPECT_TRUE(memory != MAP_FAILED);
+  return memory;
+}
+
+// The mask has to name exactly the nodes with memory; any other bit makes
+// the kernel reject the whole call.
+void InterleavesOverNodesWithMemory() {
+  std::string nodes = ReadLine("/sys/devices/system/node/has_memory");
+  if (nodes.empty())
+    return;
+  void* memory = Map();
+  EXPECT_TRUE(base::internal::ApplyNumaPolicy(memory, kSize,
+                                              base::kNumaInterleave, 0));
+  memset(memory, 1, kSize);
+  EXPECT_TRUE(PolicyOf(memory) == "interleave:" + nodes);
+  munmap(memory, kSize);
+}
+
+void BindsToNode() {
+  std::string nodes = ReadLine("/sys/devices/system/node/has_memory");
+  if (nodes.empty() || nodes[0] != '0')
+    return;
+  void* memory = Map();
+  EXPECT_TRUE(
+      base::internal::ApplyNumaPolicy(memory, kSize, base::kNumaBind, 0));
+  EXPECT_TRUE(PolicyOf(memory) == "bind:0");
+  munmap(memory, kSize);
+}
+
+// Preferred, not bound, so that a full node doesn't fail the allocation.
+void PrefersFirstAccessorNode() {
+  void* memory = Map();
+  EXPECT_TRUE(base::internal::ApplyNumaPolicy(memory, kSize,
+                                              base::kNumaFirstAccessor, 0));
+  EXPECT_EQ(0, PolicyOf(memory).compare(0, 7, "prefer:"));
+  munmap(memory, kSize);
+}
+
+void RejectsNodeOutOfRange() {
+  void* memory = Map();
+  EXPECT_TRUE(!base::internal::ApplyNumaPolicy(memory, kSize,
+                                               base::kNumaBind, 4096));
+  EXPECT_TRUE(PolicyOf(memory) == "default");
+  munmap(memory, kSize);
+}
+
+// A single node host gets no policy at all.
+void AllocationReportsPolicy() {
+  bool applied = true;
+  void* memory =
+      base::AllocateNumaMemory(kSize, base::kNumaInterleave, 0, &applied);
+  memset(memory, 1, kSize);
+  if (base::GetNumaNodeCount() > 1) {
+    EXPECT_TRUE(applied);
+    EXPECT_EQ(0, PolicyOf(memory).compare(0, 11, "interleave:"));
+  } else {
+    EXPECT_TRUE(!applied);
+    EXPECT_TRUE(PolicyOf(memory) == "default");
+  }
+  base::FreeNumaMemory(memory, kSize);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(InterleavesOverNodesWithMemory);
+  RUN_TEST(BindsToNode);
+  RUN_TEST(PrefersFirstAccessorNode);
+  RUN_TEST(RejectsNodeOutOfRange);
+  RUN_TEST(AllocationReportsPolicy);
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "sharded_singleton.h"
+#include "singleton_registry.h"
+#include "tests/test_util.h"
+
+namespace {
+
+// constexpr default constructible and trivially destructible: it must still
+// get an instance_ word unless it asks for ConstantSingletonTraits.
+struct Counter {
+  static Counter* GetInstance();
+  std::atomic<long> hits;
+};
+
+Counter* Counter::GetInstance() {
+  return base::ShardedSingleton<Counter, 4>::get();
+}
+
+// Incremented through the calling thread's shard.
+struct Tally {
+  static Tally* GetInstance();
+  std::atomic<long> hits;
+};
+
+Tally* Tally::GetInstance() {
+  return base::ShardedSingleton<Tally, 4>::get();
+}
+
+struct Plain {
+  static Plain* GetInstance();
+  int value;
+};
+
+Plain* Plain::GetInstance() {
+  return base::Singleton<Plain>::get();
+}
+
+bool IsRegistered(const void* instance) {
+  for (base::internal::SingletonRecord* record =
+           base::internal::GetSingletonRecords();
+       record; record = record->next) {
+    if (reinterpret_cast<const void*>(
+            base::subtle::Acquire_Load(record->instance)) == instance)
+      return true;
+  }
+  return false;
+}
+
+void ConstexprTypesUseInstanceWords() {
+  Counter::GetInstance()->hits += 3;
+  long total = 0;
+  size_t shards = 0;
+  base::ShardedSingleton<Counter, 4>::ForEachShard([&](Counter* shard) {
+    total += shard->hits;
+    ++shards;
+  });
+  EXPECT_EQ(1, shards);
+  EXPECT_EQ(3, total);
+  EXPECT_TRUE(IsRegistered(Counter::GetInstance()));
+  EXPECT_TRUE(IsRegistered(Plain::GetInstance()));
+}
+
+// Consecutive threads are routed to consecutive shards, so eight of them use
+// all four, and no increment is lost in the sum.
+void ForEachShardSumsAllThreads() {
+  const int kThreads = 8;
+  const long kIncrements = 10000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([] {
+      for (long j = 0; j < kIncrements; ++j)
+        Tally::GetInstance()->hits.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+
+  long total = 0;
+  size_t shards = 0;
+  base::ShardedSingleton<Tally, 4>::ForEachShard([&](Tally* shard) {
+    total += shard->hits;
+    ++shards;
+  });
+  EXPECT_EQ(4, shards);
+  EXPECT_EQ(kThreads * kIncrements, total);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(ConstexprTypesUseInstanceWords);
+  RUN_TEST(ForEachShardSumsAllThreads);
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "shared_memory_singleton.h"
+#include "tests/test_util.h"
+
+namespace {
+
+struct Index {
+  int entries[1024];
+};
+
+// Names are per test process so that runs don't see each other's segments.
+std::string SegmentName(const char* test) {
+  char name[64];
+  snprintf(name, sizeof(name), "/singleton_unittest.%s.%d", test, getpid());
+  return name;
+}
+
+// Fills the object the way a constructor would, then publishes it.
+void Construct(void* memory) {
+  Index* index = static_cast<Index*>(memory);
+  for (int i = 0; i < 1024; ++i)
+    index->entries[i] = i;
+  base::internal::PublishSharedSegment(memory, sizeof(Index), false);
+}
+
+int WaitForChild(pid_t child) {
+  int status = 0;
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A creator that dies before publishing hands the construction over to the
+// next process, through the robust mutex rather than its PID.
+void TakesOverFromDeadCreator() {
+  std::string name = SegmentName("dead_creator");
+  pid_t child = fork();
+  if (child == 0) {
+    bool creator = false;
+    base::internal::AttachSharedSegment(name.c_str(), sizeof(Index),
+                                        &creator);
+    _exit(creator ? 0 : 1);
+  }
+  EXPECT_EQ(0, WaitForChild(child));
+
+  // Fails instead of hanging if the lock is never handed over.
+  alarm(30);
+  bool creator = false;
+  void* memory = base::internal::AttachSharedSegment(
+      name.c_str(), sizeof(Index), &creator);
+  EXPECT_TRUE(creator);
+  Construct(memory);
+  alarm(0);
+
+  child = fork();
+  if (child == 0) {
+    bool creator = true;
+    Index* index = static_cast<Index*>(base::internal::AttachSharedSegment(
+        name.c_str(), sizeof(Index), &creator));
+    _exit(!creator && index->entries[1023] == 1023 ? 0 : 1);
+  }
+  EXPECT_EQ(0, WaitForChild(child));
+  base::internal::UnlinkSharedSegment(name.c_str());
+}
+
+// Waiters block until the creator publishes, and then see the object.
+void WaitsForLiveCreator() {
+  std::string name = SegmentName("live_creator");
+  int pipe_fds[2];
+  EXPECT_EQ(0, pipe(pipe_fds));
+  pid_t child = fork();
+  if (child == 0) {
+    bool creator = false;
+    void* memory = base::internal::AttachSharedSegment(
+        name.c_str(), sizeof(Index), &creator);
+    char attached = 1;
+    if (write(pipe_fds[1], &attached, 1) != 1)
+      _exit(2);
+    usleep(200 * 1000);
+    Construct(memory);
+    _exit(creator ? 0 : 1);
+  }
+  char attached = 0;
+  EXPECT_EQ(1, read(pipe_fds[0], &attached, 1));
+
+  alarm(30);
+  bool creator = true;
+  Index* index = static_cast<Index*>(base::internal::AttachSharedSegment(
+      name.c_str(), sizeof(Index), &creator));
+  alarm(0);
+  EXPECT_TRUE(!creator);
+  EXPECT_EQ(1023, index->entries[1023]);
+  EXPECT_EQ(0, WaitForChild(child));
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  base::internal::UnlinkSharedSegment(name.c_str());
+}
+
+// A process that died between claiming the segment's lock setup and finishing
+// it leaves its PID in the first word of the segment, lock_state.
+void TakesOverFromDeadLockInitializer() {
+  std::string name = SegmentName("dead_initializer");
+  pid_t child = fork();
+  if (child == 0)
+    _exit(0);
+  EXPECT_EQ(0, WaitForChild(child));
+
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t mapping_size =
+      page_size + (sizeof(Index) + page_size - 1) / page_size * page_size;
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  EXPECT_TRUE(fd >= 0);
+  EXPECT_EQ(0, ftruncate(fd, mapping_size));
+  void* mapping =
+      mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  EXPECT_TRUE(mapping != MAP_FAILED);
+  *static_cast<int32_t*>(mapping) = static_cast<int32_t>(child);
+  munmap(mapping, page_size);
+
+  // Fails instead of hanging if the dead initializer isn't noticed.
+  alarm(30);
+  bool creator = false;
+  void* memory = base::internal::AttachSharedSegment(
+      name.c_str(), sizeof(Index), &creator);
+  EXPECT_TRUE(creator);
+  Construct(memory);
+  alarm(0);
+  base::internal::UnlinkSharedSegment(name.c_str());
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(TakesOverFromDeadCreator);
+  RUN_TEST(WaitsForLiveCreator);
+  RUN_TEST(TakesOverFromDeadLockInitializer);
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "singleton_arena.h"
+#include "tests/test_util.h"
+
+namespace {
+
+using base::internal::AllocateFromSingletonArena;
+
+bool InsideChunks(void* memory, size_t size) {
+  // Touching every byte faults if the range runs past the mapping.
+  memset(memory, 0xa5, size);
+  return base::IsInSingletonArena(memory, size);
+}
+
+// Alignments above the page size can't be met by the mmap() alignment of a
+// new chunk, so the chunk has to be sized for the padding.
+void AlignsAbovePageSize() {
+  const size_t kAlignments[] = {64, 4096, 64 * 1024, 1024 * 1024};
+  for (size_t i = 0; i < sizeof(kAlignments) / sizeof(kAlignments[0]); ++i) {
+    size_t alignment = kAlignments[i];
+    // A size that fills a whole chunk leaves no slack for padding.
+    size_t size = 64 * 1024 - 64;
+    void* memory =
+        AllocateFromSingletonArena(size, alignment, base::kSingletonArenaCold);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(memory) & (alignment - 1));
+    EXPECT_TRUE(InsideChunks(memory, size));
+  }
+}
+
+void SmallAllocationsShareAChunk() {
+  base::SingletonArenaStats before;
+  base::GetSingletonArenaStats(&before);
+  char* first = static_cast<char*>(
+      AllocateFromSingletonArena(8, 8, base::kSingletonArenaWarm));
+  char* second = static_cast<char*>(
+      AllocateFromSingletonArena(8, 8, base::kSingletonArenaWarm));
+  base::SingletonArenaStats after;
+  base::GetSingletonArenaStats(&after);
+  EXPECT_EQ(base::internal::kCacheLineSize, second - first);
+  EXPECT_TRUE(after.chunk_count - before.chunk_count <= 1);
+  EXPECT_EQ(2, after.allocation_count - before.allocation_count);
+}
+
+void ChunkBoundsAreChecked() {
+  char* memory = static_cast<char*>(
+      AllocateFromSingletonArena(100, 8, base::kSingletonArenaWarm));
+  EXPECT_TRUE(base::IsInSingletonArena(memory, 100));
+  EXPECT_TRUE(!base::IsInSingletonArena(memory, 1024 * 1024));
+  int on_stack = 0;
+  EXPECT_TRUE(!base::IsInSingletonArena(&on_stack, sizeof(on_stack)));
+}
+
+struct Counters {
+  static Counters* GetInstance();
+  long hits[4];
+};
+
+typedef base::ArenaSingletonTraits<Counters, base::kSingletonArenaHot>
+    CountersTraits;
+
+Counters* Counters::GetInstance() {
+  return base::Singleton<Counters, CountersTraits>::get();
+}
+
+// Singleton<> places an instance with ArenaSingletonTraits in its hint's
+// region, zero initialized and on its own cache line.
+void SingletonGetUsesTheArena() {
+  base::SingletonArenaStats before;
+  base::GetSingletonArenaStats(&before);
+  Counters* counters = Counters::GetInstance();
+  base::SingletonArenaStats after;
+  base::GetSingletonArenaStats(&after);
+
+  EXPECT_TRUE(Counters::GetInstance() == counters);
+  EXPECT_TRUE(base::IsInSingletonArena(counters, sizeof(Counters)));
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(counters) &
+                   (base::internal::kCacheLineSize - 1));
+  EXPECT_EQ(0, counters->hits[3]);
+  EXPECT_EQ(1, after.allocation_count - before.allocation_count);
+  EXPECT_TRUE(after.used_bytes_per_hint[base::kSingletonArenaHot] >
+              before.used_bytes_per_hint[base::kSingletonArenaHot]);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(AlignsAbovePageSize);
+  RUN_TEST(SmallAllocationsShareAChunk);
+  RUN_TEST(ChunkBoundsAreChecked);
+  RUN_TEST(SingletonGetUsesTheArena);
+  return 0;
+}
@@ -0,0 +1,222 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "atomicops.h"
+#include "keyed_singleton.h"
+#include "singleton.h"
+#include "tests/test_util.h"
+#include "weak_singleton.h"
+
+namespace {
+
+const size_t kTablePages = 256;
+
+// Read-mostly table in a mapping of its own, so that smaps can tell its pages
+// apart. MAP_NORESERVE keeps the kernel from merging it with neighbouring
+// anonymous mappings.
+struct Table {
+  Table() {
+    for (size_t i = 0; i < sizeof(bytes); ++i)
+      bytes[i] = static_cast<char>(i);
+  }
+
+  static Table* GetInstance();
+
+  char bytes[kTablePages * 4096];
+};
+
+struct TableTraits : base::DefaultSingletonTraits<Table> {
+  static Table* New() {
+    void* memory = mmap(NULL, sizeof(Table), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    EXPECT_TRUE(memory != MAP_FAILED);
+    return new (memory) Table();
+  }
+};
+
+Table* Table::GetInstance() {
+  return base::Singleton<Table, TableTraits>::get();
+}
+
+struct PageCounts {
+  size_t shared_kb;
+  size_t private_kb;
+};
+
+// Sums the Shared_* and Private_* lines of the smaps entry for the mapping
+// that starts at |address|.
+PageCounts CountPages(const void* address) {
+  PageCounts counts = {0, 0};
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "%lx-",
+           reinterpret_cast<unsigned long>(address));
+  FILE* smaps = fopen("/proc/self/smaps", "r");
+  EXPECT_TRUE(smaps != NULL);
+  char line[512];
+  bool in_mapping = false;
+  while (fgets(line, sizeof(line), smaps)) {
+    unsigned long kb = 0;
+    if (strchr(line, '-') && strchr(line, ' ') &&
+        strchr(line, '-') < strchr(line, ' ')) {
+      if (in_mapping)
+        break;
+      in_mapping = strncmp(line, prefix, strlen(prefix)) == 0;
+    } else if (!in_mapping) {
+      continue;
+    } else if (sscanf(line, "Shared_Clean: %lu kB", &kb) == 1 ||
+               sscanf(line, "Shared_Dirty: %lu kB", &kb) == 1) {
+      counts.shared_kb += kb;
+    } else if (sscanf(line, "Private_Clean: %lu kB", &kb) == 1 ||
+               sscanf(line, "Private_Dirty: %lu kB", &kb) == 1) {
+      counts.private_kb += kb;
+    }
+  }
+  fclose(smaps);
+  return counts;
+}
+
+int WaitForChild(pid_t child) {
+  int status = 0;
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A kForkShare instance built before fork() stays on pages shared with the
+// parent until the child writes to them.
+void SharedPagesAfterFork() {
+  Table* table = Table::GetInstance();
+  const size_t table_kb = sizeof(Table) / 1024;
+  pid_t child = fork();
+  if (child == 0) {
+    PageCounts before = CountPages(table);
+    // Copy-on-write gives the child its own copy of the pages it writes.
+    for (size_t i = 0; i < sizeof(table->bytes) / 2; i += 4096)
+      table->bytes[i] = 0;
+    PageCounts after = CountPages(table);
+    printf("    after fork: shared %zu kB, private %zu kB\n",
+           before.shared_kb, before.private_kb);
+    printf("    after writing half: shared %zu kB, private %zu kB\n",
+           after.shared_kb, after.private_kb);
+    bool ok = before.shared_kb == table_kb && before.private_kb == 0 &&
+              after.shared_kb == table_kb / 2 &&
+              after.private_kb == table_kb / 2;
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+  }
+  EXPECT_EQ(0, WaitForChild(child));
+}
+
+// Construction that blocks in the parent until released. The child inherits
+// |g_blocking| set and clears it before creating its own instance.
+base::subtle::Atomic32 g_blocking = 0;
+base::subtle::Atomic32 g_entered = 0;
+
+struct Blocking {
+  Blocking() {
+    if (!base::subtle::Acquire_Load(&g_blocking))
+      return;
+    base::subtle::Release_Store(&g_entered, 1);
+    while (base::subtle::Acquire_Load(&g_blocking))
+      sched_yield();
+  }
+  explicit Blocking(int) : Blocking() {}
+
+  static Blocking* GetInstance();
+};
+
+Blocking* Blocking::GetInstance() {
+  return base::Singleton<Blocking>::get();
+}
+
+// Forks while another thread is inside |create|, then checks that |create|
+// completes in the child instead of waiting on the parent's marker.
+template <typename Function>
+void ForkWhileCreating(Function create) {
+  base::subtle::Release_Store(&g_blocking, 1);
+  base::subtle::Release_Store(&g_entered, 0);
+  std::thread creator(create);
+  while (!base::subtle::Acquire_Load(&g_entered))
+    sched_yield();
+
+  pid_t child = fork();
+  if (child == 0) {
+    base::subtle::Release_Store(&g_blocking, 0);
+    alarm(10);
+    create();
+    _exit(0);
+  }
+  int status = WaitForChild(child);
+  base::subtle::Release_Store(&g_blocking, 0);
+  creator.join();
+  EXPECT_EQ(0, status);
+}
+
+void SingletonCreationInFlight() {
+  ForkWhileCreating([] { Blocking::GetInstance(); });
+}
+
+void KeyedCreationInFlight() {
+  ForkWhileCreating([] { base::KeyedSingleton<Blocking, int>::get(1); });
+}
+
+void WeakCreationInFlight() {
+  ForkWhileCreating([] { base::WeakSingleton<Blocking>::get(); });
+}
+
+// Destroyed shortly after its last Ref is dropped.
+struct Idle {
+  ~Idle() { base::subtle::NoBarrier_AtomicIncrement(&destroyed, 1); }
+  static base::subtle::Atomic32 destroyed;
+};
+
+base::subtle::Atomic32 Idle::destroyed = 0;
+
+struct IdleTraits : base::DefaultWeakSingletonTraits<Idle> {
+  static const int kIdleDelayMs = 50;
+};
+
+typedef base::WeakSingleton<Idle, IdleTraits> IdleSingleton;
+
+bool WaitForDestroyed(base::subtle::Atomic32 count) {
+  for (int i = 0; i < 1000; ++i) {
+    if (base::subtle::NoBarrier_Load(&Idle::destroyed) == count)
+      return true;
+    usleep(1000);
+  }
+  return false;
+}
+
+// The child reclaims the instance whose reap was pending in the parent, and
+// the ones it creates itself.
+void WeakReapsInChild() {
+  IdleSingleton::get();
+  pid_t child = fork();
+  if (child == 0) {
+    bool inherited = WaitForDestroyed(1);
+    IdleSingleton::get();
+    _exit(inherited && WaitForDestroyed(2) ? 0 : 1);
+  }
+  EXPECT_EQ(0, WaitForChild(child));
+  EXPECT_TRUE(WaitForDestroyed(1));
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(SharedPagesAfterFork);
+  RUN_TEST(SingletonCreationInFlight);
+  RUN_TEST(KeyedCreationInFlight);
+  RUN_TEST(WeakCreationInFlight);
+  RUN_TEST(WeakReapsInChild);
+  return 0;
+}
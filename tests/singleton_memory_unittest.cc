@@ -0,0 +1,102 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <vector>
+
+#include "huge_page_singleton_traits.h"
+#include "numa_singleton_traits.h"
+#include "singleton.h"
+#include "singleton_arena.h"
+#include "singleton_memory.h"
+#include "tests/test_util.h"
+
+namespace {
+
+// Returns the usage charged to Type, zeroes if nothing was.
+template <typename Type>
+base::SingletonMemoryUsage UsageOf() {
+  base::SingletonMemoryUsage result = {NULL, 0, 0, 0};
+  std::vector<base::SingletonMemoryUsage> usage =
+      base::GetSingletonMemoryUsage();
+  for (size_t i = 0; i < usage.size(); ++i) {
+    if (strstr(usage[i].pretty_name, "ScopedSingletonMemoryTag") &&
+        strstr(usage[i].pretty_name, Type::Name()))
+      result = usage[i];
+  }
+  return result;
+}
+
+struct AlignedOwner {
+  static const char* Name() { return "AlignedOwner"; }
+};
+struct HugePageOwner {
+  static const char* Name() { return "HugePageOwner"; }
+};
+struct NumaOwner {
+  static const char* Name() { return "NumaOwner"; }
+};
+struct ArenaOwner {
+  static const char* Name() { return "ArenaOwner"; }
+};
+
+void AlignedAllocIsCharged() {
+  void* memory;
+  {
+    base::ScopedSingletonMemoryTag<AlignedOwner> tag;
+    memory = base::internal::AlignedAlloc(1000, 128);
+  }
+  EXPECT_EQ(1000, UsageOf<AlignedOwner>().live_bytes);
+  base::internal::AlignedFree(memory);
+  EXPECT_EQ(0, UsageOf<AlignedOwner>().live_bytes);
+  EXPECT_EQ(1000, UsageOf<AlignedOwner>().allocated_bytes);
+}
+
+void MappedMemoryIsCharged() {
+  void* huge_page;
+  void* numa;
+  base::HugePageBacking backing;
+  {
+    base::ScopedSingletonMemoryTag<HugePageOwner> tag;
+    huge_page =
+        base::AllocateHugePageMemory(4096, base::kLazyHugePages, &backing);
+  }
+  {
+    base::ScopedSingletonMemoryTag<NumaOwner> tag;
+    numa = base::AllocateNumaMemory(4096, base::kNumaInterleave, 0, NULL);
+  }
+  EXPECT_EQ(backing == base::kHugeTlbPages
+                ? base::GetHugePageSize()
+                : base::GetTransparentHugePageSize(),
+            UsageOf<HugePageOwner>().live_bytes);
+  EXPECT_EQ(4096, UsageOf<NumaOwner>().live_bytes);
+  base::FreeHugePageMemory(huge_page, 4096);
+  base::FreeNumaMemory(numa, 4096);
+  EXPECT_EQ(0, UsageOf<HugePageOwner>().live_bytes);
+  EXPECT_EQ(0, UsageOf<NumaOwner>().live_bytes);
+}
+
+// The arena never gives memory back, so the charge stays.
+void ArenaIsCharged() {
+  {
+    base::ScopedSingletonMemoryTag<ArenaOwner> tag;
+    base::internal::AllocateFromSingletonArena(200, 8,
+                                               base::kSingletonArenaWarm);
+  }
+  EXPECT_EQ(200, UsageOf<ArenaOwner>().live_bytes);
+  EXPECT_EQ(1, UsageOf<ArenaOwner>().allocation_count);
+}
+
+}  // namespace
+
+int main() {
+  // Only meaningful with make MEMORY_ACCOUNTING=1.
+  if (!base::SingletonMemoryAccountingEnabled())
+    return 0;
+  RUN_TEST(AlignedAllocIsCharged);
+  RUN_TEST(MappedMemoryIsCharged);
+  RUN_TEST(ArenaIsCharged);
+  return 0;
+}
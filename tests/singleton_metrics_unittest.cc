@@ -0,0 +1,170 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharded_singleton.h"
+#include "singleton.h"
+#include "singleton_metrics.h"
+#include "tests/test_util.h"
+
+namespace {
+
+const int kShards = 4;
+
+struct Counter {
+  Counter() {}
+  static Counter* GetInstance() {
+    return base::ShardedSingleton<Counter, kShards>::get();
+  }
+};
+
+// Two singletons of the same type with different traits.
+struct Widget {
+  Widget() {}
+  static Widget* GetInstance() {
+    base::Singleton<Widget, WidgetTraits>::get();
+    return base::Singleton<Widget>::get();
+  }
+
+  struct WidgetTraits : public base::DefaultSingletonTraits<Widget> {};
+};
+
+bool Contains(const std::string& text, const char* part) {
+  return text.find(part) != std::string::npos;
+}
+
+bool ReadFile(const std::string& path, std::string* contents) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+  contents->clear();
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+std::string TemporaryDirectory() {
+  char path[] = "/tmp/singleton_metrics_XXXXXX";
+  EXPECT_TRUE(mkdtemp(path) != NULL);
+  return path;
+}
+
+void NoSeriesRepeats() {
+  // Consecutive threads are routed to consecutive shards.
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kShards; ++i)
+    threads.emplace_back([] { Counter::GetInstance(); });
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  Widget::GetInstance();
+
+  std::string metrics = base::GetSingletonMetrics();
+  std::set<std::string> series;
+  int construction_samples = 0;
+  size_t begin = 0;
+  while (begin < metrics.size()) {
+    size_t end = metrics.find('\n', begin);
+    EXPECT_TRUE(end != std::string::npos);
+    std::string line = metrics.substr(begin, end - begin);
+    begin = end + 1;
+    if (line[0] == '#')
+      continue;
+    std::string name_and_labels = line.substr(0, line.rfind(' '));
+    if (!series.insert(name_and_labels).second) {
+      fprintf(stderr, "repeated series: %s\n", name_and_labels.c_str());
+      EXPECT_TRUE(false);
+    }
+    if (name_and_labels.compare(0, strlen("singleton_construction_seconds{"),
+                                "singleton_construction_seconds{") == 0) {
+      ++construction_samples;
+    }
+  }
+  EXPECT_EQ(kShards + 2, construction_samples);
+  EXPECT_TRUE(Contains(metrics, "differentiating_type=\"base::internal::"
+                                "ShardTag<{anonymous}::Counter, 3>\""));
+  EXPECT_TRUE(Contains(metrics, "traits=\"{anonymous}::Widget::WidgetTraits\""));
+}
+
+void ExportsToFile() {
+  std::string directory = TemporaryDirectory();
+  std::string path = directory + "/singletons.prom";
+  EXPECT_TRUE(base::StartSingletonMetricsExporter(path, 10));
+  EXPECT_TRUE(!base::StartSingletonMetricsExporter(path, 10));
+
+  // Snapshots keep coming: remove the file and wait for the next one.
+  std::string contents;
+  for (int snapshot = 0; snapshot < 2; ++snapshot) {
+    unlink(path.c_str());
+    int tries = 0;
+    while (!ReadFile(path, &contents) && ++tries < 500)
+      usleep(2000);
+    EXPECT_TRUE(Contains(contents, "# TYPE singleton_instances gauge\n"));
+    EXPECT_TRUE(Contains(contents, "singleton_construction_seconds{type="));
+  }
+  base::StopSingletonMetricsExporter();
+
+  // The temporary file was renamed, never left behind.
+  struct stat info;
+  EXPECT_TRUE(stat((path + ".tmp").c_str(), &info) != 0);
+  unlink(path.c_str());
+  rmdir(directory.c_str());
+}
+
+void ExportsToSocket() {
+  std::string directory = TemporaryDirectory();
+  std::string path = directory + "/metrics.sock";
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  EXPECT_TRUE(listener >= 0);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  EXPECT_EQ(0, bind(listener, reinterpret_cast<struct sockaddr*>(&address),
+                    sizeof(address)));
+  EXPECT_EQ(0, listen(listener, 4));
+
+  EXPECT_TRUE(base::StartSingletonMetricsExporter("unix:" + path, 10));
+  // Each snapshot is one connection, closed once written.
+  for (int snapshot = 0; snapshot < 2; ++snapshot) {
+    int connection = accept(listener, NULL, NULL);
+    EXPECT_TRUE(connection >= 0);
+    std::string contents;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(connection, buffer, sizeof(buffer))) > 0)
+      contents.append(buffer, static_cast<size_t>(length));
+    close(connection);
+    EXPECT_TRUE(Contains(contents, "# TYPE singleton_instances gauge\n"));
+    EXPECT_TRUE(Contains(contents, "singleton_reclaimer_pending "));
+  }
+  base::StopSingletonMetricsExporter();
+
+  close(listener);
+  unlink(path.c_str());
+  rmdir(directory.c_str());
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(NoSeriesRepeats);
+  RUN_TEST(ExportsToFile);
+  RUN_TEST(ExportsToSocket);
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "atomicops.h"
+#include "singleton_reclaimer.h"
+#include "tests/test_util.h"
+
+namespace {
+
+base::subtle::Atomic32 g_deleted = 0;
+base::subtle::Atomic32 g_hold = 0;
+// Write end of the pipe that deletions in a child report to.
+int g_report_fd = -1;
+
+void CountDeletion(void*) {
+  while (base::subtle::Acquire_Load(&g_hold))
+    sched_yield();
+  base::subtle::NoBarrier_AtomicIncrement(&g_deleted, 1);
+}
+
+void SlowReportedDeletion(void*) {
+  usleep(1000);
+  char deleted = 1;
+  if (write(g_report_fd, &deleted, 1) != 1)
+    _exit(2);
+}
+
+int WaitForChild(pid_t child) {
+  int status = 0;
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Counts the bytes written to |fd| until every writer has closed it.
+int CountReports(int fd) {
+  int reports = 0;
+  char buffer[64];
+  ssize_t bytes;
+  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+    reports += static_cast<int>(bytes);
+  return reports;
+}
+
+void DrainWaitsForDeletions() {
+  base::subtle::NoBarrier_Store(&g_deleted, 0);
+  for (int i = 0; i < 10; ++i)
+    base::internal::PostReclaim(&CountDeletion, NULL);
+  base::DrainSingletonReclaimer();
+  EXPECT_EQ(10, base::subtle::NoBarrier_Load(&g_deleted));
+  base::SingletonReclaimerStats stats;
+  base::GetSingletonReclaimerStats(&stats);
+  EXPECT_EQ(0, stats.pending);
+}
+
+// A full queue holds retiring threads back instead of growing.
+void FullQueueBlocksRetirement() {
+  const int kPosts = 300;
+  base::subtle::NoBarrier_Store(&g_deleted, 0);
+  base::subtle::Release_Store(&g_hold, 1);
+  base::SingletonReclaimerStats before;
+  base::GetSingletonReclaimerStats(&before);
+
+  std::thread retirer([] {
+    for (int i = 0; i < kPosts; ++i)
+      base::internal::PostReclaim(&CountDeletion, NULL);
+  });
+  base::SingletonReclaimerStats stats;
+  do {
+    sched_yield();
+    base::GetSingletonReclaimerStats(&stats);
+  } while (stats.blocked == before.blocked);
+  // The queue is full, and one more deletion may be running.
+  EXPECT_TRUE(stats.pending == 256 || stats.pending == 257);
+
+  base::subtle::Release_Store(&g_hold, 0);
+  retirer.join();
+  base::DrainSingletonReclaimer();
+  base::GetSingletonReclaimerStats(&stats);
+  EXPECT_EQ(kPosts, base::subtle::NoBarrier_Load(&g_deleted));
+  EXPECT_TRUE(stats.max_pending <= 257);
+}
+
+// exit() runs every queued deletion before the process goes away.
+void ExitDrainsQueue() {
+  int pipe_fds[2];
+  EXPECT_EQ(0, pipe(pipe_fds));
+  pid_t child = fork();
+  if (child == 0) {
+    close(pipe_fds[0]);
+    g_report_fd = pipe_fds[1];
+    for (int i = 0; i < 20; ++i)
+      base::internal::PostReclaim(&SlowReportedDeletion, NULL);
+    exit(0);
+  }
+  close(pipe_fds[1]);
+  EXPECT_EQ(20, CountReports(pipe_fds[0]));
+  close(pipe_fds[0]);
+  EXPECT_EQ(0, WaitForChild(child));
+}
+
+// The reclaimer thread of the parent isn't in the child; the child's first
+// retirement starts its own, and exit() doesn't wait on the parent's queue.
+void RetireInForkedChild() {
+  // Makes sure the parent's reclaimer is running, with a task still queued.
+  base::subtle::Release_Store(&g_hold, 1);
+  base::internal::PostReclaim(&CountDeletion, NULL);
+  base::internal::PostReclaim(&CountDeletion, NULL);
+
+  int pipe_fds[2];
+  EXPECT_EQ(0, pipe(pipe_fds));
+  pid_t child = fork();
+  if (child == 0) {
+    alarm(10);
+    close(pipe_fds[0]);
+    g_report_fd = pipe_fds[1];
+    base::internal::PostReclaim(&SlowReportedDeletion, NULL);
+    base::SingletonReclaimerStats stats;
+    base::GetSingletonReclaimerStats(&stats);
+    exit(stats.pending <= 1 ? 0 : 1);
+  }
+  close(pipe_fds[1]);
+  EXPECT_EQ(1, CountReports(pipe_fds[0]));
+  close(pipe_fds[0]);
+  EXPECT_EQ(0, WaitForChild(child));
+
+  base::subtle::Release_Store(&g_hold, 0);
+  base::DrainSingletonReclaimer();
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(DrainWaitsForDeletions);
+  RUN_TEST(FullQueueBlocksRetirement);
+  RUN_TEST(ExitDrainsQueue);
+  RUN_TEST(RetireInForkedChild);
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "singleton.h"
+#include "singleton_registry.h"
+#include "tests/test_util.h"
+
+namespace {
+
+struct Early {
+  static Early* GetInstance();
+};
+
+Early* Early::GetInstance() {
+  return base::Singleton<Early>::get();
+}
+
+struct Late {
+  static Late* GetInstance();
+};
+
+Late* Late::GetInstance() {
+  return base::Singleton<Late>::get();
+}
+
+// Runs |child| in a forked process with stderr redirected to a pipe. Returns
+// its wait status and stores what it printed in |output|.
+int RunInChild(void (*child)(), std::string* output) {
+  int pipe_fds[2];
+  EXPECT_EQ(0, pipe(pipe_fds));
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(pipe_fds[1], STDERR_FILENO);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    alarm(10);
+    child();
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+  char buffer[256];
+  ssize_t bytes;
+  while ((bytes = read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+    output->append(buffer, bytes);
+  close(pipe_fds[0]);
+  int status = 0;
+  EXPECT_EQ(pid, waitpid(pid, &status, 0));
+  return status;
+}
+
+void SealAndCreate() {
+  Early* early = Early::GetInstance();
+  base::SealSingletons();
+  if (!base::SingletonsSealed() || Early::GetInstance() != early)
+    _exit(1);
+  Late::GetInstance();
+}
+
+// Instances created before the seal keep being returned; a creation after it
+// aborts and names the type.
+void CreationAfterSealAborts() {
+  std::string output;
+  int status = RunInChild(&SealAndCreate, &output);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  EXPECT_EQ(SIGABRT, WTERMSIG(status));
+  EXPECT_TRUE(output.find("FATAL: Singleton<") != std::string::npos);
+  EXPECT_TRUE(output.find("Late") != std::string::npos);
+  EXPECT_TRUE(output.find("created after SealSingletons()") !=
+              std::string::npos);
+  EXPECT_TRUE(!base::SingletonsSealed());
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(CreationAfterSealAborts);
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "singleton_snapshot.h"
+#include "tests/test_util.h"
+
+namespace {
+
+const uint64_t kVersion = 7;
+
+struct Counter {
+  Counter() : value(0), restored(false) {}
+  int value;
+  bool restored;
+};
+
+struct CounterTraits : base::SnapshotSingletonTraits<Counter, CounterTraits> {
+  static bool Snapshot(const Counter& counter, std::string* data) {
+    data->assign(reinterpret_cast<const char*>(&counter.value),
+                 sizeof(counter.value));
+    return true;
+  }
+
+  static Counter* Restore(const char* data, size_t size) {
+    if (size != sizeof(int))
+      return NULL;
+    Counter* counter = new Counter;
+    memcpy(&counter->value, data, size);
+    counter->restored = true;
+    return counter;
+  }
+};
+
+struct Named {};
+
+struct NamedTraits : base::SnapshotSingletonTraits<Named, NamedTraits> {
+  static bool Snapshot(const Named&, std::string*) { return true; }
+  static Named* Restore(const char*, size_t) { return NULL; }
+  static const char* SnapshotKey(char*, size_t) { return "named"; }
+};
+
+std::string SnapshotPath() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/singleton_snapshot_unittest.%d",
+           getpid());
+  return path;
+}
+
+void RestoresFromSnapshot() {
+  std::string path = SnapshotPath();
+  Counter* counter = CounterTraits::New();
+  EXPECT_TRUE(!counter->restored);
+  counter->value = 42;
+  EXPECT_TRUE(base::WriteSingletonSnapshot(path.c_str(), kVersion));
+  CounterTraits::Delete(counter);
+
+  EXPECT_TRUE(base::LoadSingletonSnapshot(path.c_str(), kVersion));
+  counter = CounterTraits::New();
+  EXPECT_TRUE(counter->restored);
+  EXPECT_EQ(42, counter->value);
+  CounterTraits::Delete(counter);
+  base::DiscardSingletonSnapshot();
+  unlink(path.c_str());
+}
+
+// Records found by earlier creations point into the loaded snapshot, so a
+// second one is refused rather than replacing or leaking it.
+void SecondLoadIsRefused() {
+  std::string path = SnapshotPath();
+  EXPECT_TRUE(base::WriteSingletonSnapshot(path.c_str(), kVersion));
+  EXPECT_TRUE(base::LoadSingletonSnapshot(path.c_str(), kVersion));
+  EXPECT_TRUE(!base::LoadSingletonSnapshot(path.c_str(), kVersion));
+  base::DiscardSingletonSnapshot();
+  EXPECT_TRUE(base::LoadSingletonSnapshot(path.c_str(), kVersion));
+  base::DiscardSingletonSnapshot();
+  unlink(path.c_str());
+}
+
+// Keys are built in a buffer of the caller, so concurrent creations of
+// different singletons can't see each other's half written keys.
+void KeysAreBuiltPerCall() {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 1000; ++j) {
+        char buffer[base::internal::kMaxSnapshotKeySize];
+        const char* key = CounterTraits::SnapshotKey(buffer, sizeof(buffer));
+        EXPECT_TRUE(strstr(key, "Counter") != NULL);
+      }
+    });
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  char buffer[base::internal::kMaxSnapshotKeySize];
+  EXPECT_TRUE(strcmp("named", NamedTraits::SnapshotKey(buffer,
+                                                       sizeof(buffer))) == 0);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(RestoresFromSnapshot);
+  RUN_TEST(SecondLoadIsRefused);
+  RUN_TEST(KeysAreBuiltPerCall);
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "atomicops.h"
+#include "singleton.h"
+#include "tests/test_util.h"
+
+namespace {
+
+// Both are more aligned than operator new guarantees before C++17.
+struct alignas(64) CacheLine {
+  static CacheLine* GetInstance();
+  char bytes[64];
+};
+
+CacheLine* CacheLine::GetInstance() {
+  return base::Singleton<CacheLine>::get();
+}
+
+struct alignas(4096) Page {
+  static Page* GetInstance();
+  char bytes[100];
+};
+
+Page* Page::GetInstance() {
+  return base::Singleton<Page, base::LeakySingletonTraits<Page> >::get();
+}
+
+bool IsAlignedTo(const void* pointer, size_t alignment) {
+  return (reinterpret_cast<uintptr_t>(pointer) & (alignment - 1)) == 0;
+}
+
+void OverAlignedTypesAreAligned() {
+  CacheLine* cache_line = CacheLine::GetInstance();
+  Page* page = Page::GetInstance();
+  EXPECT_TRUE(IsAlignedTo(cache_line, 64));
+  EXPECT_TRUE(IsAlignedTo(page, 4096));
+  EXPECT_TRUE(CacheLine::GetInstance() == cache_line);
+  EXPECT_TRUE(Page::GetInstance() == page);
+}
+
+// Gets itself from its own constructor.
+struct SelfCycle {
+  SelfCycle() { GetInstance(); }
+  static SelfCycle* GetInstance();
+};
+
+SelfCycle* SelfCycle::GetInstance() {
+  return base::Singleton<SelfCycle>::get();
+}
+
+// CycleA and CycleB each get the other from their constructor, once both
+// constructions have started on their own threads.
+base::subtle::Atomic32 g_cycle_started = 0;
+
+void WaitForBothCycleConstructors() {
+  base::subtle::NoBarrier_AtomicIncrement(&g_cycle_started, 1);
+  while (base::subtle::NoBarrier_Load(&g_cycle_started) < 2)
+    sched_yield();
+}
+
+struct CycleA {
+  CycleA();
+  static CycleA* GetInstance();
+};
+
+struct CycleB {
+  CycleB();
+  static CycleB* GetInstance();
+};
+
+CycleA::CycleA() {
+  WaitForBothCycleConstructors();
+  CycleB::GetInstance();
+}
+
+CycleB::CycleB() {
+  WaitForBothCycleConstructors();
+  CycleA::GetInstance();
+}
+
+CycleA* CycleA::GetInstance() {
+  return base::Singleton<CycleA>::get();
+}
+
+CycleB* CycleB::GetInstance() {
+  return base::Singleton<CycleB>::get();
+}
+
+// Runs |child| in a forked process with stderr redirected to a pipe. Returns
+// its wait status and stores what it printed in |output|. A child that hangs
+// is killed by SIGALRM.
+int RunInChild(void (*child)(), std::string* output) {
+  int pipe_fds[2];
+  EXPECT_EQ(0, pipe(pipe_fds));
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(pipe_fds[1], STDERR_FILENO);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    alarm(10);
+    child();
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+  char buffer[256];
+  ssize_t bytes;
+  while ((bytes = read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+    output->append(buffer, bytes);
+  close(pipe_fds[0]);
+  int status = 0;
+  EXPECT_EQ(pid, waitpid(pid, &status, 0));
+  return status;
+}
+
+bool Contains(const std::string& output, const char* text) {
+  return output.find(text) != std::string::npos;
+}
+
+void SelfCycleAborts() {
+  std::string output;
+  int status = RunInChild([] { SelfCycle::GetInstance(); }, &output);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  EXPECT_EQ(SIGABRT, WTERMSIG(status));
+  EXPECT_TRUE(Contains(output, "FATAL: Singleton<"));
+  EXPECT_TRUE(
+      Contains(output, "SelfCycle> is needed by its own construction"));
+}
+
+// Whichever thread closes the cycle aborts, printing both waits.
+void CrossThreadCycleAborts() {
+  std::string output;
+  int status = RunInChild(
+      [] {
+        std::thread other([] { CycleB::GetInstance(); });
+        CycleA::GetInstance();
+        other.join();
+      },
+      &output);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  EXPECT_EQ(SIGABRT, WTERMSIG(status));
+  EXPECT_TRUE(
+      Contains(output, "FATAL: singletons constructing each other across "));
+  EXPECT_TRUE(Contains(output, "CycleA>, being created by thread"));
+  EXPECT_TRUE(Contains(output, "CycleB>, being created by thread"));
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(OverAlignedTypesAreAligned);
+  RUN_TEST(SelfCycleAborts);
+  RUN_TEST(CrossThreadCycleAborts);
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atomicops.h"
+#include "singleton.h"
+#include "singleton_wait_sampler.h"
+#include "tests/test_util.h"
+
+namespace {
+
+// Construction blocks until released, so that other getters wait for it.
+base::subtle::Atomic32 g_release = 0;
+
+struct Slow {
+  Slow() {
+    while (!base::subtle::Acquire_Load(&g_release))
+      sched_yield();
+  }
+  static Slow* GetInstance();
+};
+
+Slow* Slow::GetInstance() {
+  return base::Singleton<Slow>::get();
+}
+
+// Returns the count at the end of the folded line that ends with |leaf|
+// followed by a space, 0 if there is none.
+long CountOf(const std::string& folded, const char* leaf) {
+  std::string needle = std::string(leaf) + " ";
+  size_t at = folded.find(needle);
+  if (at == std::string::npos)
+    return 0;
+  return strtol(folded.c_str() + at + needle.size(), NULL, 10);
+}
+
+// A thread waiting for a singleton under construction leaves one sample,
+// folded from the root down to the singleton.
+void WaitIsSampled() {
+  base::ResetSingletonWaitSamples();
+  base::EnableSingletonWaitSampling(10);
+  // Whichever gets there second waits for the other.
+  std::thread creator([] { Slow::GetInstance(); });
+  std::thread waiter([] { Slow::GetInstance(); });
+  // Fails instead of hanging if the wait isn't sampled under its name.
+  alarm(30);
+  std::string folded;
+  while (CountOf(folded, "Slow>") == 0) {
+    sched_yield();
+    folded = base::GetFoldedSingletonWaitStacks();
+  }
+  alarm(0);
+  base::subtle::Release_Store(&g_release, 1);
+  creator.join();
+  waiter.join();
+  base::EnableSingletonWaitSampling(0);
+
+  EXPECT_EQ(1, CountOf(folded, "Slow>"));
+  size_t line_end = folded.find("Slow> 1\n");
+  size_t line_start = folded.rfind('\n', line_end);
+  line_start = line_start == std::string::npos ? 0 : line_start + 1;
+  std::string line = folded.substr(line_start, line_end - line_start);
+  // Frames come first, each followed by ';', then the singleton.
+  EXPECT_TRUE(line.find(';') != std::string::npos);
+  EXPECT_TRUE(line.find("Singleton<") == line.rfind(';') + 1);
+  EXPECT_TRUE(folded.find("[dropped]") == std::string::npos);
+}
+
+// Samples of one singleton are limited to the rate asked for.
+void SamplesAreRateLimited() {
+  base::ResetSingletonWaitSamples();
+  base::EnableSingletonWaitSampling(1);
+  static const char kKey = 0;
+  for (int i = 0; i < 10; ++i)
+    base::internal::SampleSingletonWait(&kKey, "RateLimited");
+  base::EnableSingletonWaitSampling(0);
+  EXPECT_EQ(1, CountOf(base::GetFoldedSingletonWaitStacks(),
+                       "Singleton<RateLimited>"));
+}
+
+// Stacks that don't fit in the table are counted on their own line.
+void OverflowIsCountedAsDropped() {
+  base::ResetSingletonWaitSamples();
+  // One sample per nanosecond: the rate limit doesn't get in the way.
+  base::EnableSingletonWaitSampling(1000000000);
+  static const char kKey = 0;
+  // Every name is a distinct stack, more than the table holds.
+  const int kNames = 2000;
+  std::vector<std::string> names(kNames);
+  for (int i = 0; i < kNames; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "Name%d", i);
+    names[i] = name;
+    base::internal::SampleSingletonWait(&kKey, names[i].c_str());
+  }
+  base::EnableSingletonWaitSampling(0);
+
+  std::string folded = base::GetFoldedSingletonWaitStacks();
+  long dropped = CountOf(folded, "[dropped]");
+  EXPECT_TRUE(dropped > 0);
+  std::string last_line = "[dropped] " + std::to_string(dropped) + "\n";
+  EXPECT_TRUE(folded.size() > last_line.size() &&
+              folded.substr(folded.size() - last_line.size()) == last_line);
+
+  base::ResetSingletonWaitSamples();
+  EXPECT_TRUE(base::GetFoldedSingletonWaitStacks().empty());
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(WaitIsSampled);
+  RUN_TEST(SamplesAreRateLimited);
+  RUN_TEST(OverflowIsCountedAsDropped);
+  return 0;
+}
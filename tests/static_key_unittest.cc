@@ -0,0 +1,258 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "at_exit.h"
+#include "singleton.h"
+#include "tests/test_util.h"
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// Many singletons, so that some get patched while other threads run their
+// get().
+template <int N>
+struct Hot {
+  Hot() : value(N) {}
+  static Hot* GetInstance() { return base::Singleton<Hot>::get(); }
+  int value;
+};
+
+template <int N>
+struct GetHot {
+  static bool Run() {
+    Hot<N>* instance = Hot<N>::GetInstance();
+    return instance == Hot<N>::GetInstance() && instance->value == N &&
+           GetHot<N - 1>::Run();
+  }
+};
+
+template <>
+struct GetHot<-1> {
+  static bool Run() { return true; }
+};
+
+void GetReturnsTheInstanceWhilePatched() {
+  const int kThreads = 4;
+  const int kIterations = 2000;
+  base::subtle::AtomicWord failures = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&failures] {
+      for (int j = 0; j < kIterations; ++j) {
+        if (!GetHot<63>::Run())
+          base::subtle::NoBarrier_AtomicIncrement(&failures, 1);
+      }
+    });
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  EXPECT_EQ(0, failures);
+}
+
+struct DeletedAtExitTraits;
+
+// Deleted by AtExitManager.
+struct DeletedAtExit {
+  DeletedAtExit() : alive(true) {}
+  ~DeletedAtExit() { alive = false; }
+  static DeletedAtExit* GetInstance() {
+    return base::Singleton<DeletedAtExit, DeletedAtExitTraits>::get();
+  }
+  bool alive;
+};
+
+struct DeletedAtExitTraits
+    : public base::DefaultSingletonTraits<DeletedAtExit> {
+  static const bool kRegisterAtExit = true;
+};
+
+// The patched get() must not keep returning the deleted instance.
+void GetAfterProcessCallbacksNow() {
+  base::AtExitManager exit_manager;
+  DeletedAtExit* first = DeletedAtExit::GetInstance();
+  EXPECT_TRUE(DeletedAtExit::GetInstance() == first);
+  base::AtExitManager::ProcessCallbacksNow();
+
+  DeletedAtExit* second = DeletedAtExit::GetInstance();
+  EXPECT_TRUE(second != NULL);
+  EXPECT_TRUE(second->alive);
+  EXPECT_TRUE(DeletedAtExit::GetInstance() == second);
+  EXPECT_TRUE(DeletedAtExit::GetInstance()->alive);
+}
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+
+// Returns how many sites of Singleton S are in the jump table, and how many
+// of them start with |opcode|.
+template <typename S>
+void CountSites(unsigned char opcode, int* sites, int* matching) {
+  *sites = 0;
+  *matching = 0;
+  uintptr_t key =
+      reinterpret_cast<uintptr_t>(&base::internal::StaticKeyHolder<S>::key);
+  for (const base::internal::StaticKeyEntry* entry =
+           base::__start___singleton_static_keys;
+       entry < base::__stop___singleton_static_keys; ++entry) {
+    if (entry->key != key)
+      continue;
+    ++*sites;
+    if (*reinterpret_cast<const unsigned char*>(entry->site) == opcode)
+      ++*matching;
+  }
+}
+
+int g_sigtraps = 0;
+
+void OnSigtrap(int /*signal*/) {
+  ++g_sigtraps;
+}
+
+// Must run before anything is patched, so that its handler is the previous
+// one of EnableStaticKey().
+void SigtrapChainsToPreviousHandler() {
+  signal(SIGTRAP, &OnSigtrap);
+  Hot<100>::GetInstance();
+  Hot<100>::GetInstance();
+  raise(SIGTRAP);
+  EXPECT_EQ(1, g_sigtraps);
+  asm volatile("int3");
+  EXPECT_EQ(2, g_sigtraps);
+}
+
+struct PatchedMidway {
+  PatchedMidway() {}
+  static PatchedMidway* GetInstance() {
+    return base::Singleton<PatchedMidway>::get();
+  }
+};
+
+PatchedMidway* g_midway_instance = NULL;
+int g_midway_sync = 0;
+int g_midway_int3_hits = 0;
+bool g_midway_ok = true;
+bool g_midway_text_writable = false;
+
+// Returns the permissions, such as "r-xp", that /proc/self/maps lists for the
+// mapping containing |address|.
+std::string PermissionsOf(uintptr_t address) {
+  std::string permissions;
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (!maps)
+    return permissions;
+  char line[512];
+  while (fgets(line, sizeof(line), maps)) {
+    unsigned long begin;
+    unsigned long end;
+    char flags[5];
+    if (sscanf(line, "%lx-%lx %4s", &begin, &end, flags) == 3 &&
+        address >= begin && address < end) {
+      permissions = flags;
+      break;
+    }
+  }
+  fclose(maps);
+  return permissions;
+}
+
+// Runs between the steps of patching PatchedMidway, see syscall() below.
+void GetMidway() {
+  int sites;
+  int int3s;
+  CountSites<base::Singleton<PatchedMidway> >(0xcc, &sites, &int3s);
+  g_midway_int3_hits += int3s;
+  for (const base::internal::StaticKeyEntry* entry =
+           base::__start___singleton_static_keys;
+       entry < base::__stop___singleton_static_keys; ++entry) {
+    if (PermissionsOf(entry->site) != "r-xp")
+      g_midway_text_writable = true;
+  }
+  if (PatchedMidway::GetInstance() != g_midway_instance)
+    g_midway_ok = false;
+}
+
+void GetDuringPatch() {
+  g_midway_instance = PatchedMidway::GetInstance();
+  g_midway_sync = 1;
+  EXPECT_TRUE(PatchedMidway::GetInstance() == g_midway_instance);
+  g_midway_sync = 0;
+  EXPECT_TRUE(g_midway_ok);
+  // Text is never mapped writable, nor taken away from threads running it.
+  EXPECT_TRUE(!g_midway_text_writable);
+  // Run with the int3 in place after the first and second steps.
+  EXPECT_TRUE(g_midway_int3_hits >= 2);
+  int sites;
+  int nops;
+  CountSites<base::Singleton<PatchedMidway> >(0x0f, &sites, &nops);
+  EXPECT_TRUE(sites > 0);
+  EXPECT_EQ(sites, nops);
+}
+
+void SitesArePatched() {
+  int sites;
+  int nops;
+  CountSites<base::Singleton<Hot<0> > >(0x0f, &sites, &nops);
+  EXPECT_TRUE(sites > 0);
+  EXPECT_EQ(sites, nops);
+  CountSites<base::Singleton<Hot<63> > >(0x0f, &sites, &nops);
+  EXPECT_TRUE(sites > 0);
+  EXPECT_EQ(sites, nops);
+}
+
+#endif  // defined(SINGLETON_USE_STATIC_KEYS)
+
+}  // namespace
+
+#if defined(SINGLETON_USE_STATIC_KEYS)
+// Interposes the C library's syscall() to run GetMidway() after every core
+// serialization of the patch while g_midway_sync is set.
+extern "C" long syscall(long number, ...) {
+  typedef long (*SyscallFunction)(long, ...);
+  static SyscallFunction real_syscall =
+      reinterpret_cast<SyscallFunction>(dlsym(RTLD_NEXT, "syscall"));
+  va_list list;
+  va_start(list, number);
+  long arguments[6];
+  for (int i = 0; i < 6; ++i)
+    arguments[i] = va_arg(list, long);
+  va_end(list);
+  long result = real_syscall(number, arguments[0], arguments[1], arguments[2],
+                             arguments[3], arguments[4], arguments[5]);
+  if (number == __NR_membarrier &&
+      arguments[0] == MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE &&
+      g_midway_sync) {
+    g_midway_sync = 0;
+    GetMidway();
+    g_midway_sync = 1;
+  }
+  return result;
+}
+#endif
+
+int main() {
+#if defined(SINGLETON_USE_STATIC_KEYS)
+  RUN_TEST(SigtrapChainsToPreviousHandler);
+  RUN_TEST(GetDuringPatch);
+#endif
+  RUN_TEST(GetReturnsTheInstanceWhilePatched);
+  RUN_TEST(GetAfterProcessCallbacksNow);
+#if defined(SINGLETON_USE_STATIC_KEYS)
+  RUN_TEST(SitesArePatched);
+#endif
+  return 0;
+}
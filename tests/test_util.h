@@ -0,0 +1,44 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Minimal checks for the programs in tests/. Each test is a main() that runs
+// its cases in order; the first failed check prints where it failed and
+// exits, which makes "make check" stop.
+
+#ifndef BASE_TESTS_TEST_UTIL_H_
+#define BASE_TESTS_TEST_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EXPECT_TRUE(condition)                                            \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      fprintf(stderr, "%s:%d: Failure: %s\n", __FILE__, __LINE__,         \
+              #condition);                                                \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+#define EXPECT_EQ(expected, actual)                                       \
+  do {                                                                    \
+    long long expected_value = static_cast<long long>(expected);          \
+    long long actual_value = static_cast<long long>(actual);              \
+    if (expected_value != actual_value) {                                 \
+      fprintf(stderr, "%s:%d: Failure: %s == %s (%lld vs %lld)\n",        \
+              __FILE__, __LINE__, #expected, #actual, expected_value,     \
+              actual_value);                                              \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+// Runs a test case function and reports it.
+#define RUN_TEST(test)                 \
+  do {                                 \
+    printf("  %s\n", #test);           \
+    fflush(stdout);                    \
+    test();                            \
+  } while (0)
+
+#endif  // BASE_TESTS_TEST_UTIL_H_
@@ -0,0 +1,153 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "atomicops.h"
+#include "tests/test_util.h"
+#include "trace_event.h"
+#include "trace_log.h"
+
+namespace {
+
+// Slots of a thread's ring, see trace_log.cc.
+const int64_t kRingEvents = 16 * 1024;
+
+// Counter names, so that a torn event shows as a value under the wrong name.
+const char* const kNames[] = {"n0", "n1", "n2", "n3", "n4", "n5", "n6", "n7"};
+const int64_t kNameCount = sizeof(kNames) / sizeof(kNames[0]);
+
+std::string g_path;
+
+std::string ReadFile(const std::string& path) {
+  std::string contents;
+  FILE* file = fopen(path.c_str(), "r");
+  EXPECT_TRUE(file != NULL);
+  char buffer[65536];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, length);
+  fclose(file);
+  return contents;
+}
+
+int64_t CountEvents(const std::string& trace) {
+  int64_t count = 0;
+  for (size_t at = trace.find("\"ph\":"); at != std::string::npos;
+       at = trace.find("\"ph\":", at + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+int64_t DroppedEvents(const std::string& trace) {
+  const char kKey[] = "\"dropped_events\":\"";
+  size_t at = trace.find(kKey);
+  EXPECT_TRUE(at != std::string::npos);
+  return atoll(trace.c_str() + at + sizeof(kKey) - 1);
+}
+
+// Flushes and returns the trace.
+std::string Flush() {
+  EXPECT_TRUE(base::TraceLog::GetInstance()->Flush(g_path));
+  return ReadFile(g_path);
+}
+
+void FlushesEveryEventOfAThread() {
+  base::TraceLog::GetInstance()->SetEnabled(true);
+  for (int i = 0; i < 12000; ++i)
+    TRACE_COUNTER1("test", "count", i);
+  std::string trace = Flush();
+  EXPECT_EQ(12000, CountEvents(trace));
+  EXPECT_EQ(0, DroppedEvents(trace));
+  EXPECT_TRUE(trace.find("\"args\":{\"value\":11999}") != std::string::npos);
+
+  // Flushed events are gone.
+  EXPECT_EQ(0, CountEvents(Flush()));
+}
+
+void CountsOverwrittenEventsAsDropped() {
+  const int64_t kEvents = kRingEvents + 1000;
+  for (int64_t i = 0; i < kEvents; ++i)
+    TRACE_COUNTER1("test", "count", i);
+  std::string trace = Flush();
+  int64_t flushed = CountEvents(trace);
+  EXPECT_EQ(kRingEvents - 1, flushed);
+  EXPECT_EQ(kEvents, flushed + DroppedEvents(trace));
+  // The newest events are kept.
+  EXPECT_TRUE(trace.find("\"args\":{\"value\":17383}") != std::string::npos);
+  EXPECT_TRUE(trace.find("\"args\":{\"value\":1000}") == std::string::npos);
+}
+
+void FlushWhileRecordingNeverTearsEvents() {
+  base::subtle::AtomicWord stop = 0;
+  base::subtle::AtomicWord recorded = 0;
+  std::thread writer([&stop, &recorded] {
+    int64_t i = 0;
+    for (; !base::subtle::NoBarrier_Load(&stop); ++i) {
+      base::TraceLog::GetInstance()->AddEvent(
+          base::kTraceEventCounter, "test", kNames[i % kNameCount], i);
+    }
+    base::subtle::Release_Store(&recorded, i);
+  });
+
+  int64_t flushed = 0;
+  int64_t dropped = 0;
+  for (int round = 0; round < 20; ++round) {
+    std::string trace = Flush();
+    flushed += CountEvents(trace);
+    dropped += DroppedEvents(trace);
+    // Every value must be under the name it was recorded with.
+    for (size_t at = trace.find("\"name\":\"n"); at != std::string::npos;
+         at = trace.find("\"name\":\"n", at + 1)) {
+      int64_t name = trace[at + 9] - '0';
+      size_t value_at = trace.find("\"value\":", at);
+      EXPECT_TRUE(value_at != std::string::npos);
+      int64_t value = atoll(trace.c_str() + value_at + 8);
+      EXPECT_EQ(value % kNameCount, name);
+    }
+    usleep(5000);
+  }
+  base::subtle::NoBarrier_Store(&stop, 1);
+  writer.join();
+
+  std::string trace = Flush();
+  flushed += CountEvents(trace);
+  dropped += DroppedEvents(trace);
+  EXPECT_EQ(base::subtle::Acquire_Load(&recorded), flushed + dropped);
+}
+
+void RecreatedAfterDelete() {
+  TRACE_COUNTER1("test", "before", 1);
+  base::internal::DeleteTraceLogForTesting::Delete();
+
+  // The thread's cached buffer belonged to the deleted instance.
+  base::TraceLog::GetInstance()->SetEnabled(true);
+  TRACE_COUNTER1("test", "after", 2);
+  std::string trace = Flush();
+  EXPECT_EQ(1, CountEvents(trace));
+  EXPECT_TRUE(trace.find("\"after\"") != std::string::npos);
+}
+
+}  // namespace
+
+int main() {
+  char directory[] = "/tmp/trace_log_XXXXXX";
+  EXPECT_TRUE(mkdtemp(directory) != NULL);
+  g_path = std::string(directory) + "/trace.json";
+
+  RUN_TEST(FlushesEveryEventOfAThread);
+  RUN_TEST(CountsOverwrittenEventsAsDropped);
+  RUN_TEST(FlushWhileRecordingNeverTearsEvents);
+  RUN_TEST(RecreatedAfterDelete);
+
+  unlink(g_path.c_str());
+  rmdir(directory);
+  return 0;
+}
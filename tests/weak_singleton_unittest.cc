@@ -0,0 +1,183 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "atomicops.h"
+#include "tests/test_util.h"
+#include "weak_singleton.h"
+
+namespace {
+
+const int kAlive = 0x600d;
+const int kDead = 0xdead;
+
+int64_t NowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// Reaped as soon as it's unreferenced, with a slow destructor.
+struct SlowToDestroy {
+  SlowToDestroy() : state(kAlive) {
+    base::subtle::NoBarrier_AtomicIncrement(&constructed, 1);
+  }
+  ~SlowToDestroy() {
+    base::subtle::Release_Store(&destructor_started, 1);
+    usleep(300 * 1000);
+    state = kDead;
+    base::subtle::NoBarrier_AtomicIncrement(&destroyed, 1);
+  }
+
+  int state;
+  static base::subtle::AtomicWord constructed;
+  static base::subtle::AtomicWord destroyed;
+  static base::subtle::AtomicWord destructor_started;
+};
+
+base::subtle::AtomicWord SlowToDestroy::constructed = 0;
+base::subtle::AtomicWord SlowToDestroy::destroyed = 0;
+base::subtle::AtomicWord SlowToDestroy::destructor_started = 0;
+
+struct SlowToDestroyTraits
+    : public base::DefaultWeakSingletonTraits<SlowToDestroy> {
+  static const int kIdleDelayMs = 0;
+};
+
+typedef base::WeakSingleton<SlowToDestroy, SlowToDestroyTraits> SlowWeak;
+
+// Used by the stress test.
+struct Churned {
+  Churned() : state(kAlive) {
+    base::subtle::NoBarrier_AtomicIncrement(&live, 1);
+  }
+  ~Churned() {
+    state = kDead;
+    base::subtle::NoBarrier_AtomicIncrement(&live, -1);
+  }
+
+  volatile int state;
+  static base::subtle::AtomicWord live;
+};
+
+base::subtle::AtomicWord Churned::live = 0;
+
+struct ChurnedTraits : public base::DefaultWeakSingletonTraits<Churned> {
+  static const int kIdleDelayMs = 0;
+};
+
+typedef base::WeakSingleton<Churned, ChurnedTraits> ChurnedWeak;
+
+// Kept alive for a while after its last Ref is dropped.
+struct Lingering {
+  Lingering() { base::subtle::NoBarrier_AtomicIncrement(&constructed, 1); }
+  ~Lingering() { base::subtle::NoBarrier_AtomicIncrement(&destroyed, 1); }
+
+  static base::subtle::AtomicWord constructed;
+  static base::subtle::AtomicWord destroyed;
+};
+
+base::subtle::AtomicWord Lingering::constructed = 0;
+base::subtle::AtomicWord Lingering::destroyed = 0;
+
+struct LingeringTraits : public base::DefaultWeakSingletonTraits<Lingering> {
+  static const int kIdleDelayMs = 300;
+};
+
+typedef base::WeakSingleton<Lingering, LingeringTraits> LingeringWeak;
+
+bool WaitFor(base::subtle::AtomicWord* word,
+             base::subtle::AtomicWord value,
+             int timeout_ms) {
+  int64_t deadline = NowMs() + timeout_ms;
+  while (base::subtle::Acquire_Load(word) != value) {
+    if (NowMs() > deadline)
+      return false;
+    usleep(1000);
+  }
+  return true;
+}
+
+void AcquireDuringDestructorDoesNotWait() {
+  {
+    SlowWeak::Ref ref = SlowWeak::get();
+    EXPECT_EQ(kAlive, ref->state);
+  }
+  EXPECT_TRUE(WaitFor(&SlowToDestroy::destructor_started, 1, 2000));
+
+  // The old instance is still being destroyed; a new one is created without
+  // waiting for that.
+  int64_t start = NowMs();
+  {
+    SlowWeak::Ref ref = SlowWeak::get();
+    EXPECT_EQ(kAlive, ref->state);
+    EXPECT_TRUE(NowMs() - start < 150);
+    EXPECT_EQ(2, base::subtle::NoBarrier_Load(&SlowToDestroy::constructed));
+  }
+  EXPECT_TRUE(WaitFor(&SlowToDestroy::destroyed, 2, 3000));
+}
+
+void ReapRacesWithReacquire() {
+  const int kThreads = 8;
+  const int64_t kDurationMs = 500;
+  base::subtle::AtomicWord failures = 0;
+  std::vector<std::thread> threads;
+  int64_t end = NowMs() + kDurationMs;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&failures, end] {
+      while (NowMs() < end) {
+        ChurnedWeak::Ref ref = ChurnedWeak::get();
+        if (!ref || ref->state != kAlive)
+          base::subtle::NoBarrier_AtomicIncrement(&failures, 1);
+        if (rand() % 4 == 0)
+          usleep(50);
+      }
+    });
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+
+  EXPECT_EQ(0, failures);
+  // Every instance is eventually reaped once unreferenced.
+  EXPECT_TRUE(WaitFor(&Churned::live, 0, 3000));
+
+  // And the next get() recreates one.
+  ChurnedWeak::Ref ref = ChurnedWeak::get();
+  EXPECT_EQ(kAlive, ref->state);
+}
+
+// A Ref taken within kIdleDelayMs of the last one being dropped gets the same
+// instance; the reap is pushed back until the instance has been idle long
+// enough.
+void ReacquireWithinIdleDelayReuses() {
+  Lingering* first;
+  {
+    LingeringWeak::Ref ref = LingeringWeak::get();
+    first = ref.get();
+  }
+  usleep(100 * 1000);
+  int64_t released;
+  {
+    LingeringWeak::Ref ref = LingeringWeak::get();
+    EXPECT_TRUE(ref.get() == first);
+    released = NowMs();
+  }
+  EXPECT_EQ(1, base::subtle::NoBarrier_Load(&Lingering::constructed));
+  EXPECT_TRUE(WaitFor(&Lingering::destroyed, 1, 3000));
+  EXPECT_TRUE(NowMs() - released >= LingeringTraits::kIdleDelayMs);
+}
+
+}  // namespace
+
+int main() {
+  RUN_TEST(AcquireDuringDestructorDoesNotWait);
+  RUN_TEST(ReapRacesWithReacquire);
+  RUN_TEST(ReacquireWithinIdleDelayReuses);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Macros that record trace events into the TraceLog.
+//
+//   void Renderer::Paint() {
+//     TRACE_EVENT0("gfx", "Renderer::Paint");
+//     ...
+//     TRACE_COUNTER1("gfx", "DirtyRects", dirty_rects_.size());
+//   }
+//
+// TRACE_EVENT0 records a begin event and, when the enclosing scope ends, the
+// matching end event. TRACE_COUNTER1 records the value of a counter.
+//
+// Categories must be string literals. Categories listed in
+// TRACE_DISABLED_CATEGORIES when compiling, e.g.
+//   -DTRACE_DISABLED_CATEGORIES='"gfx","ipc"'
+// are compiled out: their macros expand to nothing that runs. Other
+// categories are recorded while TraceLog::SetEnabled(true) is in effect.
+
+#ifndef BASE_DEBUG_TRACE_EVENT_H_
+#define BASE_DEBUG_TRACE_EVENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace_log.h"
+
+#if !defined(TRACE_DISABLED_CATEGORIES)
+#define TRACE_DISABLED_CATEGORIES
+#endif
+
+#define TRACE_EVENT0(category, name)                                      \
+  ::base::internal::ScopedTraceEvent<                                     \
+      ::base::internal::TraceCategoryCompiledIn(category)>                \
+      INTERNAL_TRACE_EVENT_UID(trace_event_)(category, name)
+
+#define TRACE_COUNTER1(category, name, value)                              \
+  ::base::internal::TraceCounter<                                          \
+      ::base::internal::TraceCategoryCompiledIn(category)>::Add(           \
+          category, name, static_cast<int64_t>(value))
+
+#define INTERNAL_TRACE_EVENT_UID3(prefix, line) prefix##line
+#define INTERNAL_TRACE_EVENT_UID2(prefix, line) \
+  INTERNAL_TRACE_EVENT_UID3(prefix, line)
+#define INTERNAL_TRACE_EVENT_UID(prefix) \
+  INTERNAL_TRACE_EVENT_UID2(prefix, __LINE__)
+
+namespace base {
+namespace internal {
+
+// The leading NULL keeps the array valid when no category is disabled.
+constexpr const char* kTraceDisabledCategories[] = {
+    NULL, TRACE_DISABLED_CATEGORIES};
+
+constexpr bool TraceStringsEqual(const char* a, const char* b) {
+  return *a == *b && (*a == '\0' || TraceStringsEqual(a + 1, b + 1));
+}
+
+constexpr bool TraceCategoryDisabled(const char* category, size_t index) {
+  return index < sizeof(kTraceDisabledCategories) /
+                     sizeof(kTraceDisabledCategories[0]) &&
+         ((kTraceDisabledCategories[index] &&
+           TraceStringsEqual(category, kTraceDisabledCategories[index])) ||
+          TraceCategoryDisabled(category, index + 1));
+}
+
+constexpr bool TraceCategoryCompiledIn(const char* category) {
+  return !TraceCategoryDisabled(category, 0);
+}
+
+template <bool kCompiledIn>
+class ScopedTraceEvent {
+ public:
+  ScopedTraceEvent(const char* category, const char* name) : name_(NULL) {
+    if (TraceLogEnabled()) {
+      category_ = category;
+      name_ = name;
+      TraceLog::GetInstance()->AddEvent(kTraceEventBegin, category, name, 0);
+    }
+  }
+
+  // Ends the event even if tracing was disabled in the meantime, so that no
+  // begin event is left open.
+  ~ScopedTraceEvent() {
+    if (name_)
+      TraceLog::GetInstance()->AddEvent(kTraceEventEnd, category_, name_, 0);
+  }
+
+ private:
+  const char* category_;
+  const char* name_;
+};
+
+template <>
+class ScopedTraceEvent<false> {
+ public:
+  ScopedTraceEvent(const char* /*category*/, const char* /*name*/) {}
+};
+
+template <bool kCompiledIn>
+struct TraceCounter {
+  static void Add(const char* category, const char* name, int64_t value) {
+    if (TraceLogEnabled())
+      TraceLog::GetInstance()->AddEvent(kTraceEventCounter, category, name,
+                                        value);
+  }
+};
+
+template <>
+struct TraceCounter<false> {
+  static void Add(const char* /*category*/,
+                  const char* /*name*/,
+                  int64_t /*value*/) {}
+};
+
+}  // namespace internal
+}  // namespace base
+
+#endif  // BASE_DEBUG_TRACE_EVENT_H_
@@ -0,0 +1,299 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace_log.h"
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace base {
+
+namespace internal {
+subtle::Atomic32 g_trace_log_enabled = 0;
+}  // namespace internal
+
+namespace {
+
+// A ring has kMaxChunks * kChunkEvents slots per thread. Flush() returns at
+// most all but one of them: the oldest event is in the slot the owner may be
+// writing.
+const int64_t kChunkEvents = 1024;
+const int64_t kMaxChunks = 16;
+const int64_t kRingEvents = kChunkEvents * kMaxChunks;
+
+// States of ThreadBuffer::state.
+const subtle::AtomicWord kBufferOwned = 0;
+const subtle::AtomicWord kBufferRetired = 1;
+
+struct TraceEvent {
+  int64_t timestamp_ns;
+  int64_t value;
+  const char* category;
+  const char* name;
+  char phase;
+};
+
+struct TraceChunk {
+  TraceEvent events[kChunkEvents];
+};
+
+int64_t NowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Writes |value| as a JSON string.
+void WriteJsonString(FILE* file, const char* value) {
+  fputc('"', file);
+  for (; *value; ++value) {
+    unsigned char c = static_cast<unsigned char>(*value);
+    if (c == '"' || c == '\\')
+      fprintf(file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(file, "\\u%04x", c);
+    else
+      fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+// Tells TraceLog instances apart, even one allocated where a deleted one was.
+subtle::AtomicWord g_last_generation = 0;
+
+// The buffer of the calling thread, valid while |t_buffer_generation| is the
+// generation of the current TraceLog: a thread may still point into a
+// deleted one. Initial-exec saves the __tls_get_addr() call of the default
+// model for a shared library on every event.
+#define TRACE_TLS __attribute__((tls_model("initial-exec")))
+__thread subtle::AtomicWord t_buffer_generation TRACE_TLS = 0;
+__thread void* t_buffer TRACE_TLS = NULL;
+#undef TRACE_TLS
+
+}  // namespace
+
+// Written by the owning thread only, except for |read_index|, which belongs
+// to Flush(). Event |i| lives in slot i % kRingEvents; |write_index| is
+// published with a release store after the event is written.
+struct TraceLog::ThreadBuffer {
+  subtle::AtomicWord write_index;
+  subtle::AtomicWord read_index;
+  subtle::AtomicWord state;
+  // Set before the buffer is published, and by each thread that takes it
+  // over, while Flush() may be reading it.
+  subtle::Atomic32 tid;
+  // Allocated by the owner the first time its ring reaches them.
+  subtle::AtomicWord chunks[kMaxChunks];
+  ThreadBuffer* next;
+};
+
+// Leaky: threads that are still recording at exit must not write into freed
+// buffers.
+typedef Singleton<TraceLog, LeakySingletonTraits<TraceLog> > TraceLogSingleton;
+
+TraceLog* TraceLog::GetInstance() {
+  return TraceLogSingleton::get();
+}
+
+TraceLog::TraceLog()
+    : generation_(subtle::NoBarrier_AtomicIncrement(&g_last_generation, 1)),
+      buffers_(0),
+      start_ns_(NowNs()) {
+  pthread_mutex_init(&flush_lock_, NULL);
+  pthread_key_create(&thread_exit_key_, &TraceLog::OnThreadExit);
+}
+
+TraceLog::~TraceLog() {
+  // Exiting threads must not retire buffers that are gone.
+  pthread_key_delete(thread_exit_key_);
+  ThreadBuffer* buffer =
+      reinterpret_cast<ThreadBuffer*>(subtle::NoBarrier_Load(&buffers_));
+  while (buffer) {
+    ThreadBuffer* next = buffer->next;
+    for (int64_t i = 0; i < kMaxChunks; ++i)
+      delete reinterpret_cast<TraceChunk*>(buffer->chunks[i]);
+    delete buffer;
+    buffer = next;
+  }
+  pthread_mutex_destroy(&flush_lock_);
+}
+
+void TraceLog::SetEnabled(bool enabled) {
+  subtle::NoBarrier_Store(&internal::g_trace_log_enabled, enabled ? 1 : 0);
+}
+
+bool TraceLog::IsEnabled() const {
+  return internal::TraceLogEnabled();
+}
+
+void TraceLog::AddEvent(TraceEventPhase phase,
+                        const char* category,
+                        const char* name,
+                        int64_t value) {
+  ThreadBuffer* buffer = static_cast<ThreadBuffer*>(t_buffer);
+  if (t_buffer_generation != generation_)
+    buffer = GetThreadBuffer();
+
+  subtle::AtomicWord index = subtle::NoBarrier_Load(&buffer->write_index);
+  int64_t slot = index % kRingEvents;
+  subtle::AtomicWord* chunk_word = &buffer->chunks[slot / kChunkEvents];
+  TraceChunk* chunk =
+      reinterpret_cast<TraceChunk*>(subtle::NoBarrier_Load(chunk_word));
+  if (!chunk) {
+    chunk = new TraceChunk;
+    subtle::Release_Store(chunk_word,
+                          reinterpret_cast<subtle::AtomicWord>(chunk));
+  }
+
+  TraceEvent* event = &chunk->events[slot % kChunkEvents];
+  event->timestamp_ns = NowNs();
+  event->value = value;
+  event->category = category;
+  event->name = name;
+  event->phase = static_cast<char>(phase);
+  subtle::Release_Store(&buffer->write_index, index + 1);
+}
+
+TraceLog::ThreadBuffer* TraceLog::GetThreadBuffer() {
+  ThreadBuffer* buffer = NULL;
+  for (ThreadBuffer* retired =
+           reinterpret_cast<ThreadBuffer*>(subtle::Acquire_Load(&buffers_));
+       retired && !buffer; retired = retired->next) {
+    if (subtle::Acquire_CompareAndSwap(&retired->state, kBufferRetired,
+                                       kBufferOwned) != kBufferRetired) {
+      continue;
+    }
+    // Events of the exited thread that weren't flushed yet would be
+    // attributed to this one.
+    if (subtle::Acquire_Load(&retired->read_index) ==
+        subtle::NoBarrier_Load(&retired->write_index)) {
+      buffer = retired;
+    } else {
+      subtle::Release_Store(&retired->state, kBufferRetired);
+    }
+  }
+
+  subtle::Atomic32 tid = static_cast<subtle::Atomic32>(syscall(SYS_gettid));
+  if (buffer) {
+    subtle::NoBarrier_Store(&buffer->tid, tid);
+  } else {
+    buffer = new ThreadBuffer();
+    buffer->tid = tid;
+    subtle::AtomicWord head = subtle::NoBarrier_Load(&buffers_);
+    while (true) {
+      buffer->next = reinterpret_cast<ThreadBuffer*>(head);
+      subtle::AtomicWord previous = subtle::Release_CompareAndSwap(
+          &buffers_, head, reinterpret_cast<subtle::AtomicWord>(buffer));
+      if (previous == head)
+        break;
+      head = previous;
+    }
+  }
+
+  pthread_setspecific(thread_exit_key_, buffer);
+  t_buffer = buffer;
+  t_buffer_generation = generation_;
+  return buffer;
+}
+
+// static
+void TraceLog::OnThreadExit(void* buffer) {
+  t_buffer = NULL;
+  t_buffer_generation = 0;
+  subtle::Release_Store(&static_cast<ThreadBuffer*>(buffer)->state,
+                        kBufferRetired);
+}
+
+bool TraceLog::Flush(const std::string& path) {
+  struct FlushedEvent {
+    TraceEvent event;
+    pid_t tid;
+  };
+  std::vector<FlushedEvent> events;
+  int64_t dropped = 0;
+
+  pthread_mutex_lock(&flush_lock_);
+  for (ThreadBuffer* buffer =
+           reinterpret_cast<ThreadBuffer*>(subtle::Acquire_Load(&buffers_));
+       buffer; buffer = buffer->next) {
+    // The owner may be writing event |end| right now, into the slot of event
+    // end - kRingEvents.
+    int64_t end = subtle::Acquire_Load(&buffer->write_index);
+    int64_t begin = subtle::NoBarrier_Load(&buffer->read_index);
+    if (end - begin > kRingEvents - 1) {
+      dropped += end + 1 - kRingEvents - begin;
+      begin = end + 1 - kRingEvents;
+    }
+
+    size_t first = events.size();
+    for (int64_t index = begin; index < end; ++index) {
+      int64_t slot = index % kRingEvents;
+      const TraceChunk* chunk = reinterpret_cast<const TraceChunk*>(
+          subtle::Acquire_Load(&buffer->chunks[slot / kChunkEvents]));
+      FlushedEvent flushed = {chunk->events[slot % kChunkEvents],
+                              subtle::NoBarrier_Load(&buffer->tid)};
+      events.push_back(flushed);
+    }
+
+    // The owner kept recording while we copied: slots it reached again, or
+    // is writing, may have been overwritten under us. Their copies can't be
+    // trusted.
+    subtle::MemoryBarrier();
+    int64_t overwritten =
+        subtle::NoBarrier_Load(&buffer->write_index) + 1 - kRingEvents - begin;
+    if (overwritten > 0) {
+      if (overwritten > end - begin)
+        overwritten = end - begin;
+      events.erase(events.begin() + first,
+                   events.begin() + first + overwritten);
+      dropped += overwritten;
+    }
+    subtle::Release_Store(&buffer->read_index, end);
+  }
+
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    pthread_mutex_unlock(&flush_lock_);
+    return false;
+  }
+  fprintf(file, "{\"traceEvents\":[");
+  pid_t pid = getpid();
+  for (size_t i = 0; i < events.size(); ++i) {
+    const TraceEvent& event = events[i].event;
+    fprintf(file, "%s\n{\"ph\":\"%c\",\"cat\":", i ? "," : "", event.phase);
+    WriteJsonString(file, event.category);
+    fprintf(file, ",\"name\":");
+    WriteJsonString(file, event.name);
+    fprintf(file, ",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+            (event.timestamp_ns - start_ns_) / 1e3, pid, events[i].tid);
+    if (event.phase == kTraceEventCounter)
+      fprintf(file, ",\"args\":{\"value\":%lld}",
+              static_cast<long long>(event.value));
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ns\",");
+  fprintf(file, "\"otherData\":{\"dropped_events\":\"%lld\"}}\n",
+          static_cast<long long>(dropped));
+  bool ok = fclose(file) == 0;
+  pthread_mutex_unlock(&flush_lock_);
+  return ok;
+}
+
+namespace internal {
+
+void DeleteTraceLogForTesting::Delete() {
+  TraceLog* trace_log = reinterpret_cast<TraceLog*>(
+      subtle::NoBarrier_Load(&TraceLogSingleton::instance_));
+  if (!trace_log)
+    return;
+  LeakySingletonTraits<TraceLog>::Delete(trace_log);
+  TraceLogSingleton::ClearInstance();
+}
+
+}  // namespace internal
+}  // namespace base
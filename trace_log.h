@@ -0,0 +1,121 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// TraceLog collects trace events recorded with the macros of trace_event.h
+// and writes them out in the JSON trace event format that chrome://tracing
+// and Perfetto load.
+//
+// Every thread records into its own ring of fixed size chunks, allocated as
+// the thread needs them. Recording an event writes only to memory owned by
+// the calling thread: no lock, no shared counter. Once the ring is full the
+// oldest events are overwritten, so a thread that traces a lot keeps its most
+// recent history. Flush() drains the rings of all threads, including those
+// that have exited, concurrently with recording.
+//
+// Example usage:
+//   TraceLog::GetInstance()->SetEnabled(true);
+//   ...
+//   TraceLog::GetInstance()->Flush("/tmp/trace.json");
+
+#ifndef BASE_DEBUG_TRACE_LOG_H_
+#define BASE_DEBUG_TRACE_LOG_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "atomicops.h"
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+
+namespace internal {
+
+// Non-zero while tracing is enabled. Checked inline by the trace macros, so
+// that a disabled TraceLog costs a load.
+BASE_EXPORT extern subtle::Atomic32 g_trace_log_enabled;
+
+inline bool TraceLogEnabled() {
+  return subtle::NoBarrier_Load(&g_trace_log_enabled) != 0;
+}
+
+// Deletes the TraceLog, which is otherwise leaked at exit, so that tests can
+// check that tracing afterwards recreates it. No other thread may be
+// recording events.
+class BASE_EXPORT DeleteTraceLogForTesting {
+ public:
+  static void Delete();
+};
+
+}  // namespace internal
+
+// Phases of a trace event, as spelled in the JSON trace format.
+enum TraceEventPhase {
+  kTraceEventBegin = 'B',
+  kTraceEventEnd = 'E',
+  kTraceEventCounter = 'C',
+};
+
+class BASE_EXPORT TraceLog {
+ public:
+  static TraceLog* GetInstance();
+
+  void SetEnabled(bool enabled);
+  bool IsEnabled() const;
+
+  // Records an event on the calling thread. |category| and |name| must be
+  // string literals, or otherwise outlive the TraceLog: only the pointers are
+  // stored. |value| is the value of counter events.
+  void AddEvent(TraceEventPhase phase,
+                const char* category,
+                const char* name,
+                int64_t value);
+
+  // Writes the events recorded since the previous Flush() to |path| as a
+  // JSON trace, and drops them from the buffers. Events overwritten before
+  // they could be flushed are counted in the "dropped_events" metadata.
+  // Returns false if the file can't be written; the events are lost then.
+  bool Flush(const std::string& path);
+
+ private:
+  friend struct DefaultSingletonTraits<TraceLog>;
+  friend class internal::DeleteTraceLogForTesting;
+
+  struct ThreadBuffer;
+
+  TraceLog();
+  ~TraceLog();
+
+  // Returns the buffer of the calling thread, taking over the drained buffer
+  // of an exited thread or allocating one.
+  ThreadBuffer* GetThreadBuffer();
+
+  // pthread key destructor: gives the buffer of an exiting thread back.
+  static void OnThreadExit(void* buffer);
+
+  // Identifies this instance to the threads that cached their buffer.
+  const subtle::AtomicWord generation_;
+
+  // Buffers of all threads, including exited ones, newest first. Buffers are
+  // only freed with the TraceLog.
+  subtle::AtomicWord buffers_;
+
+  // Serializes Flush() calls. Never taken when recording.
+  pthread_mutex_t flush_lock_;
+
+  pthread_key_t thread_exit_key_;
+
+  // Flush() timestamps are relative to this, in nanoseconds.
+  int64_t start_ns_;
+
+  TraceLog(const TraceLog&) = delete;
+  TraceLog& operator=(const TraceLog&) = delete;
+};
+
+}  // namespace base
+
+#endif  // BASE_DEBUG_TRACE_LOG_H_
@@ -0,0 +1,135 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "weak_singleton.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace base {
+namespace internal {
+
+namespace {
+
+struct ReapTask {
+  int64_t deadline_ms;
+  void (*callback)();
+
+  // Orders the heap so that the earliest deadline is on top.
+  bool operator<(const ReapTask& other) const {
+    return deadline_ms > other.deadline_ms;
+  }
+};
+
+// State of the reaper thread. Leaked on purpose so that reaps posted during
+// static destruction don't touch a destroyed object.
+struct Reaper {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  std::vector<ReapTask> tasks;
+};
+
+Reaper* g_reaper = NULL;
+pthread_once_t g_reaper_once = PTHREAD_ONCE_INIT;
+
+void* ReaperMain(void* /*unused*/) {
+  Reaper* reaper = g_reaper;
+  pthread_mutex_lock(&reaper->lock);
+  while (true) {
+    if (reaper->tasks.empty()) {
+      pthread_cond_wait(&reaper->cond, &reaper->lock);
+      continue;
+    }
+
+    int64_t deadline_ms = reaper->tasks.front().deadline_ms;
+    if (MonotonicNowMs() < deadline_ms) {
+      struct timespec until;
+      until.tv_sec = deadline_ms / 1000;
+      until.tv_nsec = (deadline_ms % 1000) * 1000000;
+      pthread_cond_timedwait(&reaper->cond, &reaper->lock, &until);
+      continue;
+    }
+
+    std::pop_heap(reaper->tasks.begin(), reaper->tasks.end());
+    void (*callback)() = reaper->tasks.back().callback;
+    reaper->tasks.pop_back();
+
+    // Destructors may be slow or post more reaps; don't hold the lock.
+    pthread_mutex_unlock(&reaper->lock);
+    callback();
+    pthread_mutex_lock(&reaper->lock);
+  }
+  return NULL;
+}
+
+void StartReaperThread() {
+  pthread_attr_t thread_attr;
+  pthread_attr_init(&thread_attr);
+  pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  pthread_create(&thread, &thread_attr, &ReaperMain, NULL);
+  pthread_attr_destroy(&thread_attr);
+}
+
+void InitReaperSync() {
+  pthread_mutex_init(&g_reaper->lock, NULL);
+
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&g_reaper->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+}
+
+// Holding the lock across fork() keeps |tasks| consistent in the child.
+void LockReaperForFork() {
+  pthread_mutex_lock(&g_reaper->lock);
+}
+
+void UnlockReaperAfterFork() {
+  pthread_mutex_unlock(&g_reaper->lock);
+}
+
+// The child has the parent's pending reaps, which are for its own copies of
+// the instances too, but no thread to run them.
+void RestartReaperInChild() {
+  InitReaperSync();
+  StartReaperThread();
+}
+
+void StartReaper() {
+  g_reaper = new Reaper;
+  InitReaperSync();
+  StartReaperThread();
+  pthread_atfork(&LockReaperForFork, &UnlockReaperAfterFork,
+                 &RestartReaperInChild);
+}
+
+}  // namespace
+
+int64_t MonotonicNowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void PostDelayedReap(void (*callback)(), int delay_ms) {
+  pthread_once(&g_reaper_once, &StartReaper);
+
+  ReapTask task;
+  task.deadline_ms = MonotonicNowMs() + std::max(delay_ms, 0);
+  task.callback = callback;
+
+  pthread_mutex_lock(&g_reaper->lock);
+  g_reaper->tasks.push_back(task);
+  std::push_heap(g_reaper->tasks.begin(), g_reaper->tasks.end());
+  pthread_cond_signal(&g_reaper->cond);
+  pthread_mutex_unlock(&g_reaper->lock);
+}
+
+}  // namespace internal
+}  // namespace base
@@ -0,0 +1,227 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// WeakSingleton<Type> is a reference counted flavour of Singleton<Type> for
+// objects that are expensive to keep around but only used in bursts (large
+// caches, decoders, ...). Callers hold a WeakSingleton<Type>::Ref for as long
+// as they use the instance. Once the last Ref is dropped and the instance has
+// stayed unreferenced for Traits::kIdleDelayMs, it is destroyed on a
+// background thread. The next get() recreates it using the same creation race
+// protocol as Singleton<Type>::get().
+
+#ifndef BASE_MEMORY_WEAK_SINGLETON_H_
+#define BASE_MEMORY_WEAK_SINGLETON_H_
+
+#include <stdint.h>
+
+#include "atomicops.h"
+#include "base_export.h"
+#include "singleton.h"
+
+namespace base {
+namespace internal {
+
+// Runs |callback| on the shared reaper thread no sooner than |delay_ms|
+// milliseconds from now.
+BASE_EXPORT void PostDelayedReap(void (*callback)(), int delay_ms);
+
+// Returns a monotonic timestamp in milliseconds.
+BASE_EXPORT int64_t MonotonicNowMs();
+
+}  // namespace internal
+
+// Default traits for WeakSingleton<Type>. Same allocation functions as
+// DefaultSingletonTraits, plus the idle delay.
+template <typename Type>
+struct SINGLETON_EXPORT DefaultWeakSingletonTraits
+    : public DefaultSingletonTraits<Type> {
+  // Number of milliseconds the instance is kept alive after the last Ref to it
+  // was dropped. A new Ref taken within that window reuses the instance.
+  static const int kIdleDelayMs = 1000;
+};
+
+// Example usage:
+//
+//   WeakSingleton<GlyphCache>::Ref cache = WeakSingleton<GlyphCache>::get();
+//   cache->Lookup(...);
+//
+// Unlike Singleton<>, get() is public: the returned Ref keeps the instance
+// alive, so there is no raw pointer that could be cached past its lifetime.
+// Do not hand out raw pointers obtained from a Ref beyond the Ref's lifetime.
+//
+// Acquiring a Ref costs one atomic increment on top of the acquire load done
+// by Singleton::get(). Reclamation never blocks acquirers for long: the
+// reaper claims the instance with kBeingCreatedMarker, backs off if a Ref was
+// taken in the meantime, and otherwise resets it to 0 before running the
+// destructor. Acquirers that observe the marker wait exactly as they would
+// for a concurrent creation; those that come during the destructor create a
+// new instance, so the old and the new one may briefly coexist.
+template <typename Type,
+          typename Traits = DefaultWeakSingletonTraits<Type>,
+          typename DifferentiatingType = Type>
+class SINGLETON_EXPORT WeakSingleton {
+ public:
+  // Scoped reference to the instance. Movable, not copyable.
+  class Ref {
+   public:
+    Ref() : ptr_(NULL) {}
+    Ref(Ref&& other) : ptr_(other.ptr_) { other.ptr_ = NULL; }
+    ~Ref() { reset(); }
+
+    Ref& operator=(Ref&& other) {
+      if (this != &other) {
+        reset();
+        ptr_ = other.ptr_;
+        other.ptr_ = NULL;
+      }
+      return *this;
+    }
+
+    // Drops the reference early.
+    void reset() {
+      if (ptr_) {
+        ptr_ = NULL;
+        WeakSingleton::Release();
+      }
+    }
+
+    Type* get() const { return ptr_; }
+    Type* operator->() const { return ptr_; }
+    Type& operator*() const { return *ptr_; }
+    explicit operator bool() const { return ptr_ != NULL; }
+
+   private:
+    friend class WeakSingleton;
+    explicit Ref(Type* ptr) : ptr_(ptr) {}
+
+    Ref(const Ref&) = delete;
+    Ref& operator=(const Ref&) = delete;
+
+    Type* ptr_;
+  };
+
+  // Returns a reference to the instance, creating it if needed.
+  static Ref get() { return Ref(Acquire()); }
+
+ private:
+  static Type* Acquire() {
+    // The reference must be visible before we look at instance_, so that a
+    // concurrent Reap() either sees it and backs off, or has already replaced
+    // instance_ with kBeingCreatedMarker / 0 by the time we load it.
+    subtle::Barrier_AtomicIncrement(&ref_count_, 1);
+
+    while (true) {
+      subtle::AtomicWord value = subtle::Acquire_Load(&instance_);
+      if (value != 0 && value != internal::kBeingCreatedMarker)
+        return reinterpret_cast<Type*>(value);
+
+      if (value == 0) {
+        // Lets a child forked from here on undo the marker if we set it.
+        int creation = internal::BeginSingletonCreation(&instance_);
+        if (subtle::Acquire_CompareAndSwap(&instance_, 0,
+                                           internal::kBeingCreatedMarker) ==
+            0) {
+          internal::SingletonCreation frame = {&instance_,
+                                               __PRETTY_FUNCTION__, NULL};
+          internal::PushSingletonCreation(&frame);
+          Type* newval = Traits::New();
+          internal::PopSingletonCreation(&frame);
+          subtle::Release_Store(&instance_,
+                                reinterpret_cast<subtle::AtomicWord>(newval));
+          internal::EndSingletonCreation(creation);
+          return newval;
+        }
+        internal::EndSingletonCreation(creation);
+      }
+
+      // Either a creation or a reclamation is in progress. A reclamation that
+      // completes leaves 0 behind, in which case we retry the creation race.
+      value = internal::WaitForInstance(&instance_);
+      if (value != 0)
+        return reinterpret_cast<Type*>(value);
+    }
+  }
+
+  static void Release() {
+    if (subtle::Barrier_AtomicIncrement(&ref_count_, -1) != 0)
+      return;
+
+    subtle::NoBarrier_Store(&last_release_ms_, internal::MonotonicNowMs());
+    subtle::MemoryBarrier();
+    // Only one reap task is pending at a time; it reschedules itself while the
+    // instance keeps being used.
+    if (subtle::NoBarrier_CompareAndSwap(&reap_pending_, 0, 1) == 0)
+      internal::PostDelayedReap(&Reap, Traits::kIdleDelayMs);
+  }
+
+  // Runs on the reaper thread.
+  static void Reap() {
+    subtle::NoBarrier_AtomicExchange(&reap_pending_, 0);
+    subtle::MemoryBarrier();
+    if (subtle::NoBarrier_Load(&ref_count_) != 0)
+      return;  // The next Release() schedules another reap.
+
+    int64_t idle_ms =
+        internal::MonotonicNowMs() - subtle::NoBarrier_Load(&last_release_ms_);
+    if (idle_ms < Traits::kIdleDelayMs) {
+      if (subtle::NoBarrier_CompareAndSwap(&reap_pending_, 0, 1) == 0) {
+        internal::PostDelayedReap(
+            &Reap, static_cast<int>(Traits::kIdleDelayMs - idle_ms));
+      }
+      return;
+    }
+
+    subtle::AtomicWord value = subtle::Acquire_Load(&instance_);
+    if (value == 0 || value == internal::kBeingCreatedMarker)
+      return;
+    // A child forked while we hold the marker forgets the instance.
+    int creation = internal::BeginSingletonCreation(&instance_);
+    if (subtle::Acquire_CompareAndSwap(&instance_, value,
+                                       internal::kBeingCreatedMarker) != value) {
+      internal::EndSingletonCreation(creation);
+      return;
+    }
+
+    // Pairs with the increment in Acquire(): whoever took a reference after
+    // our check above either sees the marker and waits, or we see its
+    // reference here and hand the instance back.
+    subtle::MemoryBarrier();
+    if (subtle::NoBarrier_Load(&ref_count_) != 0) {
+      subtle::Release_Store(&instance_, value);
+      internal::EndSingletonCreation(creation);
+      return;
+    }
+
+    // Nobody can reach the instance anymore. Let acquirers create a new one
+    // right away rather than wait for the destructor.
+    subtle::Release_Store(&instance_, 0);
+    internal::EndSingletonCreation(creation);
+    Traits::Delete(reinterpret_cast<Type*>(value));
+  }
+
+  static subtle::AtomicWord instance_;
+  static subtle::AtomicWord ref_count_;
+  static subtle::AtomicWord last_release_ms_;
+  static subtle::Atomic32 reap_pending_;
+};
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+subtle::AtomicWord WeakSingleton<Type, Traits, DifferentiatingType>::instance_ =
+    0;
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+subtle::AtomicWord
+    WeakSingleton<Type, Traits, DifferentiatingType>::ref_count_ = 0;
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+subtle::AtomicWord
+    WeakSingleton<Type, Traits, DifferentiatingType>::last_release_ms_ = 0;
+
+template <typename Type, typename Traits, typename DifferentiatingType>
+subtle::Atomic32
+    WeakSingleton<Type, Traits, DifferentiatingType>::reap_pending_ = 0;
+
+}  // namespace base
+
+#endif  // BASE_MEMORY_WEAK_SINGLETON_H_